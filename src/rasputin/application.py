@@ -39,6 +39,17 @@ def store_tin():
     arg_parser.add_argument("-polyfile", type=str, help="Polygon definition in WKT or WKB format", default="")
     arg_parser.add_argument("-target-coordinate-system", type=str, default="EPSG:32633", help="Target coordinate system")
     arg_parser.add_argument("-ratio", type=float, default=0.4, help="Mesh coarsening factor in [0, 1]")
+    arg_parser.add_argument("-parallel", action="store_true", help="Coarsen spatial partitions of the mesh in parallel")
+    arg_parser.add_argument("-resolution", type=float, default=None,
+                            help="Mesh a raster overview with at most this point spacing, in raster units")
+    arg_parser.add_argument("-max-raster-points", type=int, default=None,
+                            help="Mesh a raster overview with at most this number of points inside the polygon")
+    arg_parser.add_argument("-overview-reduction", type=str, default="average",
+                            choices=["average", "minimum", "maximum", "nearest"],
+                            help="Filter used for building raster overviews")
+    arg_parser.add_argument("-warp", action="store_true",
+                            help="Resample the rasters to the target coordinate system before meshing, "
+                                 "also when they are in different coordinate systems")
 
     arg_parser.add_argument("-override", action="store_true", help="Replace existing archive entry")
     arg_parser.add_argument("-land-type-partition",
@@ -101,44 +112,50 @@ def store_tin():
     target_crs = pyproj.CRS.from_string(f"+init={res.target_coordinate_system}")
     target_domain = input_domain.transform(target_crs=target_crs)
 
-    raster_repo = RasterRepository(directory=dem_archive)
-    raster_crs = pyproj.CRS.from_string(raster_repo.coordinate_system(domain=target_domain))
-    raster_domain = input_domain.transform(target_crs=raster_crs)
+    raster_repo = RasterRepository(directory=dem_archive, reduction=res.overview_reduction)
+    if res.warp:
+        # Mesh directly in the target coordinate system
+        raster_crs = target_crs
+        raster_domain = target_domain
+        raster_data_list = [raster_repo.read_warped(domain=raster_domain,
+                                                    target_crs=target_crs,
+                                                    resolution=res.resolution,
+                                                    max_points=res.max_raster_points)]
+    else:
+        raster_crs = pyproj.CRS.from_string(raster_repo.coordinate_system(domain=target_domain))
+        raster_domain = input_domain.transform(target_crs=raster_crs)
+        raster_data_list = raster_repo.read(domain=raster_domain,
+                                            resolution=res.resolution,
+                                            max_points=res.max_raster_points)
 
-    raster_data_list = raster_repo.read(domain=raster_domain)
+    lt_repo = None
+    if res.land_type_partition:
+        if res.land_type_partition == "corine":
+            lt_repo = gml_repository.GMLRepository(path=corine_archive)
+        else:
+            lt_repo = globcov_repository.GlobCovRepository(path=gc_archive)
 
+    # Keep land cover boundaries, like shorelines, as break lines through the simplification
+    constraints = lt_repo.constraints(domain=raster_domain) if lt_repo else None
     mesh = (Mesh.from_raster(data=raster_data_list,
-                             domain=raster_domain)
-            .simplify(ratio=res.ratio))
+                             domain=raster_domain,
+                             constraints=constraints)
+            .simplify(ratio=res.ratio, parallel=res.parallel, reorder=True))
 
 
     assert len(mesh.points), "No tin extracted, something went wrong..."
     if raster_crs.to_authority() != target_crs.to_authority():
-        points, faces = mesh.points, mesh.faces
-        proj = pyproj.Transformer.from_crs(raster_crs, target_crs)
-        x, y, z = proj.transform(points[:, 0],
-                                 points[:, 1],
-                                 points[:, 2])
-        points = np.dstack([x, y, z]).reshape(-1, 3)
-        mesh = Mesh.from_points_and_faces(points=points, faces=faces, proj4_str=target_crs.to_proj4())
+        mesh = mesh.reproject(target_crs)
 
-    if res.land_type_partition:
-        if res.land_type_partition == "corine":
-            lt_repo = gml_repository.GMLRepository(path=corine_archive)
-        else:
-            lt_repo = globcov_repository.GlobCovRepository(path=gc_archive)
+    if lt_repo:
         geo_cell_centers = GeoPoints(xy=mesh.cell_centers[:, :2],
                                      crs=target_crs)
         terrain_cover = lt_repo.land_cover(land_types=None,
                                            geo_points=geo_cell_centers,
                                            domain=target_domain)
         terrain_colors = np.empty((terrain_cover.shape[0], 3), dtype='d')
-        extracted_terrain_types = set()
-        for i, cell in enumerate(terrain_cover):
-            if cell not in extracted_terrain_types:
-                extracted_terrain_types.add(cell)
         meta_info = lt_repo.land_cover_meta_info_type
-        for tt in extracted_terrain_types:
+        for tt in np.unique(terrain_cover):
             cover = lt_repo.land_cover_type(tt)
             color = [c/255 for c in meta_info.color(land_cover_type=cover)]
             terrain_colors[terrain_cover == tt] = color
@@ -1,5 +1,6 @@
 #include "triangulate_dem.h"
 #include "solar_position.h"
+#include "geotiff.h"
 #include <pybind11/pybind11.h>
 #include <pybind11/stl_bind.h>
 #include <pybind11/stl.h>
@@ -25,6 +26,9 @@ PYBIND11_MAKE_OPAQUE(rasputin::point2_vector);
 PYBIND11_MAKE_OPAQUE(rasputin::face_vector);
 PYBIND11_MAKE_OPAQUE(rasputin::double_vector);
 PYBIND11_MAKE_OPAQUE(rasputin::index_vector);
+PYBIND11_MAKE_OPAQUE(rasputin::point3f_vector);
+PYBIND11_MAKE_OPAQUE(rasputin::face_u32_vector);
+PYBIND11_MAKE_OPAQUE(rasputin::face_i64_vector);
 PYBIND11_MAKE_OPAQUE(CGAL::MultiPolygon);
 PYBIND11_MAKE_OPAQUE(std::vector<rasputin::RasterData<float>>);
 PYBIND11_MAKE_OPAQUE(std::vector<rasputin::RasterData<double>>);
@@ -41,36 +45,29 @@ py::buffer_info vecarray_buffer(std::vector<std::array<T, n>> &v) {
     );
 }
 
-template<typename T, std::size_t n>
-std::vector<std::array<T, n>>* vecarray_from_numpy(py::array_t<T> buf) {
-    auto info = buf.request();
-    if (info.ndim < 1 or info.ndim > 2)
+// Number of rows of n values in a one- or two-dimensional array
+template<std::size_t n, typename A>
+std::size_t checked_rows(const A& buf) {
+    if (buf.ndim() < 1 or buf.ndim() > 2)
         throw py::type_error("Can only convert one- and two-dimensional arrays.");
 
     // Make sure total size can be preserved
-    auto size = info.shape[0];
-    if (info.ndim == 1 and size % n)
-        throw py::type_error("Size of one-dimensional array must be divisible by!" + std::to_string(n) + ".");
+    if (buf.ndim() == 1 and buf.shape(0) % n)
+        throw py::type_error("Size of one-dimensional array must be divisible by " + std::to_string(n) + ".");
 
-    if (info.ndim == 2 and info.shape[1] != n)
+    if (buf.ndim() == 2 and buf.shape(1) != n)
         throw py::type_error("Second dimension does not have size equal to " + std::to_string(n) + ".");
 
-    if (info.ndim == 2)
-        size *= n;
-
-    auto vec = std::unique_ptr<std::vector<std::array<T, n>>> (new std::vector<std::array<T, n>> ());
-    vec->reserve(size / n);
+    return buf.size() / n;
+}
 
-    // Copy values
-    double* p = static_cast<double*>(info.ptr);
-    double* end = p + size;
-    for (; p < end; p += n) {
-        auto a = std::array<T, n> {};
-        for (auto k = 0; k < n; k++)
-            a[k] = *(p + k);
-        vec->push_back(a);
-    }
+template<typename T, std::size_t n>
+std::vector<std::array<T, n>>* vecarray_from_numpy(py::array_t<T, py::array::c_style | py::array::forcecast> buf) {
+    const auto rows = checked_rows<n>(buf);
+    auto vec = std::unique_ptr<std::vector<std::array<T, n>>> (new std::vector<std::array<T, n>> (rows));
 
+    // The array is contiguous and of type T, so the values are copied in one go
+    std::copy_n(buf.data(), rows*n, vec->empty() ? nullptr : vec->front().data());
     return vec.release();
 }
 
@@ -145,16 +142,46 @@ CGAL::SimplePolygon polygon_from_numpy(py::array_t<double>& buf) {
         return exterior;
 }
 
+// Data of a caller owned float64 output array of the given shape, or null for None
+double* output_buffer(const py::object& obj, const std::vector<py::ssize_t>& shape, const char* name) {
+    if (obj.is_none())
+        return nullptr;
+    if (not py::isinstance<py::array_t<double>>(obj))
+        throw py::type_error(std::string(name) + " must be a float64 array.");
+    auto array = obj.cast<py::array_t<double>>();
+    if (not (array.flags() & py::array::c_style) or not array.writeable())
+        throw py::value_error(std::string(name) + " must be a writeable C-contiguous array.");
+    if (std::vector<py::ssize_t>(array.shape(), array.shape() + array.ndim()) != shape)
+        throw py::value_error(std::string(name) + " has the wrong shape.");
+    return array.mutable_data();
+}
+
 template<typename FT>
 void bind_rasterdata(py::module &m, const std::string& pyname) {
     py::class_<rasputin::RasterData<FT>, std::unique_ptr<rasputin::RasterData<FT>>>(m, pyname.c_str(), py::buffer_protocol())
-    .def(py::init([] (py::array_t<FT>& data_array, double x_min, double y_max, double delta_x, double delta_y) {
+    .def(py::init([] (py::array_t<FT>& data_array, double x_min, double y_max, double delta_x, double delta_y,
+                      std::optional<FT> nodata, std::optional<py::array> mask_array) {
             auto buffer = data_array.request();
             int m = buffer.shape[0], n = buffer.shape[1];
 
-            return rasputin::RasterData<FT>(x_min, y_max, delta_x, delta_y, n, m, static_cast<FT*>(buffer.ptr) );
-        }), py::return_value_policy::take_ownership,  py::keep_alive<1, 2>(),
-            py::arg("data_array").noconvert(), py::arg("x_min"), py::arg("y_max"), py::arg("delta_x"), py::arg("delta_y"))
+            // The mask is read in place, as bytes in row major order, so it can not be converted
+            const std::uint8_t* mask = nullptr;
+            if (mask_array) {
+                const char kind = mask_array->dtype().kind();
+                if (not (kind == 'b' or kind == 'u') or mask_array->itemsize() != 1)
+                    throw py::type_error("Mask must be a bool or uint8 array.");
+                if (mask_array->ndim() != 2 or mask_array->shape(0) != m or mask_array->shape(1) != n)
+                    throw py::value_error("Mask must have the same shape as the data array.");
+                if (not (mask_array->flags() & py::array::c_style))
+                    throw py::value_error("Mask must be a C-contiguous array.");
+                mask = static_cast<const std::uint8_t*>(mask_array->data());
+            }
+
+            return rasputin::RasterData<FT>(x_min, y_max, delta_x, delta_y, n, m, static_cast<FT*>(buffer.ptr),
+                                            nodata, mask);
+        }), py::return_value_policy::take_ownership,  py::keep_alive<1, 2>(), py::keep_alive<1, 8>(),
+            py::arg("data_array").noconvert(), py::arg("x_min"), py::arg("y_max"), py::arg("delta_x"), py::arg("delta_y"),
+            py::arg("nodata") = py::none(), py::arg("mask").noconvert() = py::none())
     .def_buffer([] (rasputin::RasterData<FT>& self) {
             return py::buffer_info(
                 self.data,
@@ -173,21 +200,106 @@ void bind_rasterdata(py::module &m, const std::string& pyname) {
     .def_readonly("num_points_y", &rasputin::RasterData<FT>::num_points_y)
     .def_property_readonly("x_max", &rasputin::RasterData<FT>::get_x_max)
     .def_property_readonly("y_min", &rasputin::RasterData<FT>::get_y_min)
+    .def_readonly("nodata", &rasputin::RasterData<FT>::nodata)
+    .def("is_valid_at", &rasputin::RasterData<FT>::is_valid_at)
+    .def("validity_mask", [] (const rasputin::RasterData<FT>& self) {
+            const auto mask = self.validity_mask();
+            py::array_t<bool> result({self.num_points_y, self.num_points_x});
+            std::copy(mask.begin(), mask.end(), static_cast<bool*>(result.request().ptr));
+            return result;
+        }, "Boolean array that is false at nodata and NaN samples.")
     .def("__getitem__", [](rasputin::RasterData<FT>& self, std::pair<int, int> idx) {
                 auto [i, j] = idx;
                 return self.data[self.num_points_x * i + j]; })
     .def("get_indices", &rasputin::RasterData<FT>::get_indices)
     .def("exterior", &rasputin::RasterData<FT>::exterior, py::return_value_policy::take_ownership)
     .def("contains", &rasputin::RasterData<FT>::contains)
-    .def("get_interpolated_value_at_point", &rasputin::RasterData<FT>::get_interpolated_value_at_point);
+    .def("get_interpolated_value_at_point", &rasputin::RasterData<FT>::get_interpolated_value_at_point)
+    .def("sample",
+         [] (const rasputin::RasterData<FT>& self, py::array_t<double, py::array::c_style | py::array::forcecast> xy,
+             rasputin::SamplingPolicy policy, bool gradients) -> py::object {
+            const std::size_t n = checked_rows<2>(xy);
+            py::array_t<double> heights(n);
+            py::array_t<double> grads(std::vector<std::size_t>{gradients ? n : 0, 2});
+            const double* points = xy.data();
+            double* h = heights.mutable_data();
+            double* g = gradients ? grads.mutable_data() : nullptr;
+            {
+                py::gil_scoped_release release;
+                rasputin::sample_raster(self, points, n, policy, h, g);
+            }
+            if (gradients)
+                return py::make_tuple(heights, grads);
+            return std::move(heights);
+        },
+        py::arg("xy"), py::arg("policy") = rasputin::SamplingPolicy::bilinear, py::arg("gradients") = false,
+        "Heights at an (n, 2) array of points, and their (n, 2) gradients if asked for. Voids and points outside are NaN.")
+    .def("terrain_attributes",
+         [] (const rasputin::RasterData<FT>& self, py::object slopes, py::object aspects, py::object curvatures) {
+            const std::vector<py::ssize_t> shape{py::ssize_t(self.num_points_y), py::ssize_t(self.num_points_x)};
+            rasputin::RasterTerrainAttributeBuffers out;
+            out.slopes = output_buffer(slopes, shape, "slopes");
+            out.aspects = output_buffer(aspects, shape, "aspects");
+            out.curvatures = output_buffer(curvatures, shape, "curvatures");
+            py::gil_scoped_release release;
+            rasputin::raster_terrain_attributes(self, out);
+        },
+        py::arg("slopes") = py::none(), py::arg("aspects") = py::none(), py::arg("curvatures") = py::none(),
+        "Compute the requested slopes, aspects and curvatures at the raster points in one multithreaded pass, into "
+        "float64 arrays of the raster shape. Border points and points next to voids are NaN.");
+}
+
+template<typename FT>
+void bind_downsample(py::module &m) {
+    m.def("downsample",
+          [] (const rasputin::RasterData<FT>& raster, std::size_t factor, rasputin::RasterReduction reduction) {
+              std::vector<FT> samples;
+              {
+                  py::gil_scoped_release release;
+                  samples = rasputin::downsample(raster, factor, reduction);
+              }
+              py::array_t<FT> result({(raster.num_points_y - 1)/factor + 1, (raster.num_points_x - 1)/factor + 1});
+              std::copy(samples.begin(), samples.end(), result.mutable_data());
+              return result;
+          },
+          py::arg("raster"), py::arg("factor"), py::arg("reduction") = rasputin::RasterReduction::average,
+          "Raster samples coarsened by an integer factor, with voids left out of the reduction.");
+}
+
+template<typename FT>
+void bind_warp_rasters(py::module &m) {
+    m.def("warp_rasters",
+          [] (const std::vector<rasputin::RasterData<FT>>& sources, const std::vector<std::string>& source_proj4s,
+              const std::string& target_proj4, double x_min, double y_max, double delta_x, double delta_y,
+              std::size_t num_points_x, std::size_t num_points_y, rasputin::SamplingPolicy policy, std::size_t step) {
+              const rasputin::RasterGrid grid{x_min, y_max, delta_x, delta_y, num_points_x, num_points_y};
+              std::vector<FT> samples;
+              {
+                  py::gil_scoped_release release;
+                  samples = rasputin::warp_rasters(sources, source_proj4s, target_proj4, grid, policy, step);
+              }
+              py::array_t<FT> result({num_points_y, num_points_x});
+              std::copy(samples.begin(), samples.end(), result.mutable_data());
+              return result;
+          },
+          py::arg("sources"), py::arg("source_proj4s"), py::arg("target_proj4"), py::arg("x_min"), py::arg("y_max"),
+          py::arg("delta_x"), py::arg("delta_y"), py::arg("num_points_x"), py::arg("num_points_y"),
+          py::arg("policy") = rasputin::SamplingPolicy::bilinear, py::arg("step") = 16,
+          "Source rasters resampled onto a grid in the target coordinate system, with the first source covering "
+          "a point taking priority and NaN where none do.");
 }
 
 template<typename R, typename P>
 void bind_make_mesh(py::module &m) {
         m.def("make_mesh",
-            [] (const R& raster_data, const P polygon, const std::string proj4_str) {
+            [] (const R& raster_data, const P& polygon, const std::string proj4_str) {
                 return rasputin::mesh_from_raster(raster_data, polygon, proj4_str);
-            }, py::return_value_policy::take_ownership)
+            }, py::return_value_policy::take_ownership, py::call_guard<py::gil_scoped_release>())
+        .def("make_mesh",
+            [] (const R& raster_data, const P& polygon, const CGAL::MultiPolygon& break_lines, const std::string proj4_str) {
+                return rasputin::mesh_from_raster(raster_data, polygon, proj4_str, break_lines);
+            }, py::return_value_policy::take_ownership, py::call_guard<py::gil_scoped_release>(),
+            "Mesh the raster inside the polygon, with the boundaries of the break line polygons as constrained edges.")
         .def("make_mesh",
             [] (const R& raster_data, const std::string proj4_str) {
                 return rasputin::mesh_from_raster(raster_data, proj4_str);
@@ -208,20 +320,162 @@ void bind_raster_list(py::module &m, const std::string& pyname) {
             }, py::return_value_policy::reference_internal);
 }
 
+template<typename R>
+auto lindstrom_turk_by_vertical_error() {
+    return [] (const rasputin::Mesh& self, const R& raster, double max_error) {
+        return self.coarsen_by_vertical_error(raster, max_error, SMS::LindstromTurk_placement<CGAL::Mesh>());
+    };
+}
+
+// Mesh read straight from the numpy buffers, which are only copied if not of the right type. Faces
+// with 64 bit (I) indices are read as they are, and indices out of range are rejected, not narrowed.
+template<typename I>
+rasputin::Mesh construct_mesh_from_numpy(py::array_t<double, py::array::c_style | py::array::forcecast> points,
+                                         py::array_t<I, py::array::c_style | py::array::forcecast> faces,
+                                         const std::string proj4_str) {
+    const auto num_points = checked_rows<3>(points);
+    const auto num_faces = checked_rows<3>(faces);
+    CGAL::Mesh mesh;
+    {
+        py::gil_scoped_release release;
+        mesh = rasputin::construct_mesh(points.data(), num_points, faces.data(), num_faces);
+    }
+    return rasputin::Mesh(std::move(mesh), proj4_str);
+}
+
+// Mesh with a face or vertex (I) attribute, which is int for integer and boolean arrays and double otherwise
+template<typename I>
+rasputin::Mesh with_attribute(const rasputin::Mesh& self, const std::string& name, py::array values,
+                              const std::string& policy) {
+    if (values.ndim() != 1)
+        throw py::type_error("Attribute values must be a one-dimensional array.");
+    const char kind = values.dtype().kind();
+    if (kind == 'i' or kind == 'u' or kind == 'b') {
+        const auto array = py::array_t<int, py::array::c_style | py::array::forcecast>::ensure(values);
+        return self.with_attribute<I, int>(name, std::vector<int>(array.data(), array.data() + array.size()), policy);
+    }
+    const auto array = py::array_t<double, py::array::c_style | py::array::forcecast>::ensure(values);
+    if (not array)
+        throw py::type_error("Attribute values must be numbers.");
+    return self.with_attribute<I, double>(name, std::vector<double>(array.data(), array.data() + array.size()), policy);
+}
+
+// Attributes of the faces or vertices (I) as a dict of arrays
+template<typename I>
+py::dict attributes(const rasputin::Mesh& self) {
+    py::dict result;
+    for (const auto& [name, type]: self.attributes<I>()) {
+        if (type == "int") {
+            const auto values = self.attribute<I, int>(name);
+            result[py::str(name)] = py::array_t<int>(values.size(), values.data());
+        } else {
+            const auto values = self.attribute<I, double>(name);
+            result[py::str(name)] = py::array_t<double>(values.size(), values.data());
+        }
+    }
+    return result;
+}
+
+template<typename T>
+void bind_raster_mosaic(py::module &m, const std::string& pyname) {
+    py::class_<rasputin::RasterMosaic<T>, std::unique_ptr<rasputin::RasterMosaic<T>>>(m, pyname.c_str())
+        .def(py::init<const std::vector<rasputin::RasterData<T>>&, rasputin::MosaicPolicy>(),
+             py::keep_alive<1, 2>(),
+             py::arg("raster_list"), py::arg("policy") = rasputin::MosaicPolicy::priority)
+        .def_readonly("x_min", &rasputin::RasterMosaic<T>::x_min)
+        .def_readonly("x_max", &rasputin::RasterMosaic<T>::x_max)
+        .def_readonly("y_min", &rasputin::RasterMosaic<T>::y_min)
+        .def_readonly("y_max", &rasputin::RasterMosaic<T>::y_max)
+        .def_property_readonly("policy", &rasputin::RasterMosaic<T>::get_policy)
+        .def("raster_points", [] (const rasputin::RasterMosaic<T>& self) {
+                const auto points = self.raster_points();
+                py::array_t<double> result({points.size(), std::size_t(3)});
+                auto r = result.template mutable_unchecked<2>();
+                for (std::size_t i = 0; i < points.size(); ++i) {
+                    r(i, 0) = points[i].x();
+                    r(i, 1) = points[i].y();
+                    r(i, 2) = points[i].z();
+                }
+                return result;
+            }, "Deduplicated raster points of the mosaic as an (n, 3) array.")
+        .def("exterior", &rasputin::RasterMosaic<T>::exterior)
+        .def("contains", &rasputin::RasterMosaic<T>::contains)
+        .def("is_valid_at", &rasputin::RasterMosaic<T>::is_valid_at)
+        .def("get_interpolated_value_at_point", &rasputin::RasterMosaic<T>::get_interpolated_value_at_point);
+}
+
+
+// Call f with a value of the sample type of the GeoTIFF
+template<typename F>
+auto with_sample_type(const rasputin::geotiff::GeoTiff& tiff, F f) {
+    using rasputin::geotiff::SampleFormat;
+    switch (tiff.sample_format) {
+        case SampleFormat::floating_point:
+            return tiff.bits_per_sample == 32 ? f(float()) : f(double());
+        case SampleFormat::signed_integer:
+            switch (tiff.bits_per_sample) {
+                case 8: return f(std::int8_t());
+                case 16: return f(std::int16_t());
+                default: return f(std::int32_t());
+            }
+        default:
+            switch (tiff.bits_per_sample) {
+                case 8: return f(std::uint8_t());
+                case 16: return f(std::uint16_t());
+                default: return f(std::uint32_t());
+            }
+    }
+}
+
+// Window of a GeoTIFF as an array of its sample type. Uncompressed images are
+// returned as read only views of the file mapping, kept alive by self.
+py::array read_geotiff(const py::object& self, std::size_t row, std::size_t col, std::size_t rows, std::size_t cols) {
+    const auto& tiff = self.cast<const rasputin::geotiff::GeoTiff&>();
+    const rasputin::geotiff::Window window{row, col, rows, cols};
+    if (row + rows > tiff.height or col + cols > tiff.width)
+        throw py::index_error("Window outside of image");
+
+    return with_sample_type(tiff, [&] (auto sample) -> py::array {
+        using T = decltype(sample);
+        if (tiff.is_mapped()) {
+            const T* data = static_cast<const T*>(tiff.mapped_data()) + row*tiff.width + col;
+            py::array_t<T> view({rows, cols}, {sizeof(T)*tiff.width, sizeof(T)}, data, self);
+            view.attr("flags").attr("writeable") = false;
+            return view;
+        }
+        py::array_t<T> result({rows, cols});
+        T* data = result.mutable_data();
+        {
+            py::gil_scoped_release release;
+            tiff.read(window, data);
+        }
+        return result;
+    });
+}
+
 
 PYBIND11_MODULE(triangulate_dem, m) {
     py::bind_vector<rasputin::point3_vector>(m, "point3_vector", py::buffer_protocol())
       .def_buffer(&vecarray_buffer<double, 3>)
-      .def("from_numpy", &vecarray_from_numpy<double, 3>);
+      .def_static("from_numpy", &vecarray_from_numpy<double, 3>);
     py::bind_vector<rasputin::point2_vector>(m, "point2_vector", py::buffer_protocol())
       .def_buffer(&vecarray_buffer<double, 2>)
-      .def("from_numpy", &vecarray_from_numpy<double, 2>);
+      .def_static("from_numpy", &vecarray_from_numpy<double, 2>);
     py::bind_vector<rasputin::face_vector>(m, "face_vector", py::buffer_protocol())
       .def_buffer(&vecarray_buffer<int, 3>)
-      .def("from_numpy", &vecarray_from_numpy<int, 3>);
+      .def_static("from_numpy", &vecarray_from_numpy<int, 3>);
     py::bind_vector<rasputin::index_vector>(m, "index_vector", py::buffer_protocol())
       .def_buffer(&vecarray_buffer<unsigned int, 2>)
-      .def("from_numpy", &vecarray_from_numpy<unsigned int, 2>);
+      .def_static("from_numpy", &vecarray_from_numpy<unsigned int, 2>);
+    py::bind_vector<rasputin::point3f_vector>(m, "point3f_vector", py::buffer_protocol())
+      .def_buffer(&vecarray_buffer<float, 3>)
+      .def_static("from_numpy", &vecarray_from_numpy<float, 3>);
+    py::bind_vector<rasputin::face_u32_vector>(m, "face_u32_vector", py::buffer_protocol())
+      .def_buffer(&vecarray_buffer<std::uint32_t, 3>)
+      .def_static("from_numpy", &vecarray_from_numpy<std::uint32_t, 3>);
+    py::bind_vector<rasputin::face_i64_vector>(m, "face_i64_vector", py::buffer_protocol())
+      .def_buffer(&vecarray_buffer<std::int64_t, 3>)
+      .def_static("from_numpy", &vecarray_from_numpy<std::int64_t, 3>);
     py::bind_vector<rasputin::double_vector >(m, "double_vector", py::buffer_protocol())
       .def_buffer(&vector_buffer<double>);
 
@@ -229,24 +483,90 @@ PYBIND11_MODULE(triangulate_dem, m) {
     py::bind_vector<std::vector<std::vector<int>>>(m, "shadow_vector");
 
 
+    py::enum_<rasputin::SamplingPolicy>(m, "sampling_policy")
+        .value("nearest", rasputin::SamplingPolicy::nearest)
+        .value("bilinear", rasputin::SamplingPolicy::bilinear)
+        .value("bicubic", rasputin::SamplingPolicy::bicubic);
+
     bind_rasterdata<float>(m, "raster_data_float");
     bind_rasterdata<double>(m, "raster_data_double");
 
     bind_raster_list<float>(m, "raster_list_float");
     bind_raster_list<double>(m, "raster_list_double");
 
+    py::class_<rasputin::geotiff::GeoTiff>(m, "GeoTiff")
+        .def(py::init<const std::string&>(), py::arg("path"))
+        .def_readonly("width", &rasputin::geotiff::GeoTiff::width)
+        .def_readonly("height", &rasputin::geotiff::GeoTiff::height)
+        .def_readonly("tiled", &rasputin::geotiff::GeoTiff::tiled)
+        .def_readonly("tile_width", &rasputin::geotiff::GeoTiff::tile_width)
+        .def_readonly("tile_height", &rasputin::geotiff::GeoTiff::tile_height)
+        .def_readonly("compression", &rasputin::geotiff::GeoTiff::compression)
+        .def_readonly("tie_point", &rasputin::geotiff::GeoTiff::tie_point)
+        .def_readonly("pixel_scale", &rasputin::geotiff::GeoTiff::pixel_scale)
+        .def_readonly("nodata", &rasputin::geotiff::GeoTiff::nodata)
+        .def_readonly("geo_keys", &rasputin::geotiff::GeoTiff::geo_keys, "GeoKey values by key id.")
+        .def_property_readonly("is_mapped", &rasputin::geotiff::GeoTiff::is_mapped)
+        .def_property_readonly("dtype", [] (const rasputin::geotiff::GeoTiff& self) {
+                return with_sample_type(self, [] (auto sample) {return py::dtype::of<decltype(sample)>(); });
+            })
+        .def("read", &read_geotiff, py::arg("row"), py::arg("col"), py::arg("rows"), py::arg("cols"),
+             "Samples of the window, decoding only the tiles that intersect it.")
+        .def("gather",
+             [] (const rasputin::geotiff::GeoTiff& self,
+                 py::array_t<std::uint32_t, py::array::c_style | py::array::forcecast> indices) {
+                const std::size_t n = checked_rows<2>(indices);
+                return with_sample_type(self, [&] (auto sample) -> py::array {
+                    using T = decltype(sample);
+                    py::array_t<T> result(n);
+                    T* data = result.mutable_data();
+                    {
+                        py::gil_scoped_release release;
+                        self.gather(indices.data(), n, data);
+                    }
+                    return result;
+                });
+            }, py::arg("indices"),
+            "Samples at an (n, 2) array of (column, row) indices, decoding each touched tile once.")
+        .def_readwrite("tile_cache_bytes", &rasputin::geotiff::GeoTiff::tile_cache_bytes);
+
+    py::enum_<rasputin::RasterReduction>(m, "raster_reduction")
+        .value("average", rasputin::RasterReduction::average)
+        .value("minimum", rasputin::RasterReduction::minimum)
+        .value("maximum", rasputin::RasterReduction::maximum)
+        .value("nearest", rasputin::RasterReduction::nearest);
+
+    bind_downsample<float>(m);
+    bind_downsample<double>(m);
+
+    bind_warp_rasters<float>(m);
+    bind_warp_rasters<double>(m);
+
+    py::enum_<rasputin::MosaicPolicy>(m, "mosaic_policy")
+        .value("priority", rasputin::MosaicPolicy::priority)
+        .value("blend", rasputin::MosaicPolicy::blend);
+
+    bind_raster_mosaic<float>(m, "raster_mosaic_float");
+    bind_raster_mosaic<double>(m, "raster_mosaic_double");
+
+    bind_make_mesh<rasputin::RasterMosaic<float>, CGAL::SimplePolygon>(m);
+    bind_make_mesh<rasputin::RasterMosaic<double>, CGAL::SimplePolygon>(m);
+    bind_make_mesh<rasputin::RasterMosaic<float>, CGAL::Polygon>(m);
+    bind_make_mesh<rasputin::RasterMosaic<double>, CGAL::Polygon>(m);
+    bind_make_mesh<rasputin::RasterMosaic<float>, CGAL::MultiPolygon>(m);
+    bind_make_mesh<rasputin::RasterMosaic<double>, CGAL::MultiPolygon>(m);
     bind_make_mesh<std::vector<rasputin::RasterData<float>>, CGAL::SimplePolygon>(m);
     bind_make_mesh<std::vector<rasputin::RasterData<double>>, CGAL::SimplePolygon>(m);
     bind_make_mesh<std::vector<rasputin::RasterData<float>>, CGAL::Polygon>(m);
     bind_make_mesh<std::vector<rasputin::RasterData<double>>, CGAL::Polygon>(m);
-    // bind_make_mesh<std::vector<rasputin::RasterData<float>>, CGAL::MultiPolygon>(m);
-    // bind_make_mesh<std::vector<rasputin::RasterData<double>>, CGAL::MultiPolygon>(m);
+    bind_make_mesh<std::vector<rasputin::RasterData<float>>, CGAL::MultiPolygon>(m);
+    bind_make_mesh<std::vector<rasputin::RasterData<double>>, CGAL::MultiPolygon>(m);
     bind_make_mesh<rasputin::RasterData<float>, CGAL::SimplePolygon>(m);
     bind_make_mesh<rasputin::RasterData<double>, CGAL::SimplePolygon>(m);
     bind_make_mesh<rasputin::RasterData<float>, CGAL::Polygon>(m);
     bind_make_mesh<rasputin::RasterData<double>, CGAL::Polygon>(m);
-    // bind_make_mesh<rasputin::RasterData<float>, CGAL::MultiPolygon>(m);
-    // bind_make_mesh<rasputin::RasterData<double>, CGAL::MultiPolygon>(m);
+    bind_make_mesh<rasputin::RasterData<float>, CGAL::MultiPolygon>(m);
+    bind_make_mesh<rasputin::RasterData<double>, CGAL::MultiPolygon>(m);
 
     py::class_<CGAL::SimplePolygon, std::unique_ptr<CGAL::SimplePolygon>>(m, "simple_polygon")
         .def(py::init(&polygon_from_numpy))
@@ -291,6 +611,7 @@ PYBIND11_MODULE(triangulate_dem, m) {
         .def("intersection", &intersect_polygons<CGAL::Polygon, CGAL::Polygon>);
 
     py::class_<CGAL::MultiPolygon, std::unique_ptr<CGAL::MultiPolygon>>(m, "multi_polygon")
+        .def(py::init([] () {return CGAL::MultiPolygon();}))
         .def(py::init(
             [] (const CGAL::Polygon& polygon) {
                 CGAL::MultiPolygon self;
@@ -304,6 +625,11 @@ PYBIND11_MODULE(triangulate_dem, m) {
                 return self;
             }))
         .def("num_parts", &CGAL::MultiPolygon::size)
+        .def("add_part", [] (CGAL::MultiPolygon& self, const CGAL::SimplePolygon& part) {self.emplace_back(part);})
+        .def("add_part", [] (CGAL::MultiPolygon& self, const CGAL::Polygon& part) {self.push_back(part);})
+        .def("add_part", [] (CGAL::MultiPolygon& self, const CGAL::MultiPolygon& parts) {
+                self.insert(self.end(), parts.begin(), parts.end());
+            })
         .def("parts",
             [] (const CGAL::MultiPolygon& self) {
                 py::list result;
@@ -329,51 +655,236 @@ PYBIND11_MODULE(triangulate_dem, m) {
                     return self.at(idx);
                     }, py::return_value_policy::reference_internal);
 
+    py::class_<rasputin::PolygonClassifier>(m, "polygon_classifier")
+        .def(py::init<>())
+        .def("add", &rasputin::PolygonClassifier::add<CGAL::SimplePolygon>, py::arg("label"), py::arg("polygon"))
+        .def("add", &rasputin::PolygonClassifier::add<CGAL::Polygon>, py::arg("label"), py::arg("polygon"))
+        .def("add", &rasputin::PolygonClassifier::add<CGAL::MultiPolygon>, py::arg("label"), py::arg("polygon"))
+        .def("add",
+             [] (rasputin::PolygonClassifier& self, int label, py::array_t<double>& exterior,
+                 std::vector<py::array_t<double>>& holes) {
+                // Inside is decided by the even-odd rule, so the rings need no orientation or overlay
+                std::vector<CGAL::SimplePolygon> rings;
+                for (auto& hole: holes)
+                    rings.push_back(polygon_from_numpy(hole));
+                self.add(label, CGAL::Polygon(polygon_from_numpy(exterior), rings.begin(), rings.end()));
+            }, py::arg("label"), py::arg("exterior"), py::arg("holes") = std::vector<py::array_t<double>>{},
+            "Add a polygon given by its exterior ring and hole rings as (n, 2) arrays.")
+        .def("__len__", &rasputin::PolygonClassifier::size)
+        .def("classify",
+             [] (rasputin::PolygonClassifier& self, py::array_t<double, py::array::c_style | py::array::forcecast> xy,
+                 int default_label) {
+                const std::size_t n = checked_rows<2>(xy);
+                py::array_t<int> labels(n);
+                const double* points = xy.data();
+                int* out = labels.mutable_data();
+                {
+                    py::gil_scoped_release release;
+                    self.classify(points, n, out, default_label);
+                }
+                return labels;
+            }, py::arg("xy"), py::arg("default_label") = -1,
+            "Label of the first added polygon containing each point of an (n, 2) array.");
+
+    py::class_<rasputin::ProgressiveMesh, std::unique_ptr<rasputin::ProgressiveMesh>>(m, "progressive_mesh")
+        .def(py::init([] (const rasputin::point3_vector& points, const rasputin::face_vector& faces,
+                          const std::vector<int>& removed, const std::vector<int>& kept,
+                          const rasputin::point3_vector& positions, const std::string proj4_str) {
+                if (removed.size() != kept.size() or removed.size() != positions.size())
+                    throw py::value_error("Collapse sequence arrays must have equal length.");
+                // Replaying the sequence indexes by these without checks, so reject corrupt files here
+                const auto in_range = [n = points.size()] (int v) {return v >= 0 and std::size_t(v) < n;};
+                if (removed.size() > points.size())
+                    throw py::index_error("More collapses than points.");
+                if (not std::all_of(removed.begin(), removed.end(), in_range) or
+                    not std::all_of(kept.begin(), kept.end(), in_range))
+                    throw py::index_error("Collapse sequence has a vertex index out of range.");
+                for (std::size_t j = 0; j < faces.size(); ++j)
+                    if (not std::all_of(faces[j].begin(), faces[j].end(), in_range))
+                        throw py::index_error("Face " + std::to_string(j) + " has a vertex index out of range.");
+                return rasputin::ProgressiveMesh{points, faces, removed, kept, positions, proj4_str};
+            }), py::arg("points"), py::arg("faces"), py::arg("removed"), py::arg("kept"), py::arg("positions"),
+            py::arg("proj4_str"))
+        .def_readonly("points", &rasputin::ProgressiveMesh::points)
+        .def_readonly("faces", &rasputin::ProgressiveMesh::faces)
+        .def_readonly("positions", &rasputin::ProgressiveMesh::positions)
+        .def_readonly("proj4_str", &rasputin::ProgressiveMesh::proj4_str)
+        .def_property_readonly("removed", [] (const rasputin::ProgressiveMesh& self) {
+                return py::array_t<int>(self.removed.size(), self.removed.data());
+            })
+        .def_property_readonly("kept", [] (const rasputin::ProgressiveMesh& self) {
+                return py::array_t<int>(self.kept.size(), self.kept.data());
+            })
+        .def_property_readonly("num_collapses", &rasputin::ProgressiveMesh::num_collapses)
+        .def_property_readonly("min_num_vertices", &rasputin::ProgressiveMesh::min_num_vertices)
+        .def("extract", &rasputin::extract_mesh, py::return_value_policy::take_ownership,
+             "Extract the mesh with the given number of vertices, or the coarsest mesh if fewer.");
+
     py::class_<rasputin::Mesh, std::unique_ptr<rasputin::Mesh>>(m, "Mesh")
         .def("lindstrom_turk_by_ratio",
-            [] (const rasputin::Mesh& self, double ratio) {
+            [] (const rasputin::Mesh& self, double ratio, bool parallel) {
+                if (parallel)
+                    return self.coarsen_parallel(static_cast<std::size_t>(ratio*self.num_edges()),
+                                                 SMS::LindstromTurk_placement<CGAL::Mesh>(),
+                                                 SMS::LindstromTurk_cost<CGAL::Mesh>());
                 return self.coarsen(SMS::Count_ratio_stop_predicate<CGAL::Mesh>(ratio),
                                     SMS::LindstromTurk_placement<CGAL::Mesh>(),
                                     SMS::LindstromTurk_cost<CGAL::Mesh>());
-            }, py::return_value_policy::take_ownership,
-            "Simplify the mesh.\n\nThe LindstromTurk cost and placement strategy is used, and simplification process stops when the number of undirected edges drops below the size threshold.")
+            }, py::return_value_policy::take_ownership, py::call_guard<py::gil_scoped_release>(),
+            py::arg("ratio"), py::arg("parallel") = false,
+            "Simplify the mesh.\n\nThe LindstromTurk cost and placement strategy is used, and simplification process stops when the number of undirected edges drops below the size threshold. With parallel, spatial partitions of the mesh are simplified concurrently.")
         .def("lindstrom_turk_by_size",
-            [] (const rasputin::Mesh& self, int max_size) {
+            [] (const rasputin::Mesh& self, int max_size, bool parallel) {
+                if (parallel)
+                    return self.coarsen_parallel(max_size,
+                                                 SMS::LindstromTurk_placement<CGAL::Mesh>(),
+                                                 SMS::LindstromTurk_cost<CGAL::Mesh>());
                 return self.coarsen(SMS::Count_stop_predicate<CGAL::Mesh>(max_size),
                                     SMS::LindstromTurk_placement<CGAL::Mesh>(),
                                     SMS::LindstromTurk_cost<CGAL::Mesh>());
-            }, py::return_value_policy::take_ownership,
-            "Simplify the mesh.\n\nThe LindstromTurk cost and placement strategy is used, and simplification process stops when the number of undirected edges drops below the ratio threshold.")
+            }, py::return_value_policy::take_ownership, py::call_guard<py::gil_scoped_release>(),
+            py::arg("max_size"), py::arg("parallel") = false,
+            "Simplify the mesh.\n\nThe LindstromTurk cost and placement strategy is used, and simplification process stops when the number of undirected edges drops below the ratio threshold. With parallel, spatial partitions of the mesh are simplified concurrently.")
+        .def("lindstrom_turk_by_vertical_error", lindstrom_turk_by_vertical_error<rasputin::RasterData<float>>(),
+             py::return_value_policy::take_ownership, py::call_guard<py::gil_scoped_release>(),
+             py::arg("raster"), py::arg("max_error"),
+             "Simplify the mesh.\n\nThe LindstromTurk placement strategy is used, and edges are collapsed for as long as the vertical distance to the raster samples stays below max_error.")
+        .def("lindstrom_turk_by_vertical_error", lindstrom_turk_by_vertical_error<rasputin::RasterData<double>>(),
+             py::return_value_policy::take_ownership, py::call_guard<py::gil_scoped_release>(),
+             py::arg("raster"), py::arg("max_error"))
+        .def("lindstrom_turk_by_vertical_error", lindstrom_turk_by_vertical_error<rasputin::RasterMosaic<float>>(),
+             py::return_value_policy::take_ownership, py::call_guard<py::gil_scoped_release>(),
+             py::arg("raster"), py::arg("max_error"))
+        .def("lindstrom_turk_by_vertical_error", lindstrom_turk_by_vertical_error<rasputin::RasterMosaic<double>>(),
+             py::return_value_policy::take_ownership, py::call_guard<py::gil_scoped_release>(),
+             py::arg("raster"), py::arg("max_error"))
+        .def("lindstrom_turk_progressive",
+            [] (const rasputin::Mesh& self, double ratio) {
+                rasputin::ProgressiveMesh progressive_mesh;
+                self.coarsen(SMS::Count_ratio_stop_predicate<CGAL::Mesh>(ratio),
+                             SMS::LindstromTurk_placement<CGAL::Mesh>(),
+                             SMS::LindstromTurk_cost<CGAL::Mesh>(),
+                             &progressive_mesh);
+                return progressive_mesh;
+            }, py::return_value_policy::take_ownership, py::call_guard<py::gil_scoped_release>(),
+            "Simplify the mesh down to the edge ratio, and record all collapses as a progressive mesh.")
         .def("copy", &rasputin::Mesh::copy, py::return_value_policy::take_ownership)
+        .def("reproject", &rasputin::Mesh::reproject, py::return_value_policy::take_ownership,
+             py::call_guard<py::gil_scoped_release>(), py::arg("target_proj4"),
+             "Mesh with the points transformed to the target coordinate system, and the same connectivity.")
+        .def_property_readonly("geographic_centroids", &rasputin::Mesh::geographic_centroids,
+             py::return_value_policy::reference_internal,
+             "WGS84 longitude, latitude and height of the face centroids, computed once per mesh.")
         .def("extract_sub_mesh", &rasputin::Mesh::extract_sub_mesh, py::return_value_policy::take_ownership)
+        .def("with_face_attribute", &with_attribute<CGAL::FaceIndex>,
+             py::arg("name"), py::arg("values"), py::arg("policy") = "free",
+             "Mesh with an attribute for each face. Int labels with the \"boundary\" policy keep their boundaries when simplifying.")
+        .def("with_vertex_attribute", &with_attribute<CGAL::VertexIndex>,
+             py::arg("name"), py::arg("values"), py::arg("policy") = "average",
+             "Mesh with an attribute for each vertex, merged by the policy (average, minimum, maximum or nearest) on edge collapse.")
+        .def_property_readonly("face_attributes", &attributes<CGAL::FaceIndex>)
+        .def_property_readonly("vertex_attributes", &attributes<CGAL::VertexIndex>)
+        .def("partition_by_label", [] (const rasputin::Mesh& self, const std::vector<int>& labels) {
+                auto parts = [&] () {
+                    py::gil_scoped_release release;
+                    return self.partition_by_label(labels);
+                }();
+                py::dict result;
+                for (auto& part: parts)
+                    result[py::int_(part.first)] = py::cast(std::move(part.second));
+                return result;
+            }, py::arg("labels"),
+            "Sub meshes of the faces with each label, as a dict from label to mesh.")
+        .def("hilbert_face_order", [] (const rasputin::Mesh& self) {
+                const auto order = self.hilbert_face_order();
+                return py::array_t<int>(order.size(), order.data());
+            }, "Face indices sorted along a Hilbert curve through the face centroids.")
+        .def("permute_faces", &rasputin::Mesh::permute_faces, py::return_value_policy::take_ownership,
+             py::call_guard<py::gil_scoped_release>(), py::arg("order"),
+             "Mesh with the faces in the given order and the vertices numbered by first use.")
+
+        .def_property_readonly("part_ids", [] (const rasputin::Mesh& self) {
+                const auto part_ids = self.part_ids();
+                return py::array_t<int>(part_ids.size(), part_ids.data());
+            }, "Part index of each face when meshed from a multipolygon, otherwise empty.")
+
+        .def_property_readonly("constrained_edges", [] (const rasputin::Mesh& self) {
+                const auto edges = self.constrained_edges();
+                py::array_t<double> result({edges.size(), std::size_t(2), std::size_t(3)});
+                std::copy_n(edges.empty() ? nullptr : edges.front().front().data(), 6*edges.size(),
+                            static_cast<double*>(result.request().ptr));
+                return result;
+            }, "End points of the constrained edges (break lines) in the interior of the mesh.")
 
         .def_property_readonly("num_vertices", &rasputin::Mesh::num_vertices)
         .def_property_readonly("num_edges", &rasputin::Mesh::num_edges)
         .def_property_readonly("num_faces", &rasputin::Mesh::num_faces)
 
+        .def_property_readonly("bounding_box_centre", &rasputin::Mesh::bounding_box_centre)
+        .def("compact_points_faces", &rasputin::Mesh::flat_points_faces<float, std::uint32_t>,
+             py::call_guard<py::gil_scoped_release>(), py::arg("origin"),
+             "Points relative to origin as float32 and faces as uint32.")
+        .def("large_points_faces",
+             [] (const rasputin::Mesh& self) {
+                 return self.flat_points_faces<double, std::int64_t>(rasputin::point3{0.0, 0.0, 0.0});
+             }, py::call_guard<py::gil_scoped_release>(),
+             "Points as float64 and faces as int64.")
+
         .def_property_readonly("points", &rasputin::Mesh::get_points, py::return_value_policy::reference_internal)
-        .def_property_readonly("faces", &rasputin::Mesh::get_faces, py::return_value_policy::reference_internal);
+        .def_property_readonly("faces", &rasputin::Mesh::get_faces, py::return_value_policy::reference_internal)
+        .def_readonly("proj4_str", &rasputin::Mesh::proj4_str);
 
     m.def("compute_shadow", (std::vector<int> (*)(const rasputin::Mesh &, const rasputin::point3 &))&rasputin::compute_shadow, "Compute shadows for given topocentric sun position.")
      .def("compute_shadow", (std::vector<int> (*)(const rasputin::Mesh &, const double, const double))&rasputin::compute_shadow, "Compute shadows for given azimuth and elevation.")
      .def("compute_shadows", &rasputin::compute_shadows, "Compute shadows for a series of times and ray directions.")
      .def("construct_mesh",
             [] (const rasputin::point3_vector& points, const rasputin::face_vector & faces, const std::string proj4_str) {
-                rasputin::VertexIndexMap index_map;
-                rasputin::FaceDescrMap face_map;
-                return rasputin::Mesh(rasputin::construct_mesh(points, faces, index_map, face_map), proj4_str);
+                return rasputin::Mesh(rasputin::construct_mesh(points, faces), proj4_str);
          }, py::return_value_policy::take_ownership)
-     .def("surface_normals", &rasputin::surface_normals,
+     .def("construct_mesh", construct_mesh_from_numpy<int>, py::return_value_policy::take_ownership)
+     .def("construct_mesh", construct_mesh_from_numpy<std::int64_t>, py::return_value_policy::take_ownership,
+          "Mesh from (n, 3) arrays of points and faces. Face indices out of range raise an IndexError.")
+     .def("terrain_attributes",
+          [] (const rasputin::Mesh& mesh, py::object face_normals, py::object slopes, py::object aspects,
+              py::object cell_centers, py::object point_normals) {
+              const auto& points = mesh.get_points();
+              const auto& faces = mesh.get_faces();
+              const py::ssize_t n = faces.size(), m = points.size();
+              rasputin::TerrainAttributeBuffers out;
+              auto components = [] (double* data, py::ssize_t size) {
+                  return data ? std::array<double*, 3>{{data, data + size, data + 2*size}}
+                              : std::array<double*, 3>{{nullptr, nullptr, nullptr}};
+              };
+              out.face_normals = components(output_buffer(face_normals, {3, n}, "face_normals"), n);
+              out.slopes = output_buffer(slopes, {n}, "slopes");
+              out.aspects = output_buffer(aspects, {n}, "aspects");
+              out.cell_centers = components(output_buffer(cell_centers, {3, n}, "cell_centers"), n);
+              out.point_normals = components(output_buffer(point_normals, {3, m}, "point_normals"), m);
+              py::gil_scoped_release release;
+              rasputin::terrain_attributes(points.empty() ? nullptr : points.front().data(), points.size(),
+                                           faces.empty() ? nullptr : faces.front().data(), faces.size(), out);
+          },
+          py::arg("mesh"), py::arg("face_normals") = py::none(), py::arg("slopes") = py::none(),
+          py::arg("aspects") = py::none(), py::arg("cell_centers") = py::none(), py::arg("point_normals") = py::none(),
+          "Compute the requested terrain attributes of the mesh in one multithreaded pass, into float64 arrays of shape "
+          "(3, num_faces) for face normals and cell centers, (num_faces,) for slopes and aspects and (3, num_points) for point normals.")
+     .def("surface_normals", &rasputin::surface_normals<double, int>,
           "Compute surface normals for all faces in the mesh.",
           py::return_value_policy::take_ownership)
-     .def("point_normals", &rasputin::point_normals, "Compute surface normals for all vertices in the mesh.")
+     .def("surface_normals", &rasputin::surface_normals<float, std::uint32_t>, py::return_value_policy::take_ownership)
+     .def("surface_normals", &rasputin::surface_normals<double, std::int64_t>, py::return_value_policy::take_ownership)
+     .def("point_normals", &rasputin::point_normals<double, int>, "Compute surface normals for all vertices in the mesh.")
+     .def("point_normals", &rasputin::point_normals<float, std::uint32_t>)
+     .def("point_normals", &rasputin::point_normals<double, std::int64_t>)
      .def("orient_tin", &rasputin::orient_tin, "Orient all triangles in the TIN and returns their surface normals.")
      .def("extract_lakes", &rasputin::extract_lakes, "Extract lakes as separate face list.")
      .def("compute_slopes", &rasputin::compute_slopes,"Compute slopes (i.e. angles relative to xy plane) for the all the vectors in list.")
      .def("compute_aspects", &rasputin::compute_aspects, "Compute aspects for the all the vectors in list.")
      .def("extract_avalanche_expositions", &rasputin::extract_avalanche_expositions, "Extract avalanche exposed cells.")
      .def("consolidate", &rasputin::consolidate, "Make a stand alone consolidated tin.")
-     .def("cell_centers", &rasputin::cell_centers, "Compute cell centers for triangulation.")
+     .def("cell_centers", &rasputin::cell_centers<double, int>, "Compute cell centers for triangulation.")
+     .def("cell_centers", &rasputin::cell_centers<float, std::uint32_t>)
+     .def("cell_centers", &rasputin::cell_centers<double, std::int64_t>)
      .def("coordinates_to_indices", &rasputin::coordinates_to_indices, "Transform from coordinate space to index space.")
      .def("extract_uint8_buffer_values", &rasputin::extract_buffer_values<std::uint8_t>, "Extract raster data for given indices.")
      // From solar_position.h
@@ -44,18 +44,14 @@ class Geometry:
                               material=self.material)
 
     def split_by_colors(self) -> List["Geometry"]:
-        print(len(self.colors))
-        print(len(self._colors))
-        print(len(self.faces))
-        sub_geometries = []
         if self._colors is None:
             raise RuntimeError("No colors to split by")
-        for color in set([tuple(c) for c in self._colors]):
-            color = np.array(color)
-            sub_geom = self.extract_faces(faces=self.faces[np.all(self._colors==color, axis=1)])
-            sub_geom.base_color = color
-            sub_geometries.append(sub_geom)
-        return sub_geometries
+        colors, labels = np.unique(self._colors, axis=0, return_inverse=True)
+        return [self.__class__(mesh=mesh,
+                               crs=self.crs,
+                               base_color=tuple(colors[label]),
+                               material_spec=self.material_spec)
+                for label, mesh in self.mesh.partition_by_label(labels.ravel()).items()]
 
 
     @property
@@ -74,16 +70,20 @@ class Geometry:
     def face_normals(self) -> np.ndarray:
         return self.mesh.face_normals
 
+    def _compute_slopes_and_aspects(self) -> None:
+        attributes = self.mesh.terrain_attributes(slopes=True, aspects=True)
+        self._slopes, self._aspects = attributes["slopes"], attributes["aspects"]
+
     @property
     def aspects(self) -> np.ndarray:
         if self._aspects is None:
-            self._aspects = np.asarray(td.compute_aspects(self.face_normals))
+            self._compute_slopes_and_aspects()
         return self._aspects
 
     @property
     def slopes(self) -> np.ndarray:
         if self._slopes is None:
-            self._slopes = np.asarray(td.compute_slopes(self.face_normals))
+            self._compute_slopes_and_aspects()
         return self._slopes
 
     @property
@@ -210,11 +210,8 @@ class GeoPolygon:
 
     @classmethod
     def from_raster_file(cls, *, filepath: Path) -> "GeoPolygon":
-        from rasputin.reader import identify_projection, get_image_extents
-        from PIL import Image
-        with Image.open(filepath) as image:
-            projection_str = identify_projection(image=image)
-            image_extents = get_image_extents(image=image)
+        from rasputin.reader import read_raster_info
+        projection_str, image_extents = read_raster_info(filepath=filepath)
 
         return GeoPolygon(polygon=geometry.Polygon.from_bounds(*image_extents.box),
                           crs=pyproj.CRS.from_proj4(projection_str))
@@ -258,11 +255,18 @@ class GeoPolygon:
     def buffer(self, value: float) -> "GeoPolygon":
         return GeoPolygon(polygon=self.polygon.buffer(value), crs=self.crs)
 
-    def to_cpp(self) -> Union[td.simple_polygon, td.polygon]:
+    def to_cpp(self) -> Union[td.simple_polygon, td.polygon, td.multi_polygon]:
         # Note: Shapely polygons have one vertex repeated and orientation dos not matter
         #       CGAL polygons have no vertex repeated and orientation mattters
         from shapely.geometry.polygon import orient
 
+        # Disjoint parts are meshed independently, see triangulate_dem.mesh_from_parts
+        if isinstance(self.polygon, geometry.MultiPolygon):
+            cgal_polygon = td.multi_polygon()
+            for part in self.polygon.geoms:
+                cgal_polygon.add_part(GeoPolygon(polygon=part, crs=self.crs).to_cpp())
+            return cgal_polygon
+
         # Get point sequences as arrays
         exterior = np.asarray(orient(self.polygon).exterior)[:-1]
         interiors = [np.asarray(hole)[:-1]
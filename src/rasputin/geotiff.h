@@ -0,0 +1,651 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "parallel.h"
+
+namespace rasputin::geotiff {
+
+// Read only memory mapping of a whole file
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Unable to open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0 or st.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error("Unable to map " + path);
+        }
+        size = static_cast<std::size_t>(st.st_size);
+        void* ptr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED)
+            throw std::runtime_error("Unable to map " + path);
+        data = static_cast<const std::uint8_t*>(ptr);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        ::munmap(const_cast<std::uint8_t*>(data), size);
+    }
+
+    const std::uint8_t* data = nullptr;
+    std::size_t size = 0;
+};
+
+enum class SampleFormat {unsigned_integer = 1, signed_integer = 2, floating_point = 3};
+
+// GeoKey values are shorts stored in the directory, doubles from
+// GeoDoubleParamsTag or strings from GeoAsciiParamsTag
+using GeoKeyValue = std::variant<int, double, std::string>;
+
+// Rows [row, row + rows) and columns [col, col + cols) of an image
+struct Window {
+    std::size_t row, col, rows, cols;
+};
+
+// Decode 8-bit TIFF LZW (MSB first codes, early change) into out
+inline std::size_t lzw_decode(const std::uint8_t* in, std::size_t n, std::uint8_t* out, std::size_t capacity) {
+    constexpr unsigned clear_code = 256, end_code = 257;
+    std::vector<std::uint32_t> prefix(4096);
+    std::vector<std::uint8_t> suffix(4096), first(4096);
+    std::vector<std::uint16_t> length(4096);
+    for (unsigned c = 0; c < 256; ++c) {
+        suffix[c] = first[c] = static_cast<std::uint8_t>(c);
+        length[c] = 1;
+    }
+
+    std::size_t pos = 0, bit = 0;
+    unsigned next = 258, width = 9;
+    int previous = -1;
+    const std::size_t bits = 8*n;
+    while (bit + width <= bits) {
+        unsigned code = 0;
+        for (unsigned b = 0; b < width; ++b, ++bit)
+            code = (code << 1) | ((in[bit >> 3] >> (7 - (bit & 7))) & 1u);
+
+        if (code == end_code)
+            break;
+        if (code == clear_code) {
+            next = 258;
+            width = 9;
+            previous = -1;
+            continue;
+        }
+        if (previous < 0) {
+            if (code > 255)
+                throw std::runtime_error("Corrupt LZW stream");
+            if (pos < capacity)
+                out[pos++] = static_cast<std::uint8_t>(code);
+            previous = code;
+            continue;
+        }
+        if (code > next or next >= 4096)
+            throw std::runtime_error("Corrupt LZW stream");
+
+        // The code not yet in the table is the previous string plus its own first byte
+        const unsigned known = code < next ? code : previous;
+        const std::uint8_t head = first[known];
+        prefix[next] = previous;
+        suffix[next] = head;
+        first[next] = first[previous];
+        length[next] = length[previous] + 1;
+        ++next;
+
+        const std::size_t size = length[code];
+        std::size_t p = pos + size;
+        for (unsigned c = code; p > pos; c = prefix[c]) {
+            --p;
+            if (p < capacity)
+                out[p] = suffix[c];
+        }
+        pos = std::min(pos + size, capacity);
+        previous = code;
+
+        if (next + 1 >= (1u << width) and width < 12)
+            ++width;
+    }
+    return pos;
+}
+
+// GeoTIFF over a memory mapped file. Only the first image of the file is
+// read. Samples are decoded lazily, tile by tile, so reading a window only
+// touches the tiles (or strips) that intersect it.
+class GeoTiff {
+  public:
+    explicit GeoTiff(const std::string& path) : file(path) {
+        parse_header();
+        parse_geo_keys();
+    }
+
+    std::size_t width = 0, height = 0;
+    std::size_t tile_width = 0, tile_height = 0;
+    bool tiled = false;
+    std::size_t bits_per_sample = 0;
+    SampleFormat sample_format = SampleFormat::unsigned_integer;
+    unsigned compression = 1, predictor = 1;
+
+    // ModelTiePointTag (i, j, k, x, y, z) and ModelPixelScaleTag (dx, dy, dz)
+    std::vector<double> tie_point, pixel_scale;
+    std::optional<double> nodata;
+    std::map<int, GeoKeyValue> geo_keys;
+
+    std::size_t sample_size() const {return bits_per_sample/8; }
+
+    // Samples of the whole image are laid out row by row in the file, in host
+    // byte order, so a window can be viewed without decoding
+    bool is_mapped() const {
+        if (compression != 1 or not native_order)
+            return false;
+        for (std::size_t k = 1; k < offsets.size(); ++k)
+            if (offsets[k] != offsets[k - 1] + byte_counts[k - 1])
+                return false;
+        // The strips must also add up to the image, or short strips would shift the rows
+        return not tiled and not offsets.empty() and offsets[0] + width*height*sample_size() <= file.size
+               and offsets.back() + byte_counts.back() >= offsets[0] + width*height*sample_size();
+    }
+
+    // First sample of the image in the mapping, for mapped images
+    const void* mapped_data() const {
+        if (not is_mapped())
+            throw std::logic_error("Image samples are not mapped contiguously");
+        return file.data + offsets[0];
+    }
+
+    // Decode the window into out, converting samples to T. Tiles are decoded
+    // in parallel.
+    template<typename T>
+    void read(const Window& w, T* out) const {
+        if (w.row + w.rows > height or w.col + w.cols > width)
+            throw std::out_of_range("Window outside of image");
+        if (w.rows == 0 or w.cols == 0)
+            return;
+
+        const std::size_t tiles_across = (width + tile_width - 1)/tile_width;
+        const std::size_t t_row0 = w.row/tile_height, t_row1 = (w.row + w.rows - 1)/tile_height;
+        const std::size_t t_col0 = w.col/tile_width, t_col1 = (w.col + w.cols - 1)/tile_width;
+        const std::size_t n_cols = t_col1 - t_col0 + 1;
+
+        parallel_for((t_row1 - t_row0 + 1)*n_cols, [&] (std::size_t t) {
+            const std::size_t ti = t_row0 + t/n_cols, tj = t_col0 + t%n_cols;
+            const auto tile = decode_tile(ti*tiles_across + tj);
+
+            const std::size_t r0 = std::max(w.row, ti*tile_height);
+            const std::size_t r1 = std::min(w.row + w.rows, (ti + 1)*tile_height);
+            const std::size_t c0 = std::max(w.col, tj*tile_width);
+            const std::size_t c1 = std::min(w.col + w.cols, (tj + 1)*tile_width);
+            for (std::size_t r = r0; r < r1; ++r) {
+                const std::uint8_t* src = tile.data() + ((r - ti*tile_height)*tile_width + c0 - tj*tile_width)*sample_size();
+                T* dst = out + (r - w.row)*w.cols + (c0 - w.col);
+                convert_samples(src, c1 - c0, dst);
+            }
+        });
+    }
+
+    template<typename T>
+    std::vector<T> read(const Window& w) const {
+        std::vector<T> result(w.rows*w.cols);
+        read(w, result.data());
+        return result;
+    }
+
+    // Samples at n (column, row) index pairs, converted to T. The indices are
+    // grouped by the tile holding them, so each touched tile is decoded once,
+    // and the groups are gathered in parallel. Mapped images are read in place.
+    template<typename T>
+    void gather(const std::uint32_t* indices, std::size_t n, T* out) const {
+        for (std::size_t i = 0; i < n; ++i)
+            if (indices[2*i] >= width or indices[2*i + 1] >= height)
+                throw std::out_of_range("Index outside of image");
+
+        const std::size_t ss = sample_size();
+        constexpr std::size_t chunk_size = 4096;
+        if (is_mapped()) {
+            const std::uint8_t* data = file.data + offsets[0];
+            parallel_for((n + chunk_size - 1)/chunk_size, [&] (std::size_t chunk) {
+                for (std::size_t i = chunk*chunk_size; i < std::min(n, (chunk + 1)*chunk_size); ++i)
+                    convert_samples(data + (std::size_t(indices[2*i + 1])*width + indices[2*i])*ss, 1, out + i);
+            });
+            return;
+        }
+
+        const std::size_t tiles_across = (width + tile_width - 1)/tile_width;
+        std::vector<std::pair<std::size_t, std::size_t>> order(n);
+        for (std::size_t i = 0; i < n; ++i)
+            order[i] = {(indices[2*i + 1]/tile_height)*tiles_across + indices[2*i]/tile_width, i};
+        std::sort(order.begin(), order.end());
+
+        std::vector<std::size_t> starts;
+        for (std::size_t k = 0; k < n; ++k)
+            if (k == 0 or order[k].first != order[k - 1].first)
+                starts.push_back(k);
+        starts.push_back(n);
+
+        parallel_for(starts.size() - 1, [&] (std::size_t g) {
+            const std::size_t t = order[starts[g]].first;
+            const auto tile = cached_tile(t);
+            const std::size_t row0 = (t/tiles_across)*tile_height, col0 = (t%tiles_across)*tile_width;
+            for (std::size_t k = starts[g]; k < starts[g + 1]; ++k) {
+                const std::size_t i = order[k].second;
+                const std::size_t r = indices[2*i + 1] - row0, c = indices[2*i] - col0;
+                convert_samples(tile->data() + (r*tile_width + c)*ss, 1, out + i);
+            }
+        });
+    }
+
+    // Decoded tiles kept for gather, least recently used first out
+    std::size_t tile_cache_bytes = std::size_t(64) << 20;
+
+  private:
+    MappedFile file;
+    bool big_endian = false, big_tiff = false, native_order = true;
+    std::vector<std::uint64_t> offsets, byte_counts;
+
+    struct Field {
+        std::uint16_t type;
+        std::uint64_t count;
+        const std::uint8_t* data;
+    };
+    std::map<std::uint16_t, Field> fields;
+
+    using Tile = std::shared_ptr<const std::vector<std::uint8_t>>;
+    mutable std::mutex cache_mutex;
+    mutable std::list<std::pair<std::size_t, Tile>> cached_tiles;
+    mutable std::map<std::size_t, decltype(cached_tiles)::iterator> cache_index;
+    mutable std::size_t cached_bytes = 0;
+
+    Tile cached_tile(std::size_t k) const {
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            const auto it = cache_index.find(k);
+            if (it != cache_index.end()) {
+                cached_tiles.splice(cached_tiles.begin(), cached_tiles, it->second);
+                return it->second->second;
+            }
+        }
+        // Decode outside of the lock, so tiles are decoded in parallel
+        const Tile tile = std::make_shared<const std::vector<std::uint8_t>>(decode_tile(k));
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        if (cache_index.count(k) or tile->size() > tile_cache_bytes)
+            return tile;
+        cached_tiles.emplace_front(k, tile);
+        cache_index[k] = cached_tiles.begin();
+        cached_bytes += tile->size();
+        while (cached_bytes > tile_cache_bytes) {
+            cached_bytes -= cached_tiles.back().second->size();
+            cache_index.erase(cached_tiles.back().first);
+            cached_tiles.pop_back();
+        }
+        return tile;
+    }
+
+    const std::uint8_t* at(std::uint64_t offset, std::uint64_t n) const {
+        if (offset > file.size or n > file.size - offset)
+            throw std::runtime_error("Truncated TIFF file");
+        return file.data + offset;
+    }
+
+    template<typename U>
+    U get(const std::uint8_t* p) const {
+        U value;
+        std::memcpy(&value, p, sizeof(U));
+        if (not native_order) {
+            auto bytes = reinterpret_cast<std::uint8_t*>(&value);
+            std::reverse(bytes, bytes + sizeof(U));
+        }
+        return value;
+    }
+
+    static std::size_t type_size(std::uint16_t type) {
+        switch (type) {
+            case 1: case 2: case 6: case 7: return 1;
+            case 3: case 8: return 2;
+            case 4: case 9: case 11: return 4;
+            case 5: case 10: case 12: case 16: case 17: case 18: return 8;
+            default: return 0;
+        }
+    }
+
+    std::vector<double> numbers(const Field& f) const {
+        const std::size_t size = type_size(f.type);
+        std::vector<double> result(f.count);
+        for (std::size_t k = 0; k < f.count; ++k) {
+            const std::uint8_t* p = f.data + k*size;
+            switch (f.type) {
+                case 1: case 7: result[k] = *p; break;
+                case 6: result[k] = static_cast<std::int8_t>(*p); break;
+                case 3: result[k] = get<std::uint16_t>(p); break;
+                case 8: result[k] = get<std::int16_t>(p); break;
+                case 4: result[k] = get<std::uint32_t>(p); break;
+                case 9: result[k] = get<std::int32_t>(p); break;
+                case 5: result[k] = double(get<std::uint32_t>(p))/get<std::uint32_t>(p + 4); break;
+                case 10: result[k] = double(get<std::int32_t>(p))/get<std::int32_t>(p + 4); break;
+                case 11: result[k] = get<float>(p); break;
+                case 12: result[k] = get<double>(p); break;
+                case 16: case 18: result[k] = get<std::uint64_t>(p); break;
+                case 17: result[k] = get<std::int64_t>(p); break;
+                default: throw std::runtime_error("Unsupported TIFF field type");
+            }
+        }
+        return result;
+    }
+
+    // Offsets and byte counts may not be exactly representable as doubles
+    std::vector<std::uint64_t> integers(const Field& f) const {
+        std::vector<std::uint64_t> result(f.count);
+        for (std::size_t k = 0; k < f.count; ++k) {
+            const std::uint8_t* p = f.data + k*type_size(f.type);
+            switch (f.type) {
+                case 3: result[k] = get<std::uint16_t>(p); break;
+                case 4: result[k] = get<std::uint32_t>(p); break;
+                case 16: case 18: result[k] = get<std::uint64_t>(p); break;
+                default: throw std::runtime_error("Unsupported TIFF offset type");
+            }
+        }
+        return result;
+    }
+
+    std::optional<std::vector<double>> field(std::uint16_t tag) const {
+        const auto it = fields.find(tag);
+        if (it == fields.end())
+            return std::nullopt;
+        return numbers(it->second);
+    }
+
+    std::size_t field_value(std::uint16_t tag, std::size_t fallback) const {
+        const auto values = field(tag);
+        return values and values->size() ? std::size_t((*values)[0]) : fallback;
+    }
+
+    std::optional<std::string> ascii_field(std::uint16_t tag) const {
+        const auto it = fields.find(tag);
+        if (it == fields.end())
+            return std::nullopt;
+        return std::string(reinterpret_cast<const char*>(it->second.data), it->second.count);
+    }
+
+    void parse_header() {
+        const std::uint8_t* header = at(0, 8);
+        if (header[0] == 'M' and header[1] == 'M')
+            big_endian = true;
+        else if (not (header[0] == 'I' and header[1] == 'I'))
+            throw std::invalid_argument("Not a TIFF file");
+        native_order = big_endian == (std::endian::native == std::endian::big);
+
+        const auto version = get<std::uint16_t>(header + 2);
+        big_tiff = version == 43;
+        if (version != 42 and not big_tiff)
+            throw std::invalid_argument("Not a TIFF file");
+
+        const std::uint64_t ifd = big_tiff ? get<std::uint64_t>(at(8, 8)) : get<std::uint32_t>(header + 4);
+        const std::size_t count_size = big_tiff ? 8 : 2, entry_size = big_tiff ? 20 : 12, value_size = big_tiff ? 8 : 4;
+        const std::uint64_t num_entries = big_tiff ? get<std::uint64_t>(at(ifd, 8)) : get<std::uint16_t>(at(ifd, 2));
+        const std::uint8_t* entries = at(ifd + count_size, num_entries*entry_size);
+        for (std::uint64_t e = 0; e < num_entries; ++e) {
+            const std::uint8_t* entry = entries + e*entry_size;
+            Field f;
+            const auto tag = get<std::uint16_t>(entry);
+            f.type = get<std::uint16_t>(entry + 2);
+            f.count = big_tiff ? get<std::uint64_t>(entry + 4) : get<std::uint32_t>(entry + 4);
+            const std::uint8_t* value = entry + (big_tiff ? 12 : 8);
+            const std::size_t size = type_size(f.type);
+            if (size == 0)
+                continue;
+            if (f.count*size <= value_size)
+                f.data = value;
+            else
+                f.data = at(big_tiff ? get<std::uint64_t>(value) : get<std::uint32_t>(value), f.count*size);
+            fields[tag] = f;
+        }
+
+        width = field_value(256, 0);
+        height = field_value(257, 0);
+        if (width == 0 or height == 0)
+            throw std::runtime_error("TIFF file has no image");
+        if (field_value(277, 1) != 1)
+            throw std::invalid_argument("Only single band images are supported");
+        bits_per_sample = field_value(258, 1);
+        sample_format = SampleFormat(field_value(339, 1));
+        compression = field_value(259, 1);
+        predictor = field_value(317, 1);
+
+        const bool valid_type = (sample_format == SampleFormat::floating_point and (bits_per_sample == 32 or bits_per_sample == 64))
+            or (sample_format != SampleFormat::floating_point and (bits_per_sample == 8 or bits_per_sample == 16 or bits_per_sample == 32));
+        if (not valid_type)
+            throw std::invalid_argument("Unsupported sample type");
+        if (compression != 1 and compression != 5 and compression != 8 and compression != 32946)
+            throw std::invalid_argument("Unsupported TIFF compression");
+        if (predictor > 3)
+            throw std::invalid_argument("Unsupported TIFF predictor");
+
+        tiled = fields.count(322);
+        if (tiled) {
+            tile_width = field_value(322, 0);
+            tile_height = field_value(323, 0);
+            offsets = integers(fields.at(324));
+            byte_counts = integers(fields.at(325));
+        } else {
+            tile_width = width;
+            tile_height = std::min(field_value(278, height), height);
+            if (not fields.count(273) or not fields.count(279))
+                throw std::runtime_error("TIFF file has no strips");
+            offsets = integers(fields.at(273));
+            byte_counts = integers(fields.at(279));
+        }
+        const std::size_t num_tiles = ((width + tile_width - 1)/tile_width)*((height + tile_height - 1)/tile_height);
+        if (tile_width == 0 or tile_height == 0 or offsets.size() < num_tiles or byte_counts.size() < offsets.size())
+            throw std::runtime_error("Inconsistent TIFF tile layout");
+
+        if (auto values = field(33922))
+            tie_point = *values;
+        if (auto values = field(33550))
+            pixel_scale = *values;
+        if (auto value = ascii_field(42113)) {
+            // GDAL stores the nodata value as an ascii string
+            const char* begin = value->c_str();
+            char* end;
+            const double v = std::strtod(begin, &end);
+            if (end != begin)
+                nodata = v;
+        }
+    }
+
+    void parse_geo_keys() {
+        const auto directory = field(34735);
+        if (not directory)
+            return;
+        if (directory->size() < 4 or (*directory)[0] != 1)
+            throw std::runtime_error("Unsupported GeoKeyDirectory version");
+        const auto doubles = field(34736);
+        const auto ascii = ascii_field(34737);
+
+        const std::size_t num_keys = std::min<std::size_t>((*directory)[3], directory->size()/4 - 1);
+        for (std::size_t k = 1; k <= num_keys; ++k) {
+            const int key = (*directory)[4*k];
+            const int location = (*directory)[4*k + 1];
+            const std::size_t count = (*directory)[4*k + 2];
+            const std::size_t value_offset = (*directory)[4*k + 3];
+            if (key == 0)
+                continue;
+            if (location == 0) {
+                geo_keys[key] = int(value_offset);
+            } else if (location == 34736 and doubles and value_offset < doubles->size()) {
+                geo_keys[key] = (*doubles)[value_offset];
+            } else if (location == 34737 and ascii and value_offset < ascii->size()) {
+                std::string value = ascii->substr(value_offset, count);
+                std::replace(value.begin(), value.end(), '|', '\n');
+                const auto keep = [] (char c) {return not (std::isspace(static_cast<unsigned char>(c)) or c == '\0'); };
+                value.erase(std::find_if(value.rbegin(), value.rend(), keep).base(), value.end());
+                value.erase(value.begin(), std::find_if(value.begin(), value.end(), keep));
+                geo_keys[key] = value;
+            }
+        }
+    }
+
+    // Samples of tile (or strip) k, in host byte order, padded to a full tile
+    std::vector<std::uint8_t> decode_tile(std::size_t k) const {
+        const std::size_t ss = sample_size();
+        const std::size_t rows = tiled ? tile_height : std::min(tile_height, height - k*tile_height);
+        const std::size_t row_bytes = tile_width*ss;
+        std::vector<std::uint8_t> tile(tile_height*row_bytes);
+        if (offsets[k] == 0 or byte_counts[k] == 0) {
+            // Sparse tiles are not stored, and read as nodata like GDAL does
+            const auto fill = sparse_sample();
+            for (std::size_t p = 0; p < tile.size(); p += ss)
+                std::memcpy(tile.data() + p, fill.data(), ss);
+            return tile;
+        }
+        const std::uint8_t* src = at(offsets[k], byte_counts[k]);
+
+        const std::size_t size = rows*row_bytes;
+        // Short data would otherwise leave zero samples, which look like real heights
+        if (compression == 1) {
+            if (byte_counts[k] < size)
+                throw std::runtime_error("Truncated TIFF file");
+            std::memcpy(tile.data(), src, size);
+        } else if (compression == 5) {
+            if (lzw_decode(src, byte_counts[k], tile.data(), size) != size)
+                throw std::runtime_error("Truncated TIFF file");
+        } else {
+            // Z_BUF_ERROR is also the result of a truncated stream, so only a full tile is accepted
+            uLongf n = size;
+            const int status = ::uncompress(tile.data(), &n, src, byte_counts[k]);
+            if (status != Z_OK and status != Z_BUF_ERROR)
+                throw std::runtime_error("Corrupt Deflate stream");
+            if (n != size)
+                throw std::runtime_error("Truncated TIFF file");
+        }
+
+        if (predictor == 3) {
+            // Bytes of each row are differenced and stored most significant byte plane first
+            std::vector<std::uint8_t> planes(row_bytes);
+            for (std::size_t r = 0; r < rows; ++r) {
+                std::uint8_t* row = tile.data() + r*row_bytes;
+                for (std::size_t b = 1; b < row_bytes; ++b)
+                    row[b] += row[b - 1];
+                std::copy(row, row + row_bytes, planes.begin());
+                for (std::size_t j = 0; j < tile_width; ++j)
+                    for (std::size_t b = 0; b < ss; ++b) {
+                        const std::size_t byte = std::endian::native == std::endian::little ? ss - 1 - b : b;
+                        row[j*ss + byte] = planes[b*tile_width + j];
+                    }
+            }
+            return tile;
+        }
+
+        if (not native_order)
+            for (std::size_t p = 0; p < size; p += ss)
+                std::reverse(tile.begin() + p, tile.begin() + p + ss);
+
+        if (predictor == 2) {
+            switch (ss) {
+                case 1: undo_differencing<std::uint8_t>(tile.data(), rows); break;
+                case 2: undo_differencing<std::uint16_t>(tile.data(), rows); break;
+                case 4: undo_differencing<std::uint32_t>(tile.data(), rows); break;
+                default: undo_differencing<std::uint64_t>(tile.data(), rows); break;
+            }
+        }
+        return tile;
+    }
+
+    // Sample of sparse tiles in host byte order: the nodata value, NaN for floating point samples
+    // without one, and zero otherwise
+    std::array<std::uint8_t, 8> sparse_sample() const {
+        std::array<std::uint8_t, 8> sample{};
+        if (not nodata and sample_format != SampleFormat::floating_point)
+            return sample;
+        const double value = nodata ? *nodata : std::numeric_limits<double>::quiet_NaN();
+        auto store = [&] (auto v) {std::memcpy(sample.data(), &v, sizeof(v)); };
+        switch (sample_format) {
+            case SampleFormat::floating_point:
+                if (bits_per_sample == 32)
+                    store(static_cast<float>(value));
+                else
+                    store(value);
+                break;
+            case SampleFormat::signed_integer:
+                switch (bits_per_sample) {
+                    case 8: store(static_cast<std::int8_t>(value)); break;
+                    case 16: store(static_cast<std::int16_t>(value)); break;
+                    default: store(static_cast<std::int32_t>(value)); break;
+                }
+                break;
+            default:
+                switch (bits_per_sample) {
+                    case 8: store(static_cast<std::uint8_t>(value)); break;
+                    case 16: store(static_cast<std::uint16_t>(value)); break;
+                    default: store(static_cast<std::uint32_t>(value)); break;
+                }
+        }
+        return sample;
+    }
+
+    template<typename U>
+    void undo_differencing(std::uint8_t* data, std::size_t rows) const {
+        for (std::size_t r = 0; r < rows; ++r) {
+            U* row = reinterpret_cast<U*>(data) + r*tile_width;
+            for (std::size_t j = 1; j < tile_width; ++j)
+                row[j] += row[j - 1];
+        }
+    }
+
+    template<typename S, typename T>
+    static void convert(const std::uint8_t* src, std::size_t n, T* dst) {
+        for (std::size_t j = 0; j < n; ++j) {
+            S value;
+            std::memcpy(&value, src + j*sizeof(S), sizeof(S));
+            dst[j] = static_cast<T>(value);
+        }
+    }
+
+    template<typename T>
+    void convert_samples(const std::uint8_t* src, std::size_t n, T* dst) const {
+        switch (sample_format) {
+            case SampleFormat::floating_point:
+                return bits_per_sample == 32 ? convert<float>(src, n, dst) : convert<double>(src, n, dst);
+            case SampleFormat::signed_integer:
+                switch (bits_per_sample) {
+                    case 8: return convert<std::int8_t>(src, n, dst);
+                    case 16: return convert<std::int16_t>(src, n, dst);
+                    default: return convert<std::int32_t>(src, n, dst);
+                }
+            default:
+                switch (bits_per_sample) {
+                    case 8: return convert<std::uint8_t>(src, n, dst);
+                    case 16: return convert<std::uint16_t>(src, n, dst);
+                    default: return convert<std::uint32_t>(src, n, dst);
+                }
+        }
+    }
+};
+
+}
@@ -2,15 +2,12 @@ from typing import List, Optional, Tuple, Dict, Any
 from pathlib import Path
 import numpy as np
 from pyproj import CRS, Transformer
-from PIL import Image
-from rasputin.reader import extract_geo_keys, GeoKeysInterpreter, GeoTiffTags
+from rasputin.reader import native_geo_keys, GeoKeysInterpreter
 from rasputin.land_cover_repository import LandCoverBaseType, LandCoverMetaInfoBase, LandCoverRepository
 import rasputin.triangulate_dem as td
 from rasputin.geometry import GeoPoints, GeoPolygon
 from rasputin.material_specification import lake_material, terrain_material
 
-Image.MAX_IMAGE_PIXELS = None
-
 
 class LandCoverType(LandCoverBaseType):
     crop_type_1 = 11
@@ -114,13 +111,14 @@ class GlobCovRepository(LandCoverRepository):
         super().__init__()
         self.path = path / "GLOBCOVER_L4_200901_200912_V2.3.tif"
         assert self.path.is_file()
-        with Image.open(self.path) as image:
-            self.geo_keys = extract_geo_keys(image=image)
-            self.gk_interpreter = GeoKeysInterpreter(self.geo_keys)
-            self.data_crs = CRS.from_string("+init=EPSG:4326")
-            self.model_tie_point = image.tag_v2.get(GeoTiffTags.ModelTiePointTag.value)
-            self.model_pixel_scale = image.tag_v2.get(GeoTiffTags.ModelPixelScaleTag.value)
-            self.M, self.N = image.size
+        # The global raster is only decoded in the blocks that sampled points fall in
+        self.tiff = td.GeoTiff(str(self.path))
+        self.geo_keys = native_geo_keys(tiff=self.tiff)
+        self.gk_interpreter = GeoKeysInterpreter(self.geo_keys)
+        self.data_crs = CRS.from_string("+init=EPSG:4326")
+        self.model_tie_point = self.tiff.tie_point
+        self.model_pixel_scale = self.tiff.pixel_scale
+        self.M, self.N = self.tiff.width, self.tiff.height
 
     def read(self,
              *,
@@ -143,31 +141,27 @@ class GlobCovRepository(LandCoverRepository):
             xy = np.dstack(proj.transform(geo_points.xy[:, 0], geo_points.xy[:, 1])).reshape(-1, 2)
         else:
             xy = geo_points.xy
-        with Image.open(self.path) as image:
-            return self._extract_land_types(image=image,
-                                            land_types=land_types,
-                                            indices=self._raster_indices(xy=xy))
+        return self._extract_land_types(land_types=land_types, indices=self._raster_indices(xy=xy))
 
-    def _raster_indices(self, *, xy: np.ndarray) -> td.index_vector:
-        pts = td.point2_vector(xy.tolist())
+    def _raster_indices(self, *, xy: np.ndarray) -> np.ndarray:
+        """ (column, row) indices of the pixels containing the points. """
         dx, dy, _ = self.model_pixel_scale
         jt, it, _, xt, yt, _ = self.model_tie_point
         X0 = xt - jt*dx
         Y1 = yt + it * dy
-        return td.coordinates_to_indices(X0, Y1, dx, dy, self.M, self.N, pts)
+        indices = np.column_stack([np.floor((xy[:, 0] - X0)/dx), np.floor((Y1 - xy[:, 1])/dy)])
+        outside = (indices[:, 0] < 0) | (indices[:, 0] >= self.M) | (indices[:, 1] < 0) | (indices[:, 1] >= self.N)
+        if outside.any():
+            raise IndexError(f"Point {xy[np.argmax(outside)]} is outside of {self.path.name}")
+        return indices.astype(np.uint32)
 
     def _extract_land_types(self,
                             *,
-                            image,
                             land_types: Optional[List[LandCoverType]],
-                            indices: td.index_vector) -> np.ndarray:
-        # TODO: This does not work, perhaps figure out why?
-        #all_land_types = np.asarray(td.extract_uint8_buffer_values(indices, image))
-        all_land_types = np.asarray([image.getpixel(tuple(idx)) for idx in indices])
+                            indices: np.ndarray) -> np.ndarray:
+        all_land_types = self.tiff.gather(indices)
         if land_types is None:
             return all_land_types
         lcts = [lct.value for lct in land_types]
-        func = np.vectorize(lambda t: t not in lcts)
-        all_land_types[func(all_land_types)] = 0
+        all_land_types[~np.isin(all_land_types, lcts)] = 0
         return all_land_types
-
@@ -1,11 +1,16 @@
 from typing import Dict, List, Tuple, Optional, Any
 from pathlib import Path
+import json
+import os
+import shutil
 from lxml import etree
 import numpy as np
 from pyproj import Transformer
 from pyproj import CRS
 from shapely.geometry import Polygon, Point
 from rasputin.geometry import GeoPoints, GeoPolygon
+from rasputin.reader import PackedRTree
+from rasputin import triangulate_dem as td
 from rasputin.land_cover_repository import LandCoverBaseType, LandCoverRepository, LandCoverMetaInfoBase
 from rasputin.material_specification import lake_material, terrain_material
 
@@ -127,6 +132,107 @@ class LandCoverMetaInfo(LandCoverMetaInfoBase):
         return terrain_material
 
 
+class PolygonStore:
+    """
+    Polygons of a GML file, converted once to flat binary arrays in a cache
+    directory next to it: vertex coordinates, ring offsets into the vertices,
+    polygon offsets into the rings, class codes and bounding boxes. The
+    arrays are memory mapped, so a query only reads the vertices of the
+    polygons whose boxes intersect it. The cache is rebuilt when the
+    modification time or size of the GML file changes.
+    """
+
+    dirname = ".rasputin_polygons"
+    version = 1
+
+    def __init__(self, *, filepath: Path) -> None:
+        self.filepath = filepath
+        self.directory = filepath.parent / self.dirname / filepath.stem
+        stat = filepath.stat()
+        source = dict(version=self.version, mtime_ns=stat.st_mtime_ns, size=stat.st_size)
+        try:
+            with (self.directory / "meta.json").open("r") as meta_file:
+                meta = json.load(meta_file)
+        except (OSError, ValueError):
+            meta = {}
+        if any(meta.get(key) != value for (key, value) in source.items()):
+            meta = self._convert(source)
+
+        self.srs_name = meta["srs_name"]
+        self.codes = np.load(self.directory / "codes.npy", mmap_mode="r")
+        self.boxes = np.load(self.directory / "boxes.npy", mmap_mode="r")
+        self.polygon_offsets = np.load(self.directory / "polygon_offsets.npy", mmap_mode="r")
+        self.ring_offsets = np.load(self.directory / "ring_offsets.npy", mmap_mode="r")
+        if meta["num_vertices"]:
+            self.coordinates = np.memmap(self.directory / "coordinates.f8", dtype="<f8", mode="r",
+                                         shape=(meta["num_vertices"], 2))
+        else:
+            self.coordinates = np.empty((0, 2))
+        self.tree = PackedRTree(self.boxes)
+
+    @property
+    def crs(self) -> CRS:
+        return CRS.from_string(f"+init={self.srs_name}")
+
+    def __len__(self) -> int:
+        return len(self.codes)
+
+    def _convert(self, source: Dict[str, int]) -> Dict[str, Any]:
+        # Stream the features, dropping each one after conversion so the XML tree never grows
+        temp = self.directory.with_name(f"{self.directory.name}.{os.getpid()}")
+        shutil.rmtree(temp, ignore_errors=True)
+        temp.mkdir(parents=True)
+        codes, boxes, polygon_offsets, ring_offsets = [], [], [0], [0]
+        srs_name = None
+        with (temp / "coordinates.f8").open("wb") as coordinate_file:
+            for _, feature in etree.iterparse(str(self.filepath), events=("end",), tag="{*}featureMember",
+                                              encoding="utf-8", recover=True, huge_tree=True):
+                polygon = next(feature.iter("{*}Polygon"))
+                if srs_name is None:
+                    srs_name = polygon.attrib["srsName"]
+                rings = [np.fromstring(next(boundary.iter("{*}coordinates")).text.replace(",", " "),
+                                       dtype="<f8", sep=" ").reshape(-1, 2)
+                         for tag in ("{*}outerBoundaryIs", "{*}innerBoundaryIs")
+                         for boundary in polygon.iter(tag)]
+                for ring in rings:
+                    ring.tofile(coordinate_file)
+                    ring_offsets.append(ring_offsets[-1] + len(ring))
+                polygon_offsets.append(len(ring_offsets) - 1)
+                codes.append(int(next(feature.iter("{*}clc18_kode")).text))
+                boxes.append((*rings[0].min(axis=0), *rings[0].max(axis=0)))
+
+                feature.clear()
+                while feature.getprevious() is not None:
+                    del feature.getparent()[0]
+        if srs_name is None:
+            shutil.rmtree(temp, ignore_errors=True)
+            raise RuntimeError(f"No polygons found in {self.filepath}")
+
+        np.save(temp / "codes.npy", np.array(codes, dtype=np.int32))
+        np.save(temp / "boxes.npy", np.array(boxes, dtype=np.float64).reshape(-1, 4))
+        np.save(temp / "polygon_offsets.npy", np.array(polygon_offsets, dtype=np.int64))
+        np.save(temp / "ring_offsets.npy", np.array(ring_offsets, dtype=np.int64))
+        meta = dict(source, srs_name=srs_name, num_vertices=ring_offsets[-1])
+        with (temp / "meta.json").open("w") as meta_file:
+            json.dump(meta, meta_file)
+        shutil.rmtree(self.directory, ignore_errors=True)
+        os.replace(temp, self.directory)
+        return meta
+
+    def query(self, box: Tuple[float, float, float, float]) -> np.ndarray:
+        """ Indices of the polygons whose bounding boxes intersect box, in file order. """
+        return self.tree.query(box)
+
+    def rings(self, index: int) -> List[np.ndarray]:
+        """ Exterior ring followed by the holes of a polygon, as views of the store. """
+        first, last = self.polygon_offsets[index], self.polygon_offsets[index + 1]
+        return [self.coordinates[self.ring_offsets[r]:self.ring_offsets[r + 1]] for r in range(first, last)]
+
+    def polygon(self, index: int) -> Polygon:
+        exterior, *holes = self.rings(index)
+        return Polygon(shell=exterior, holes=holes)
+
+
 class GMLRepository(LandCoverRepository):
 
     land_cover_type = LandCoverType
@@ -137,58 +243,55 @@ class GMLRepository(LandCoverRepository):
         files = list(path.glob("*.gml"))
         assert len(files) == 1
         self.fn = files[0]
-        self.parser = etree.XMLParser(encoding="utf-8", recover=True, huge_tree=True)
         self.data_crs: Optional[CRS] = None
+        self._store: Optional[PolygonStore] = None
 
-    def _parse_polygon(self, polygon: etree._Element, nsmap: Dict[str, str]) -> Polygon:
-        gml = f"{{{nsmap['gml']}}}"
-        ogr = f"{{{nsmap['ogr']}}}"
-        outer_boundary = next(polygon.iter(f"{gml}outerBoundaryIs"))
-        citer = (float(x) for x in next(outer_boundary.iter(f"{gml}coordinates")).text.replace(",", " ").split())
-        shell = np.fromiter(citer, dtype='d').reshape(-1, 2)
-        holes = []
-        for inner_boundary in polygon.iter(f"{gml}innerBoundaryIs"):
-            citer = (float(x) for x in next(inner_boundary.iter(f"{gml}coordinates")).text.replace(",", " ").split())
-            holes.append(np.fromiter(citer, dtype='d').reshape(-1, 2))
-        return Polygon(shell=shell, holes=holes)
-
-    def _assign_data_crs(self, root: etree._Element) -> None:
-        gml = f"{{{root.nsmap['gml']}}}"
-        elm = next(root.iter(f"{gml}featureMember"))
-        pstr = next(elm.iter(f"{gml}Polygon")).attrib["srsName"]
-        self.data_crs = CRS.from_string(f"+init={pstr}")
+    @property
+    def store(self) -> PolygonStore:
+        if self._store is None:
+            self._store = PolygonStore(filepath=self.fn)
+            self.data_crs = self._store.crs
+        return self._store
 
     def read(self, domain: GeoPolygon) -> Dict[LandCoverType, List[Polygon]]:
-        tree = etree.parse(str(self.fn), self.parser)
-        root = tree.getroot()
-        self._assign_data_crs(root)
+        store = self.store
         if domain.crs.to_authority() != self.data_crs.to_authority():
             domain = domain.transform(target_crs=self.data_crs)
-        assert "gml" in root.nsmap, "Not a GML file!"
-        assert "ogr" in root.nsmap, "Can not find land cover types!"
-        gml = f"{{{root.nsmap['gml']}}}"
-        ogr = f"{{{root.nsmap['ogr']}}}"
         result = {}
-        for elm in root.iter(f"{gml}featureMember"):
-            code = LandCoverType(int(next(elm.iter(f"{ogr}clc18_kode")).text))
-            polygon = self._parse_polygon(next(elm.iter(f"{gml}Polygon")), root.nsmap)
+        for k in store.query(domain.polygon.bounds):
+            polygon = store.polygon(k)
             if polygon.intersects(domain.polygon):
+                code = LandCoverType(int(store.codes[k]))
                 if code not in result:
                     result[code] = []
                 result[code].append(polygon.intersection(domain.polygon))
         return result
 
+    # Land cover types with boundaries that are inserted as break lines in the mesh
+    constraint_types = (LandCoverType.road_and_rail,
+                        LandCoverType.water_course,
+                        LandCoverType.water_body,
+                        LandCoverType.coastal_lagoon,
+                        LandCoverType.estuary,
+                        LandCoverType.sea_and_ocean)
+
     def constraints(self, *, domain: GeoPolygon) -> List[GeoPolygon]:
-        return []
+        """Roads and water bodies intersecting the domain, in the data coordinate system."""
+        land_cover_types = self.read(domain)
+        result = []
+        for code in self.constraint_types:
+            for polygon in land_cover_types.get(code, []):
+                parts = polygon.geoms if hasattr(polygon, "geoms") else [polygon]
+                result.extend(GeoPolygon(polygon=part, crs=self.data_crs)
+                              for part in parts if isinstance(part, Polygon) and not part.is_empty)
+        return result
 
     def land_cover(self,
                    *,
                    land_types: Optional[List[LandCoverType]],
                    geo_points: GeoPoints,
                    domain: GeoPolygon) -> np.ndarray:
-        tree = etree.parse(str(self.fn), self.parser)
-        root = tree.getroot()
-        self._assign_data_crs(root)
+        store = self.store
         pts_crs = geo_points.crs
         if pts_crs.to_authority() != self.data_crs.to_authority():
             xy = np.dstack(Transformer.from_crs(pts_crs, self.data_crs).transform(
@@ -196,32 +299,19 @@ class GMLRepository(LandCoverRepository):
                 geo_points.xy[:, 1])).reshape((-1, 2))
         else:
             xy = geo_points.xy
-        # Add rel_buffer_size buffer on domain to make sure we hit all geo_points in data projection
-        rel_buffer_size = 0.02
-        domain = domain.transform(target_crs=self.data_crs)
-        bbox = domain.polygon.bounds
-        buffer_size = (bbox[2] - bbox[0])*rel_buffer_size
-        domain = domain.buffer(buffer_size)
-
-        # At this point, we have a consistent coordinate system for domain and xy all in the self.data_crs, so
-        # omit checks for speed.
-
-        land_cover_types = self.read(domain)
+        xy = np.ascontiguousarray(xy, dtype='d')
+        if not len(xy):
+            return np.zeros(0, dtype=np.int32)
 
-        # TODO: Move to C++ for speed!
-        faces = np.zeros(len(xy), dtype="int")
-        for i, _pt in enumerate(xy):
-            pt = Point(_pt)
-            found = False
-            for key, p_list in land_cover_types.items():
-                for p in p_list:
-                    if p.intersects(pt):
-                        faces[i] = key.value
-                        found = True
-                        break
-                if found:
-                    break
-            if not found:
-                raise RuntimeError(f"Illegal point {pt}")
+        # Whole polygons are classified against, so only the ones whose boxes hold points are needed,
+        # and they go to the classifier as views of the store without clipping them to the domain
+        classifier = td.polygon_classifier()
+        for k in store.query((*xy.min(axis=0), *xy.max(axis=0))):
+            exterior, *holes = store.rings(k)
+            classifier.add(int(store.codes[k]), exterior, holes)
+        faces = classifier.classify(xy, default_label=-1)
+        illegal = np.flatnonzero(faces < 0)
+        if len(illegal):
+            raise RuntimeError(f"Illegal point {Point(xy[illegal[0]])}")
         return faces
 
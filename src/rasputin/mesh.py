@@ -7,45 +7,130 @@ from pyproj import CRS
 import meshio
 
 
+def _raster_to_cpp(data: tp.Union[tp.List[Rasterdata], Rasterdata], mosaic_policy: str = "priority"):
+    """C++ raster, or raster mosaic for a list of rasters, and its coordinate system."""
+    if isinstance(data, list):
+        if data[0].array.dtype == np.float64:
+            raster_list = triangulate_dem.raster_list_double()
+            raster_mosaic = triangulate_dem.raster_mosaic_double
+        else:
+            raster_list = triangulate_dem.raster_list_float()
+            raster_mosaic = triangulate_dem.raster_mosaic_float
+
+        for raster in data:
+            raster_list.add_raster(raster.to_cpp())
+        return (raster_mosaic(raster_list, getattr(triangulate_dem.mosaic_policy, mosaic_policy)),
+                data[0].coordinate_system)
+
+    return data.to_cpp(), data.coordinate_system
+
+
 class Mesh:
+    """
+    Triangulated surface.
 
-    def __init__(self, cpp_mesh: triangulate_dem.Mesh):
+    The precision decides the types of the points and faces arrays:
+     * "double":  float64 points and int32 faces
+     * "compact": float32 points relative to origin and uint32 faces, for half the memory
+     * "large":   float64 points and int64 faces, for more than 2^31 points
+    """
+
+    precisions = ("double", "compact", "large")
+
+    def __init__(self,
+                 cpp_mesh: triangulate_dem.Mesh,
+                 *,
+                 precision: str = "double",
+                 origin: tp.Optional[np.ndarray] = None):
+        if precision not in self.precisions:
+            raise ValueError(f"Unknown precision '{precision}', must be one of {self.precisions}")
         self._cpp = cpp_mesh
+        self._precision = precision
+        self._origin = None if origin is None else np.asarray(origin, dtype=np.float64)
+        self._flat: tp.Optional[tuple] = None
         self._face_normals: tp.Optional[np.ndarray] = None
         self._point_normals: tp.Optional[np.ndarray] = None
 
+    def _wrap(self, cpp_mesh: triangulate_dem.Mesh) -> "Mesh":
+        return self.__class__(cpp_mesh, precision=self._precision, origin=self._origin)
+
+    def with_precision(self, precision: str, *, origin: tp.Optional[np.ndarray] = None) -> "Mesh":
+        """
+        The same mesh, sharing its storage, with points and faces of the given precision. The
+        origin of compact meshes defaults to the centre of the bounding box.
+        """
+        return self.__class__(self._cpp, precision=precision, origin=origin)
+
+    @property
+    def precision(self) -> str:
+        return self._precision
+
+    @property
+    def origin(self) -> np.ndarray:
+        """Point the points are relative to, only different from zero for compact meshes."""
+        if self._precision != "compact":
+            return np.zeros(3)
+        if self._origin is None:
+            self._origin = np.asarray(self._cpp.bounding_box_centre, dtype=np.float64)
+        return self._origin
+
+    def _cpp_points_faces(self) -> tuple:
+        if self._precision == "double":
+            return self._cpp.points, self._cpp.faces
+        if self._flat is None:
+            if self._precision == "compact":
+                self._flat = self._cpp.compact_points_faces(self.origin)
+            else:
+                self._flat = self._cpp.large_points_faces()
+        return self._flat
+
     @classmethod
     def from_points_and_faces(cls, *, points: np.ndarray, faces: np.ndarray, proj4_str: str) -> "Mesh":
-        points = triangulate_dem.point3_vector(points.tolist())
-        faces = triangulate_dem.face_vector(faces.tolist())
-        return cls(triangulate_dem.construct_mesh(points, faces, proj4_str))
+        # The arrays are read in place when they are C-contiguous float64, and int32 or int64. Faces
+        # that do not fit in int32 are passed as int64, where indices out of range raise an IndexError.
+        faces = np.asarray(faces)
+        index_type = np.intc if np.can_cast(faces.dtype, np.intc) else np.int64
+        return cls(triangulate_dem.construct_mesh(np.ascontiguousarray(points, dtype=np.float64),
+                                                  np.ascontiguousarray(faces, dtype=index_type),
+                                                  proj4_str))
 
     @classmethod
     def from_raster(cls, *,
                     data: tp.Union[tp.List[Rasterdata], Rasterdata],
-                    domain: tp.Optional[GeoPolygon] = None) -> "Mesh":
-        # Extract cpp objects
-        if isinstance(data, list):
-            if data[0].array.dtype == np.float64:
-                rasterdata_cpp = triangulate_dem.raster_list_double()
-            else:
-                rasterdata_cpp = triangulate_dem.raster_list_float()
+                    domain: tp.Optional[GeoPolygon] = None,
+                    mosaic_policy: str = "priority",
+                    constraints: tp.Optional[tp.List[GeoPolygon]] = None,
+                    reorder: bool = False) -> "Mesh":
+        """Triangulate raster data inside the domain.
 
-            proj4_str = data[0].coordinate_system
-            for raster in data:
-                rasterdata_cpp.add_raster(raster.to_cpp())
+        A list of rasters is meshed as one mosaic, where each location is sampled once. With the
+        "priority" policy the first raster with data wins in overlaps, and with "blend" the
+        overlapping rasters are averaged.
 
-        else:
-            rasterdata_cpp = data.to_cpp()
-            proj4_str = data.coordinate_system
+        The boundaries of the constraint polygons, like lake shorelines and roads, are draped onto
+        the raster and inserted as break lines. Break lines are kept when the mesh is simplified.
+        Constraints need a domain.
+
+        With reorder, the faces and points are sorted for locality, see reorder.
+        """
+        if constraints and not domain:
+            raise ValueError("Break line constraints can only be used together with a domain")
 
-        if domain:
+        rasterdata_cpp, proj4_str = _raster_to_cpp(data, mosaic_policy)
+
+        if domain and constraints:
+            raster_crs = CRS.from_proj4(proj4_str)
+            break_lines = triangulate_dem.multi_polygon()
+            for constraint in constraints:
+                break_lines.add_part(constraint.transform(target_crs=raster_crs).to_cpp())
+            mesh = cls(triangulate_dem.make_mesh(rasterdata_cpp, domain.to_cpp(), break_lines, raster_crs.to_proj4()))
+        elif domain:
             tmp = triangulate_dem.make_mesh(rasterdata_cpp, domain.to_cpp(), CRS.from_proj4(proj4_str).to_proj4())
             mesh = cls(tmp)
         else:
             mesh = cls(triangulate_dem.make_mesh(rasterdata_cpp, CRS.from_proj4(proj4_str).to_proj4()))
 
-        return mesh
+        return mesh.reorder()[0] if reorder else mesh
 
     @property
     def num_points(self) -> int:
@@ -63,19 +148,57 @@ class Mesh:
     def characteristic(self) -> int:
         return self.num_points - self.num_edges + self.num_faces
 
+    @property
+    def part_ids(self) -> np.ndarray:
+        """Index of the domain part each face belongs to, empty unless meshed from a multipolygon."""
+        return np.asarray(self._cpp.part_ids)
+
+    @property
+    def constrained_edges(self) -> np.ndarray:
+        """End points of the break line edges in the mesh, as an array of shape (n, 2, 3)."""
+        return np.asarray(self._cpp.constrained_edges)
+
+    @property
+    def face_attributes(self) -> tp.Dict[str, np.ndarray]:
+        return self._cpp.face_attributes
+
+    @property
+    def vertex_attributes(self) -> tp.Dict[str, np.ndarray]:
+        return self._cpp.vertex_attributes
+
+    def with_face_attribute(self, name: str, values: np.ndarray, *, preserve_boundaries: bool = False) -> "Mesh":
+        """
+        Mesh with a value for each face, that follows the faces through simplification, sub mesh
+        extraction and reordering. Integer values are stored as int32 and others as float64. With
+        preserve_boundaries, edges between faces of different value are never collapsed.
+        """
+        return self._wrap(self._cpp.with_face_attribute(name, np.asarray(values),
+                                                        "boundary" if preserve_boundaries else "free"))
+
+    def with_vertex_attribute(self, name: str, values: np.ndarray, *, merge: str = "average") -> "Mesh":
+        """
+        Mesh with a value for each point, that follows the points through simplification, sub mesh
+        extraction and reordering. When an edge is collapsed, the values of its end points are merged
+        by "average", "minimum", "maximum" or "nearest", which keeps the value of the end point
+        closest to the new point and suits labels.
+        """
+        return self._wrap(self._cpp.with_vertex_attribute(name, np.asarray(values), merge))
+
     @property
     def points(self) -> np.ndarray:
-        array = np.asarray(self._cpp.points)
+        """Points, relative to origin for compact meshes."""
+        array = np.asarray(self._cpp_points_faces()[0])
         array.flags.writeable = False
         return array
 
     @property
     def cell_centers(self) -> np.ndarray:
-        return self.points[self.faces].mean(axis=1)
+        """Face centroids in float64, with the origin added back."""
+        return self.points[self.faces].mean(axis=1, dtype=np.float64) + self.origin
 
     @property
     def faces(self) -> np.ndarray:
-        array = np.asarray(self._cpp.faces)
+        array = np.asarray(self._cpp_points_faces()[1])
         array.flags.writeable = False
         return array
 
@@ -83,8 +206,7 @@ class Mesh:
     def face_normals(self) -> np.ndarray:
         # Only compute normals when needed, and only once
         if self._face_normals is None:
-            self._face_normals = triangulate_dem.surface_normals(self._cpp.points,
-                                                                 self._cpp.faces)
+            self._face_normals = triangulate_dem.surface_normals(*self._cpp_points_faces())
 
         array = np.asarray(self._face_normals)
         array.flags.writeable = False
@@ -93,16 +215,48 @@ class Mesh:
     @property
     def point_normals(self) -> np.ndarray:
         if self._point_normals is None:
-            self._point_normals = triangulate_dem.point_normals(self._cpp.points,
-                                                                self._cpp.faces)
-            array = np.asarray(self._point_normals)
-            array.flags.writeable = False
-            return array
+            self._point_normals = triangulate_dem.point_normals(*self._cpp_points_faces())
+
+        array = np.asarray(self._point_normals)
+        array.flags.writeable = False
+        return array
+
+    def terrain_attributes(self, *,
+                           face_normals: bool = False,
+                           slopes: bool = False,
+                           aspects: bool = False,
+                           cell_centers: bool = False,
+                           point_normals: bool = False,
+                           out: tp.Optional[tp.Dict[str, np.ndarray]] = None) -> tp.Dict[str, np.ndarray]:
+        """
+        Compute the requested terrain attributes in one multithreaded pass over the faces.
+
+        Face normals, cell centers and point normals are structure of arrays of shape (3, n), so that
+        component k of face i is at [k, i]. Slopes and aspects have shape (n,). Arrays in out, which
+        must be float64 and C-contiguous, are written to instead of new arrays.
+        """
+        out = dict(out or {})
+        shapes = dict(face_normals=(3, self.num_faces),
+                      slopes=(self.num_faces,),
+                      aspects=(self.num_faces,),
+                      cell_centers=(3, self.num_faces),
+                      point_normals=(3, self.num_points))
+        requested = dict(face_normals=face_normals, slopes=slopes, aspects=aspects,
+                         cell_centers=cell_centers, point_normals=point_normals)
+        for name, shape in shapes.items():
+            if requested[name] or name in out:
+                out.setdefault(name, np.empty(shape))
+        triangulate_dem.terrain_attributes(self._cpp, **out)
+        return out
 
     def simplify(self,
                  *,
                  ratio: tp.Optional[float] = None,
-                 max_size: tp.Optional[int] = None) -> "Mesh":
+                 max_size: tp.Optional[int] = None,
+                 parallel: bool = False,
+                 max_vertical_error: tp.Optional[float] = None,
+                 data: tp.Optional[tp.Union[tp.List[Rasterdata], Rasterdata]] = None,
+                 reorder: bool = False) -> "Mesh":
 
         """
         Simplify mesh by edge collapse, using the Lindstrom-Turk cost functional
@@ -110,26 +264,76 @@ class Mesh:
 
         :ratio:    Target ratio for edges in result mesh to edges in initial mesh
         :max_size: Maximum number of edges in the result mesh
+        :parallel: Simplify spatial partitions of the mesh on all cores
+        :max_vertical_error: Collapse edges for as long as the vertical distance from the
+                             mesh to the raster samples in data stays below this value,
+                             so that the mesh size follows the terrain complexity
+        :data:     Raster data the mesh was made from, needed with max_vertical_error
+        :reorder:  Sort the faces and points of the result for locality, see reorder
         :returns:  Mesh
 
         """
         result = self
+        if max_vertical_error is not None:
+            if data is None:
+                raise ValueError("Simplification by vertical error needs the raster data")
+            rasterdata_cpp, _ = _raster_to_cpp(data)
+            result = self._wrap(self._cpp.lindstrom_turk_by_vertical_error(rasterdata_cpp, max_vertical_error))
+
         if ratio is not None:
             if ratio < 1:
-                result = self.__class__(self._cpp.lindstrom_turk_by_ratio(ratio))
+                result = self._wrap(result._cpp.lindstrom_turk_by_ratio(ratio, parallel=parallel))
 
         if max_size is not None:
             if max_size < result.num_edges:
-                result = self.__class__(result._cpp.lindstrom_turk_by_size(max_size))
+                result = self._wrap(result._cpp.lindstrom_turk_by_size(max_size, parallel=parallel))
+
+        if reorder:
+            return result.reorder()[0]
 
         # If no valid criteria return a copy (consistent with e.g. ratio > 1)
         return self.copy() if result is self else result
 
+    def reorder(self) -> tp.Tuple["Mesh", np.ndarray]:
+        """
+        Sort the faces along a Hilbert curve through their centroids, and number the points
+        in the order the faces first use them, so that neighbouring faces and their points
+        are close in memory.
+
+        :returns: The reordered mesh, and the index of each of its faces in this mesh. Face
+                  fields follow the faces with field[order].
+        """
+        order = self._cpp.hilbert_face_order()
+        return self._wrap(self._cpp.permute_faces(order)), np.asarray(order)
+
+    def progressive(self, *, ratio: float = 0.0) -> "ProgressiveMesh":
+        """
+        Simplify mesh by Lindstrom-Turk edge collapse down to the edge ratio, and
+        record the collapses so that every level of detail can be extracted.
+        """
+        return ProgressiveMesh(self._cpp.lindstrom_turk_progressive(ratio))
+
     def copy(self) -> "Mesh":
-        return self.__class__(self._cpp.copy())
+        return self._wrap(self._cpp.copy())
+
+    @property
+    def proj4_str(self) -> str:
+        return self._cpp.proj4_str
+
+    def reproject(self, target_crs: CRS) -> "Mesh":
+        """
+        The mesh with its points transformed to the target coordinate system, in parallel. Faces,
+        constraints and attributes carry over unchanged. Geographic coordinates are lon, lat in degrees.
+        """
+        return self._wrap(self._cpp.reproject(target_crs.to_proj4()))
 
     def extract_sub_mesh(self, faces: np.ndarray):
-        return self.__class__(self._cpp.extract_sub_mesh(faces));
+        return self._wrap(self._cpp.extract_sub_mesh(faces));
+
+    def partition_by_label(self, labels: np.ndarray) -> tp.Dict[int, "Mesh"]:
+        """Sub meshes of the faces with each label, built in one pass over the faces."""
+        return {label: self._wrap(cpp_mesh)
+                for label, cpp_mesh in self._cpp.partition_by_label(np.asarray(labels, dtype=np.intc)).items()}
 
     def write(self, filename: str):
         """
@@ -141,3 +345,50 @@ class Mesh:
 
     def shade(self, timestamp: float) -> np.ndarray:
         return triangulate_dem.shade(self._cpp, timestamp)
+
+
+class ProgressiveMesh:
+    """Edge collapse sequence of a mesh, from which any level of detail is extracted."""
+
+    def __init__(self, cpp_progressive_mesh: triangulate_dem.progressive_mesh):
+        self._cpp = cpp_progressive_mesh
+
+    @property
+    def num_points(self) -> int:
+        return len(self._cpp.points)
+
+    @property
+    def min_num_points(self) -> int:
+        return self._cpp.min_num_vertices
+
+    def extract(self, *,
+                num_points: tp.Optional[int] = None,
+                ratio: tp.Optional[float] = None) -> Mesh:
+        """
+        Extract the mesh with the given number of points, or the given ratio of
+        points to the points in the full mesh. The coarsest mesh is returned if the
+        target is below what the recorded collapses can reach.
+        """
+        if num_points is None:
+            num_points = self.num_points if ratio is None else int(round(ratio*self.num_points))
+        return Mesh(self._cpp.extract(max(num_points, 0)))
+
+    def save(self, path: str) -> None:
+        np.savez(path,
+                 points=np.asarray(self._cpp.points),
+                 faces=np.asarray(self._cpp.faces),
+                 removed=self._cpp.removed,
+                 kept=self._cpp.kept,
+                 positions=np.asarray(self._cpp.positions).reshape(-1, 3),
+                 proj4_str=self._cpp.proj4_str)
+
+    @classmethod
+    def load(cls, path: str) -> "ProgressiveMesh":
+        with np.load(path) as data:
+            return cls(triangulate_dem.progressive_mesh(
+                triangulate_dem.point3_vector.from_numpy(data["points"]),
+                triangulate_dem.face_vector.from_numpy(data["faces"]),
+                triangulate_dem.int_vector(data["removed"].tolist()),
+                triangulate_dem.int_vector(data["kept"].tolist()),
+                triangulate_dem.point3_vector.from_numpy(data["positions"]),
+                str(data["proj4_str"])))
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rasputin {
+
+inline std::size_t num_threads() {
+    return std::max<std::size_t>(1, std::thread::hardware_concurrency());
+}
+
+// Call f(i) for every i in [0, n) on a pool of worker threads.
+//
+// Indices are handed out one at a time, so tasks of very different size (like
+// the parts of a multipolygon) are balanced between the threads. The first
+// exception thrown by a task is rethrown in the calling thread.
+template<typename F>
+void parallel_for(std::size_t n, F f, std::size_t max_threads = 0) {
+    const std::size_t thread_count = std::min(n, max_threads ? max_threads : num_threads());
+    if (thread_count <= 1) {
+        for (std::size_t i = 0; i < n; ++i)
+            f(i);
+        return;
+    }
+
+    std::atomic<std::size_t> next{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&] () {
+        for (std::size_t i = next++; i < n; i = next++) {
+            try {
+                f(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (not error)
+                    error = std::current_exception();
+                next = n;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (std::size_t t = 0; t + 1 < thread_count; ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread: threads)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+}
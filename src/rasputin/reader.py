@@ -1,6 +1,8 @@
-from typing import Dict, Any, Optional,  Tuple, List
+from typing import Dict, Any, Optional,  Tuple, List, Union
 from dataclasses import dataclass
 from enum import Enum
+import json
+import os
 from PIL import Image
 from PIL.TiffImagePlugin import TiffImageFile
 from rasputin.geometry import GeoPolygon
@@ -18,6 +20,7 @@ class GeoTiffTags(Enum):
     ModelTiePointTag = 33922
     ModelPixelScaleTag = 33550
     GeoKeyDirectoryTag = 34735
+    GDALNoDataTag = 42113
 
 
 class KeyValueTags(Enum):
@@ -90,6 +93,15 @@ def _isinteger(obj: Any) -> bool:
     return np.issubdtype(type(obj), np.integer)
 
 
+def _readable_short(value: int) -> Any:
+    # Translate special integer values for readability:
+    if value == 0:
+        return "undefined"
+    if value == 32767:
+        return "user-defined"
+    return value
+
+
 def extract_geo_keys(*, image: TiffImageFile) -> Dict[str, Any]:
     """ Extract GeoKeys from image and return as Python dictionary. """
 
@@ -118,14 +130,7 @@ def extract_geo_keys(*, image: TiffImageFile) -> Dict[str, Any]:
 
         if KeyValueTags(location) == KeyValueTags.GeoShortParamsTag:
             # Short values are stored in value_offset field in the directory
-            key_value = value_offset
-
-            # Translate special integer values for readability:
-            if key_value == 0:
-                key_value = "undefined"
-
-            elif key_value == 32767:
-                key_value = "user-defined"
+            key_value = _readable_short(value_offset)
 
         if KeyValueTags(location) == KeyValueTags.GeoDoubleParamsTag:
             tiff_tag = KeyValueTags.GeoDoubleParamsTag.value
@@ -291,6 +296,14 @@ class GeoKeysInterpreter(object):
         return update
 
 
+def native_geo_keys(*, tiff: triangulate_dem.GeoTiff) -> Dict[str, Any]:
+    """ GeoKeys parsed by the native reader, named as by extract_geo_keys. """
+    if not tiff.geo_keys:
+        raise RuntimeError("Image is missing GeoKeyDirectory required by GeoTiff v1.0.")
+    return {GeoKeys(key_id).name: _readable_short(value) if isinstance(value, int) else value
+            for (key_id, value) in tiff.geo_keys.items()}
+
+
 def identify_projection(*, image: TiffImageFile) -> str:
     geokeys = extract_geo_keys(image=image)
     return GeoKeysInterpreter(geokeys).to_proj4()
@@ -326,6 +339,7 @@ class Rasterdata(ImageExtents):
     array: np.ndarray
     coordinate_system: str
     info: Dict[str, Any]
+    nodata: Optional[float] = None
 
     def __post_init__(self):
         shapes = self.shape, self.array.shape
@@ -337,19 +351,52 @@ class Rasterdata(ImageExtents):
         return GeoPolygon(polygon=Polygon.from_bounds(*self.box),
                           crs=pyproj.CRS.from_proj4(self.coordinate_system))
 
+    def sample(self,
+               xy: np.ndarray,
+               *,
+               policy: str = "bilinear",
+               gradients: bool = False) -> Union[np.ndarray, Tuple[np.ndarray, np.ndarray]]:
+        """
+        Heights at an (n, 2) array of points, with policy "nearest", "bilinear" or "bicubic",
+        and their (n, 2) gradients when asked for. Voids and points outside give NaN.
+        """
+        return self.to_cpp().sample(xy, getattr(triangulate_dem.sampling_policy, policy), gradients)
+
+    def terrain_attributes(self,
+                           *,
+                           slopes: bool = False,
+                           aspects: bool = False,
+                           curvatures: bool = False,
+                           out: Optional[Dict[str, np.ndarray]] = None) -> Dict[str, np.ndarray]:
+        """
+        Compute the requested terrain attributes at the raster points, without meshing, in one
+        multithreaded pass. Slopes and aspects, in radians as for mesh faces, come from the Horn
+        gradient, and curvatures are the Laplacian of the height, positive in hollows. Border points
+        and points next to voids are NaN. Arrays in out, which must be float64 and C-contiguous with
+        the raster shape, are written to instead of new arrays.
+        """
+        out = dict(out or {})
+        requested = dict(slopes=slopes, aspects=aspects, curvatures=curvatures)
+        for name in requested:
+            if requested[name] or name in out:
+                out.setdefault(name, np.empty(self.shape))
+        self.to_cpp().terrain_attributes(**out)
+        return out
+
     def to_cpp(self) -> triangulate_dem.raster_data_float:
-        return triangulate_dem.raster_data_float(self.array,
+        # Copies only when the array is not a contiguous float32 array, like a
+        # window of a memory mapped file narrower than the image
+        return triangulate_dem.raster_data_float(np.ascontiguousarray(self.array, dtype=np.float32),
                                                  self.x_min,
                                                  self.y_max,
                                                  self.delta_x,
-                                                 self.delta_y)
-
-def crop_image_to_polygon(*,
-                          image: Image.Image,
-                          polygon: Polygon, extents=None) -> Tuple[Image.Image, ImageExtents]:
-    if not extents:
-        extents = get_image_extents(image)
+                                                 self.delta_y,
+                                                 nodata=self.nodata)
 
+def crop_extents(*,
+                 extents: ImageExtents,
+                 polygon: Polygon) -> Tuple[Tuple[int, int, int, int], ImageExtents]:
+    """ Image box (j_min, i_min, j_max, i_max) covering the polygon, and its extents. """
     (m, n) = extents.shape
     delta_x, delta_y = extents.delta_x, extents.delta_y
 
@@ -359,17 +406,10 @@ def crop_image_to_polygon(*,
     # We need polygon bounds in image coordinates
     x_min_p, y_min_p, x_max_p, y_max_p = polygon.bounds
 
-    j_min = np.clip(np.floor((x_min_p - x_min)/delta_x), 0, n - 1)
-    i_min = np.clip(np.floor((y_max - y_max_p)/delta_y), 0, m - 1)
-    j_max = np.clip(np.ceil((x_max_p - x_min)/delta_x) + 1, 1, n)
-    i_max = np.clip(np.ceil((y_max - y_min_p)/delta_y) + 1, 1, m)
-
-    # NOTE: Issues with Pillows Image.crop
-    #     - Cropping is sepcified in image coordinates
-    #     - Cropping does not include last indices of the cropping box
-    #     - Cropping discards tiff tags
-
-    sub_image = image.crop(box=(j_min, i_min, j_max, i_max))
+    j_min = int(np.clip(np.floor((x_min_p - x_min)/delta_x), 0, n - 1))
+    i_min = int(np.clip(np.floor((y_max - y_max_p)/delta_y), 0, m - 1))
+    j_max = int(np.clip(np.ceil((x_max_p - x_min)/delta_x) + 1, 1, n))
+    i_max = int(np.clip(np.ceil((y_max - y_min_p)/delta_y) + 1, 1, m))
 
     # Find extents of the cropped image
     sub_extents = ImageExtents(shape=(i_max - i_min, j_max - j_min),
@@ -377,16 +417,53 @@ def crop_image_to_polygon(*,
                                x_min=x_min + j_min * delta_x,
                                y_max=y_max - i_min * delta_y)
 
+    return (j_min, i_min, j_max, i_max), sub_extents
+
+
+def crop_image_to_polygon(*,
+                          image: Image.Image,
+                          polygon: Polygon, extents=None) -> Tuple[Image.Image, ImageExtents]:
+    if not extents:
+        extents = get_image_extents(image)
+
+    # NOTE: Issues with Pillows Image.crop
+    #     - Cropping is sepcified in image coordinates
+    #     - Cropping does not include last indices of the cropping box
+    #     - Cropping discards tiff tags
+
+    box, sub_extents = crop_extents(extents=extents, polygon=polygon)
+    sub_image = image.crop(box=box)
+
     return sub_image, sub_extents
 
+def get_nodata_value(image: Image.Image) -> Optional[float]:
+    # GDAL stores the nodata value as an ascii string
+    value = image.tag_v2.get(GeoTiffTags.GDALNoDataTag.value)
+    if value is None:
+        return None
+    try:
+        return float(str(value).strip("\x00 "))
+    except ValueError:
+        return None
+
 def get_image_extents(image: Image.Image) -> Tuple[float, float, float, float]:
     tiepoint_idx = GeoTiffTags.ModelTiePointTag.value
-    j_tag, i_tag, _, x_tag, y_tag, _ = image.tag_v2.get(tiepoint_idx, (0, 0, 0, 0, 0, 0))
-
     scale_idx = GeoTiffTags.ModelPixelScaleTag.value
-    delta_x, delta_y, _ = image.tag_v2.get(scale_idx, (1.0, 1.0, 0.0))
-
     n, m = image.size
+    return _extents_from_tags(tie_point=image.tag_v2.get(tiepoint_idx),
+                              pixel_scale=image.tag_v2.get(scale_idx),
+                              shape=(m, n))
+
+def get_tiff_extents(tiff: triangulate_dem.GeoTiff) -> ImageExtents:
+    return _extents_from_tags(tie_point=tiff.tie_point,
+                              pixel_scale=tiff.pixel_scale,
+                              shape=(tiff.height, tiff.width))
+
+def _extents_from_tags(*, tie_point, pixel_scale, shape: Tuple[int, int]) -> ImageExtents:
+    j_tag, i_tag, _, x_tag, y_tag, _ = tie_point or (0, 0, 0, 0, 0, 0)
+    delta_x, delta_y, _ = pixel_scale or (1.0, 1.0, 0.0)
+
+    m, n = shape
 
 
     x_min = x_tag - delta_x * j_tag
@@ -406,12 +483,41 @@ def read_raster_file(*,
     logger.debug(f"Reading raster file {filepath}")
     assert filepath.exists()
 
+    try:
+        tiff = triangulate_dem.GeoTiff(str(filepath))
+    except ValueError:
+        # Layouts the native reader does not handle, like multi band images
+        return _read_raster_file_with_pil(filepath=filepath, polygon=polygon)
+
+    info = native_geo_keys(tiff=tiff)
+    coordinate_system = GeoKeysInterpreter(info).to_proj4()
+    extents = get_tiff_extents(tiff)
+    box = (0, 0, tiff.width, tiff.height)
+    if polygon:
+        box, extents = crop_extents(extents=extents, polygon=polygon)
+
+    # Only the tiles intersecting the box are decoded, and uncompressed
+    # images are viewed directly in the file mapping
+    j_min, i_min, j_max, i_max = box
+    image_array = tiff.read(row=i_min, col=j_min, rows=i_max - i_min, cols=j_max - j_min)
+    logger.debug("Done")
+
+    return Rasterdata(array=image_array, shape=extents.shape,
+                      x_min=extents.x_min, y_max=extents.y_max,
+                      delta_x=extents.delta_x, delta_y=extents.delta_y,
+                      info=info, coordinate_system=coordinate_system, nodata=tiff.nodata)
+
+def _read_raster_file_with_pil(*,
+                               filepath: Path,
+                               polygon: Optional[Polygon] = None) -> Rasterdata:
+    logger = getLogger()
     with Image.open(filepath) as image:
         # Since cropping discards tiff tags we extract tags data first
         info = extract_geo_keys(image=image)
         coordinate_system = identify_projection(image=image)
 
         extents = get_image_extents(image)
+        nodata = get_nodata_value(image)
 
         if polygon:
             image, extents = crop_image_to_polygon(image=image, polygon=polygon, extents=extents)
@@ -424,29 +530,320 @@ def read_raster_file(*,
     return Rasterdata(array=image_array, shape=extents.shape,
                       x_min=extents.x_min, y_max=extents.y_max,
                       delta_x=extents.delta_x, delta_y=extents.delta_y,
-                      info=info, coordinate_system=coordinate_system)
+                      info=info, coordinate_system=coordinate_system, nodata=nodata)
 
-class RasterRepository:
+def read_raster_header(*, filepath: Path) -> Tuple[Dict[str, Any], str, ImageExtents, Optional[float]]:
+    """ GeoKeys, coordinate system, extents and nodata value of a raster file, read from its header only. """
+    try:
+        tiff = triangulate_dem.GeoTiff(str(filepath))
+    except ValueError:
+        with Image.open(filepath) as image:
+            info = extract_geo_keys(image=image)
+            return info, GeoKeysInterpreter(info).to_proj4(), get_image_extents(image), get_nodata_value(image)
+    info = native_geo_keys(tiff=tiff)
+    return info, GeoKeysInterpreter(info).to_proj4(), get_tiff_extents(tiff), tiff.nodata
+
+
+def read_raster_info(*, filepath: Path) -> Tuple[str, ImageExtents]:
+    """ Coordinate system and extents of a raster file, read from its header only. """
+    _, coordinate_system, extents, _ = read_raster_header(filepath=filepath)
+    return coordinate_system, extents
+
+
+def crop_raster_data(*, raster_data: Rasterdata, polygon: Polygon) -> Rasterdata:
+    (j_min, i_min, j_max, i_max), extents = crop_extents(extents=raster_data, polygon=polygon)
+    return Rasterdata(array=raster_data.array[i_min:i_max, j_min:j_max], shape=extents.shape,
+                      x_min=extents.x_min, y_max=extents.y_max,
+                      delta_x=extents.delta_x, delta_y=extents.delta_y,
+                      info=raster_data.info, coordinate_system=raster_data.coordinate_system,
+                      nodata=raster_data.nodata)
+
+
+def warp_raster_data(*,
+                     data: List[Rasterdata],
+                     target_crs: pyproj.CRS,
+                     domain: Optional[GeoPolygon] = None,
+                     resolution: Optional[float] = None,
+                     policy: str = "bilinear",
+                     step: int = 16) -> Rasterdata:
+    """
+    The rasters resampled onto one grid in the target coordinate system, so that rasters in
+    different coordinate systems, like tiles in neighbouring UTM zones, are meshed as one mosaic.
+    Earlier rasters take priority where they overlap, and points covered by none are NaN.
+
+    The grid covers the domain, or else all the rasters, with a spacing of resolution in target
+    units. The spacing defaults to the finest raster spacing, measured in the target system.
+    Source coordinates are transformed exactly every step grid points and interpolated between.
+    """
+    target_proj4 = target_crs.to_proj4()
+    source_crss = [pyproj.CRS.from_proj4(raster.coordinate_system) for raster in data]
+    if domain is not None:
+        x_min, y_min, x_max, y_max = domain.transform(target_crs=target_crs).polygon.bounds
+    else:
+        boxes = np.array([raster.polygon.transform(target_crs=target_crs).polygon.bounds for raster in data])
+        x_min, y_min = boxes[:, :2].min(axis=0)
+        x_max, y_max = boxes[:, 2:].max(axis=0)
+
+    if resolution is None:
+        spacings = []
+        for raster, crs in zip(data, source_crss):
+            x, y = (raster.x_min + raster.x_max)/2, (raster.y_min + raster.y_max)/2
+            transformer = pyproj.Transformer.from_crs(crs, target_crs, always_xy=True)
+            tx, ty = transformer.transform([x, x + raster.delta_x, x], [y, y, y + raster.delta_y])
+            spacings.append(min(np.hypot(tx[1] - tx[0], ty[1] - ty[0]), np.hypot(tx[2] - tx[0], ty[2] - ty[0])))
+        resolution = min(spacings)
+
+    # Align the grid with multiples of the resolution, covering the bounds
+    x_min = np.floor(x_min/resolution)*resolution
+    y_max = np.ceil(y_max/resolution)*resolution
+    num_points_x = int(np.ceil((x_max - x_min)/resolution)) + 1
+    num_points_y = int(np.ceil((y_max - y_min)/resolution)) + 1
+
+    sources = triangulate_dem.raster_list_float()
+    for raster in data:
+        sources.add_raster(raster.to_cpp())
+    array = triangulate_dem.warp_rasters(sources, [crs.to_proj4() for crs in source_crss], target_proj4,
+                                         x_min, y_max, resolution, resolution, num_points_x, num_points_y,
+                                         getattr(triangulate_dem.sampling_policy, policy), step)
+    return Rasterdata(array=array, shape=array.shape,
+                      x_min=x_min, y_max=y_max, delta_x=resolution, delta_y=resolution,
+                      info={}, coordinate_system=target_proj4)
+
+
+class PackedRTree:
+    """
+    Static R-tree over boxes (x_min, y_min, x_max, y_max), packed with the
+    Sort-Tile-Recursive algorithm. Levels are stored as arrays of node boxes,
+    so queries are a few vectorized box tests per level.
+    """
+
+    def __init__(self, boxes: np.ndarray, node_size: int = 16) -> None:
+        boxes = np.asarray(boxes, dtype=np.float64).reshape(-1, 4)
+        self.node_size = node_size
+
+        # Sort by x into vertical slices of whole nodes, and each slice by y
+        centres = (boxes[:, :2] + boxes[:, 2:])/2
+        order = np.argsort(centres[:, 0], kind="stable")
+        num_leaves = -(-len(boxes)//node_size)
+        slice_size = node_size*max(1, int(np.ceil(np.sqrt(num_leaves))))
+        for start in range(0, len(boxes), slice_size):
+            part = order[start:start + slice_size]
+            order[start:start + slice_size] = part[np.argsort(centres[part, 1], kind="stable")]
+        self.order = order
+
+        # Leaves first, root last
+        self.levels = [boxes[order]]
+        while len(self.levels[-1]) > 1:
+            child = self.levels[-1]
+            starts = np.arange(0, len(child), node_size)
+            self.levels.append(np.column_stack([np.minimum.reduceat(child[:, 0], starts),
+                                                np.minimum.reduceat(child[:, 1], starts),
+                                                np.maximum.reduceat(child[:, 2], starts),
+                                                np.maximum.reduceat(child[:, 3], starts)]))
+
+    def query(self, box: Tuple[float, float, float, float]) -> np.ndarray:
+        """ Indices of the boxes intersecting box, in increasing order. """
+        x_min, y_min, x_max, y_max = box
+        candidates = np.arange(len(self.levels[-1]))
+        for depth in range(len(self.levels) - 1, -1, -1):
+            b = self.levels[depth][candidates]
+            hits = candidates[(b[:, 0] <= x_max) & (b[:, 2] >= x_min) & (b[:, 1] <= y_max) & (b[:, 3] >= y_min)]
+            if depth == 0:
+                return np.sort(self.order[hits])
+            children = (hits[:, None]*self.node_size + np.arange(self.node_size)).ravel()
+            candidates = children[children < len(self.levels[depth - 1])]
+        return np.empty(0, dtype=int)
+
+
+@dataclass
+class RasterTile:
+    filepath: Path
+    coordinate_system: str
+    crs: pyproj.CRS
+    box: Tuple[float, float, float, float]
+    delta_x: float
+    delta_y: float
+
+    @property
+    def polygon(self) -> GeoPolygon:
+        return GeoPolygon(polygon=Polygon.from_bounds(*self.box), crs=self.crs)
+
+
+class TileCatalog:
+    """
+    Footprints, coordinate systems and resolutions of the GeoTIFF files in a
+    directory, with an R-tree per coordinate system. The catalog is persisted
+    in the directory, and only files that are new or whose modification time
+    or size changed are opened when it is loaded.
+    """
+
+    filename = ".rasputin_catalog.json"
+    version = 1
 
     def __init__(self, *, directory: Path) -> None:
         self.directory = directory
 
+        # Priority order: finest resolution first, then by file name
+        self.tiles = sorted(self._refresh(), key=lambda t: (t.delta_x*t.delta_y, t.filepath.name))
+        self._trees = []
+        for coordinate_system in sorted({t.coordinate_system for t in self.tiles}):
+            indices = np.array([i for (i, t) in enumerate(self.tiles) if t.coordinate_system == coordinate_system])
+            self._trees.append((self.tiles[indices[0]].crs, indices, PackedRTree([self.tiles[i].box for i in indices])))
+
+    def _refresh(self) -> List[RasterTile]:
+        catalog_path = self.directory / self.filename
+        try:
+            with catalog_path.open("r") as catalog_file:
+                content = json.load(catalog_file)
+            entries = content["tiles"] if content.get("version") == self.version else {}
+        except (OSError, ValueError, KeyError):
+            entries = {}
+
+        tiles, updated, crs_cache = [], {}, {}
+        for filepath in sorted(self.directory.glob("*.tif")):
+            stat = filepath.stat()
+            entry = entries.get(filepath.name)
+            if not entry or (entry["mtime_ns"], entry["size"]) != (stat.st_mtime_ns, stat.st_size):
+                coordinate_system, extents = read_raster_info(filepath=filepath)
+                entry = dict(mtime_ns=stat.st_mtime_ns, size=stat.st_size,
+                             coordinate_system=coordinate_system,
+                             box=[float(v) for v in extents.box],
+                             delta=[float(extents.delta_x), float(extents.delta_y)])
+            updated[filepath.name] = entry
+
+            coordinate_system = entry["coordinate_system"]
+            if coordinate_system not in crs_cache:
+                crs_cache[coordinate_system] = pyproj.CRS.from_proj4(coordinate_system)
+            tiles.append(RasterTile(filepath=filepath,
+                                    coordinate_system=coordinate_system,
+                                    crs=crs_cache[coordinate_system],
+                                    box=tuple(entry["box"]), delta_x=entry["delta"][0], delta_y=entry["delta"][1]))
+
+        if updated != entries:
+            # Write and rename, so concurrent readers never see a partial catalog
+            temp_path = catalog_path.with_name(f"{self.filename}.{os.getpid()}")
+            try:
+                with temp_path.open("w") as catalog_file:
+                    json.dump(dict(version=self.version, tiles=updated), catalog_file)
+                os.replace(temp_path, catalog_path)
+            except OSError as error:
+                getLogger().warning(f"Unable to store raster catalog in {self.directory}: {error}")
+        return tiles
+
+    def intersecting(self, domain: GeoPolygon) -> List[RasterTile]:
+        """ Tiles whose footprints intersect the domain, in priority order. """
+        hits = []
+        for (crs, indices, tree) in self._trees:
+            polygon = domain.transform(target_crs=crs).polygon
+            for i in indices[tree.query(polygon.bounds)]:
+                footprint = Polygon.from_bounds(*self.tiles[i].box)
+                if polygon.intersects(footprint) and not polygon.touches(footprint):
+                    hits.append(i)
+        return [self.tiles[i] for i in sorted(hits)]
+
+
+class RasterRepository:
+    """
+    GeoTIFF tiles in a directory. Tiles can be read at overview levels, where
+    level l is the tile downsampled by 2**l with the reduction filter, one of
+    the triangulate_dem.raster_reduction names.
+    """
+
+    overview_dirname = ".rasputin_overviews"
+
+    def __init__(self, *, directory: Path, reduction: str = "average") -> None:
+        self.directory = directory
+        self.reduction = reduction
+        self._catalog = None
+
+    @property
+    def catalog(self) -> TileCatalog:
+        if self._catalog is None:
+            self._catalog = TileCatalog(directory=self.directory)
+        return self._catalog
+
+    def overview(self, *, tile: RasterTile, level: int) -> Rasterdata:
+        """
+        The whole tile at an overview level. Each level is built from the level
+        below and cached as a .npy file, which is rebuilt when the tile changes.
+        """
+        if level == 0:
+            return read_raster_file(filepath=tile.filepath)
+
+        info, coordinate_system, extents, nodata = read_raster_header(filepath=tile.filepath)
+        cache_path = self.directory / self.overview_dirname / f"{tile.filepath.stem}.{self.reduction}.{level}.npy"
+        if cache_path.exists() and cache_path.stat().st_mtime_ns >= tile.filepath.stat().st_mtime_ns:
+            array = np.load(cache_path, mmap_mode="r")
+        else:
+            source = self.overview(tile=tile, level=level - 1)
+            array = triangulate_dem.downsample(source.to_cpp(), 2,
+                                               getattr(triangulate_dem.raster_reduction, self.reduction))
+            temp_path = cache_path.with_name(f"{cache_path.stem}.{os.getpid()}.npy")
+            try:
+                cache_path.parent.mkdir(exist_ok=True)
+                np.save(temp_path, array)
+                os.replace(temp_path, cache_path)
+            except OSError as error:
+                getLogger().warning(f"Unable to cache overview {cache_path}: {error}")
+
+        factor = 2**level
+        return Rasterdata(array=array, shape=array.shape,
+                          x_min=extents.x_min, y_max=extents.y_max,
+                          delta_x=extents.delta_x*factor, delta_y=extents.delta_y*factor,
+                          info=info, coordinate_system=coordinate_system, nodata=nodata)
+
+    def overview_level(self,
+                       *,
+                       domain: GeoPolygon,
+                       resolution: Optional[float] = None,
+                       max_points: Optional[int] = None) -> int:
+        """
+        The coarsest level with a raster spacing of at most resolution, in units
+        of the tile coordinate system, coarsened further when needed to keep
+        the number of raster points inside the domain within max_points.
+        """
+        tiles = self.catalog.intersecting(domain)
+        if not tiles:
+            return 0
+
+        # Keep at least two raster points in each direction of every tile
+        max_level = min(int(np.log2(max(1, min(round((t.box[2] - t.box[0])/t.delta_x),
+                                               round((t.box[3] - t.box[1])/t.delta_y)))))
+                        for t in tiles)
+
+        level = 0
+        if resolution:
+            spacing = max(tiles[0].delta_x, tiles[0].delta_y)
+            while level < max_level and 2**(level + 1)*spacing <= resolution:
+                level += 1
+        if max_points:
+            num_points = sum(domain.transform(target_crs=t.crs).polygon.intersection(t.polygon.polygon).area
+                             / (t.delta_x*t.delta_y) for t in tiles)
+            while level < max_level and num_points/4**level > max_points:
+                level += 1
+        return level
+
     def get_intersections(self,
                           *,
-                          target_polygon: GeoPolygon) -> List[Rasterdata]:
+                          target_polygon: GeoPolygon,
+                          level: int = 0) -> List[Rasterdata]:
 
         parts = []
 
-        raster_files = self.directory.glob("*.tif")
         logger = getLogger()
-        for filepath in raster_files:
-            geo_polygon = GeoPolygon.from_raster_file(filepath=filepath)
+        for tile in self.catalog.intersecting(target_polygon):
+            filepath = tile.filepath
+            geo_polygon = tile.polygon
 
             if target_polygon.intersects(geo_polygon):
                 logger.info(f"Using file: {filepath}")
                 polygon = target_polygon.transform(target_crs=geo_polygon.crs).polygon
-                part = read_raster_file(filepath=filepath,
-                                        polygon=polygon)
+                if level == 0:
+                    part = read_raster_file(filepath=filepath,
+                                            polygon=polygon)
+                else:
+                    part = crop_raster_data(raster_data=self.overview(tile=tile, level=level),
+                                            polygon=polygon)
                 parts.append(part)
 
                 target_polygon = target_polygon.difference(geo_polygon)
@@ -456,16 +853,38 @@ class RasterRepository:
         return parts
 
     def coordinate_system(self, domain: GeoPolygon) -> str:
-        raster_files = self.directory.glob("*.tif")
-        for filepath in raster_files:
-            geo_polygon = GeoPolygon.from_raster_file(filepath=filepath)
-            if domain.intersects(geo_polygon):
-                return geo_polygon.crs.to_proj4()
+        tiles = self.catalog.intersecting(domain)
+        if tiles:
+            return tiles[0].crs.to_proj4()
 
         raise RuntimeError("Defining polygon does not intersect with dem raster data.")
 
-    def read(self, *, domain: GeoPolygon) -> List[Rasterdata]:
-        return self.get_intersections(target_polygon=domain)
+    def read(self,
+             *,
+             domain: GeoPolygon,
+             resolution: Optional[float] = None,
+             max_points: Optional[int] = None) -> List[Rasterdata]:
+        level = self.overview_level(domain=domain, resolution=resolution, max_points=max_points)
+        if level:
+            getLogger().info(f"Reading overview level {level}")
+        return self.get_intersections(target_polygon=domain, level=level)
+
+    def read_warped(self,
+                    *,
+                    domain: GeoPolygon,
+                    target_crs: pyproj.CRS,
+                    resolution: Optional[float] = None,
+                    max_points: Optional[int] = None,
+                    policy: str = "bilinear") -> Rasterdata:
+        """
+        The tiles covering the domain, whatever their coordinate systems, resampled onto one grid
+        in the target coordinate system, see warp_raster_data. The tiles are read at the overview
+        level picked by resolution and max_points, as in read.
+        """
+        data = self.read(domain=domain, resolution=resolution, max_points=max_points)
+        if not data:
+            raise RuntimeError("Defining polygon does not intersect with dem raster data.")
+        return warp_raster_data(data=data, target_crs=target_crs, domain=domain, resolution=resolution, policy=policy)
 
 
 def read_sun_posisions(*, filepath: Path) -> triangulate_dem.shadow_vector:
@@ -1,5 +1,5 @@
 from copy import deepcopy
-from typing import Dict, Any, Optional
+from typing import Dict, Any, Optional, Tuple
 import numpy as np
 from datetime import datetime
 from h5py import File
@@ -73,7 +73,7 @@ class TinRepository:
                 geometry.colors = tin_group["face_fields"]["cover_color"][:]
             return geometry
 
-    def extract(self, *, uid: str, face_id: int) -> Geometry:
+    def _read_cover(self, *, uid: str) -> Tuple[Mesh, np.ndarray, np.ndarray, str]:
         filename = self.path / f"{uid}.h5"
         if not filename.exists():
             raise FileNotFoundError(f"File {filename.absolute()} not found.")
@@ -91,15 +91,25 @@ class TinRepository:
             projection = tin_group["points"].attrs["projection"]
             faces = tin_group["faces"][:]
             mesh = Mesh.from_points_and_faces(points=pts, faces=faces, proj4_str=projection)
-            indices = [i for (i, f) in enumerate(tin_group["face_fields"]["cover_type"]) if f == face_id]
-            if not indices:
-                raise IOError(f"face_id {face_id} not found in dataset")
-            base_color = tin_group["face_fields"]["cover_color"][indices[0]]
-            mesh = mesh.extract_sub_mesh(np.asarray(indices))
-            geometry = Geometry(mesh=mesh,
-                                crs=CRS.from_proj4(projection),
-                                base_color=base_color)
-            return geometry
+            return mesh, face_group["cover_type"][:], face_group["cover_color"][:], projection
+
+    def extract(self, *, uid: str, face_id: int) -> Geometry:
+        mesh, cover_type, cover_color, projection = self._read_cover(uid=uid)
+        indices = np.flatnonzero(cover_type == face_id)
+        if not len(indices):
+            raise IOError(f"face_id {face_id} not found in dataset")
+        return Geometry(mesh=mesh.extract_sub_mesh(indices),
+                        crs=CRS.from_proj4(projection),
+                        base_color=cover_color[indices[0]])
+
+    def extract_all(self, *, uid: str) -> Dict[int, Geometry]:
+        """Geometry of each cover type in the mesh, split in a single pass."""
+        mesh, cover_type, cover_color, projection = self._read_cover(uid=uid)
+        crs = CRS.from_proj4(projection)
+        cover_types, first_index = np.unique(cover_type, return_index=True)
+        base_colors = dict(zip(cover_types.tolist(), cover_color[first_index]))
+        return {face_id: Geometry(mesh=sub_mesh, crs=crs, base_color=base_colors[face_id])
+                for face_id, sub_mesh in mesh.partition_by_label(cover_type).items()}
 
     @property
     def content(self) -> Dict[str, Dict[str, Any]]:
@@ -16,8 +16,12 @@
 #include <CGAL/Projection_traits_xy_3.h>
 #include <CGAL/Surface_mesh.h>
 #include <CGAL/Surface_mesh_simplification/edge_collapse.h>
+#include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/Constrained_placement.h>
+#include <CGAL/Surface_mesh_simplification/Edge_collapse_visitor_base.h>
+#include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/Count_stop_predicate.h>
 #include <CGAL/Triangulation_face_base_2.h>
 #include <CGAL/Boolean_set_operations_2.h>
+#include <CGAL/Polygon_set_2.h>
 
 #include <CGAL/Polygon_2.h>
 #include <CGAL/Polygon_with_holes_2.h>
@@ -27,18 +31,30 @@
 #include <boost/geometry/srs/epsg.hpp>
 #include <boost/geometry/srs/projection.hpp>
 #include <boost/geometry/geometries/geometries.hpp>
+#include <boost/geometry/index/rtree.hpp>
 #include <boost/geometry/srs/transformation.hpp>
 
 #include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
 #include <armadillo>
+#include <cctype>
 #include <cmath>
 #include <fstream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <tuple>
+#include <type_traits>
+#include <variant>
 #include <numeric>
 #include <pybind11/numpy.h>
 #include <cstdint>
 #include "solar_position.h"
+#include "parallel.h"
 
 
 
@@ -57,6 +73,7 @@ using PointList = std::vector<Point>;
 using Mesh = Surface_mesh<Point>;
 using VertexIndex = Mesh::Vertex_index;
 using FaceIndex = Mesh::Face_index;
+using EdgeIndex = Mesh::Edge_index;
 using PointVertexMap = std::map<Point, VertexIndex>;
 using Ray = K::Ray_3;
 using Primitive = CGAL::AABB_face_graph_triangle_primitive<Mesh>;
@@ -194,112 +211,1520 @@ using index_vector = std::vector<index>;
 using double_vector = std::vector<double>;
 using uint8_vector = std::vector<std::uint8_t>;
 
-// Clean up below
-using VertexIndexMap = std::map<int, CGAL::VertexIndex>;
-using FaceDescrMap = std::map<CGAL::face_descriptor, int>;
+// Flat points and faces of other coordinate and index types: float32 coordinates and uint32 indices
+// for compact meshes, and int64 indices for very large meshes
+template<typename P>
+using point3_vector_t = std::vector<std::array<P, 3>>;
+template<typename I>
+using face_vector_t = std::vector<std::array<I, 3>>;
+using point3f_vector = point3_vector_t<float>;
+using face_u32_vector = face_vector_t<std::uint32_t>;
+using face_i64_vector = face_vector_t<std::int64_t>;
+
+// Mesh from row-major arrays of num_points point coordinates and num_faces vertex index triplets.
+// The storage is reserved up front and filled in order, so vertex and face i of the mesh are row i
+// of the arrays.
+template<typename P, typename I>
+CGAL::Mesh construct_mesh(const P* points, std::size_t num_points,
+                          const I* faces, std::size_t num_faces) {
+    CGAL::Mesh mesh;
+    mesh.reserve(num_points, num_points + num_faces, num_faces);
+    for (std::size_t i = 0; i < num_points; ++i, points += 3)
+        mesh.add_vertex(CGAL::Point(points[0], points[1], points[2]));
+    for (std::size_t j = 0; j < num_faces; ++j, faces += 3) {
+        if (std::any_of(faces, faces + 3, [num_points] (I v) {return v < 0 or std::size_t(v) >= num_points;}))
+            throw std::out_of_range("Face " + std::to_string(j) + " has a vertex index out of range.");
+        const auto f = mesh.add_face(CGAL::VertexIndex(faces[0]), CGAL::VertexIndex(faces[1]), CGAL::VertexIndex(faces[2]));
+        if (f == CGAL::Mesh::null_face())
+            throw std::invalid_argument("Face " + std::to_string(j) + " can not be added without breaking the manifold.");
+    }
+    return mesh;
+}
 
-CGAL::Mesh construct_mesh(const point3_vector &pts,
-                          const face_vector &faces,
-                          VertexIndexMap& index_map,
-                          FaceDescrMap& face_map);
-struct Mesh {
+CGAL::Mesh construct_mesh(const point3_vector &pts, const face_vector &faces) {
+    return construct_mesh(pts.empty() ? nullptr : pts.front().data(), pts.size(),
+                          faces.empty() ? nullptr : faces.front().data(), faces.size());
+}
+
+
+// The collapse sequence of an edge collapse simplification, stored with the mesh it started from.
+//
+// Each collapse merges the vertex removed[k] into kept[k], which is moved to positions[k]. The
+// mesh after any number of collapses is recovered by replaying the sequence on the vertex indices,
+// so one simplification pass gives all levels of detail.
+struct ProgressiveMesh {
+    point3_vector points;
+    face_vector faces;
+    std::vector<int> removed;
+    std::vector<int> kept;
+    point3_vector positions;
+    std::string proj4_str;
+
+    std::size_t num_collapses() const {return removed.size();}
+    std::size_t min_num_vertices() const {return points.size() - removed.size();}
+
+    // Points and faces of the mesh with (at least) the given number of vertices
+    std::tuple<point3_vector, face_vector> extract(std::size_t num_vertices) const {
+        const std::size_t n = points.size();
+        const std::size_t num_replayed = std::min(removed.size(), n > num_vertices ? n - num_vertices : 0);
+
+        std::vector<int> parent(n);
+        std::iota(parent.begin(), parent.end(), 0);
+        point3_vector position(points);
+        for (std::size_t k = 0; k < num_replayed; ++k) {
+            parent[removed[k]] = kept[k];
+            position[kept[k]] = positions[k];
+        }
+        auto find = [&parent] (int v) {
+            while (parent[v] != v)
+                v = parent[v] = parent[parent[v]];
+            return v;
+        };
+
+        // Faces around a collapsed edge degenerate, and unused vertices are left out
+        std::vector<int> new_index(n, -1);
+        point3_vector new_points;
+        face_vector new_faces;
+        new_points.reserve(n - num_replayed);
+        new_faces.reserve(faces.size());
+        for (const auto& f: faces) {
+            const face g{find(f[0]), find(f[1]), find(f[2])};
+            if (g[0] == g[1] or g[1] == g[2] or g[2] == g[0])
+                continue;
+            face new_face;
+            for (std::size_t i = 0; i < 3; ++i) {
+                if (new_index[g[i]] < 0) {
+                    new_index[g[i]] = static_cast<int>(new_points.size());
+                    new_points.push_back(position[g[i]]);
+                }
+                new_face[i] = new_index[g[i]];
+            }
+            new_faces.push_back(new_face);
+        }
+        return std::make_tuple(std::move(new_points), std::move(new_faces));
+    }
+};
+
+
+// Edge collapse visitor recording the collapses into a progressive mesh, if one is given
+class ProgressiveMeshRecorder : public CGAL::Surface_mesh_simplification::Edge_collapse_visitor_base<CGAL::Mesh> {
+  public:
+    explicit ProgressiveMeshRecorder(ProgressiveMesh* progressive_mesh) : progressive_mesh(progressive_mesh) {}
+
+    void OnStarted(CGAL::Mesh& mesh) {
+        this->mesh = &mesh;
+        if (progressive_mesh == nullptr)
+            return;
+
+        progressive_mesh->points.clear();
+        progressive_mesh->faces.clear();
+        progressive_mesh->removed.clear();
+        progressive_mesh->kept.clear();
+        progressive_mesh->positions.clear();
+
+        index.assign(mesh.num_vertices(), -1);
+        for (auto v: mesh.vertices()) {
+            index[v.idx()] = static_cast<int>(progressive_mesh->points.size());
+            const auto& p = mesh.point(v);
+            progressive_mesh->points.push_back(point3{p.x(), p.y(), p.z()});
+        }
+        for (auto f: mesh.faces()) {
+            face g;
+            std::size_t i = 0;
+            for (auto v: mesh.vertices_around_face(mesh.halfedge(f)))
+                g[i++] = index[v.idx()];
+            progressive_mesh->faces.push_back(g);
+        }
+    }
+
+    void OnCollapsing(const Profile& profile, const boost::optional<Point>&) {
+        v0 = profile.v0();
+        v1 = profile.v1();
+    }
+
+    void OnCollapsed(const Profile&, vertex_descriptor v) {
+        if (progressive_mesh == nullptr)
+            return;
+        const auto& p = mesh->point(v);
+        progressive_mesh->removed.push_back(index[(v == v0 ? v1 : v0).idx()]);
+        progressive_mesh->kept.push_back(index[v.idx()]);
+        progressive_mesh->positions.push_back(point3{p.x(), p.y(), p.z()});
+    }
+
+  private:
+    ProgressiveMesh* progressive_mesh;
+    const CGAL::Mesh* mesh = nullptr;
+    std::vector<int> index;  // From CGAL vertex index to progressive mesh vertex
+    vertex_descriptor v0, v1;
+};
+
+
+// Raster samples sorted into the faces containing them, for bounding the vertical distance between a
+// mesh and the raster it was made from during simplification.
+//
+// The cost of collapsing an edge is the largest vertical error over the samples in the faces around
+// the edge, measured against the faces after the collapse. Collapses that fold faces over, leave
+// samples uncovered or exceed the tolerance have no cost, and are not carried out. After a collapse
+// the samples of the old faces are redistributed to the new ones, so the error is tracked
+// incrementally.
+class VerticalErrorTracker {
+  public:
+    template<typename R>
+    VerticalErrorTracker(const CGAL::Mesh& mesh, const R& raster, double tolerance)
+        : tolerance(tolerance), samples(raster.raster_points()), face_samples(mesh.num_faces()) {
+        if (mesh.is_empty() or samples.empty())
+            return;
+
+        // Locate the samples with vertical rays
+        CGAL::Tree tree(CGAL::faces(mesh).first, CGAL::faces(mesh).second, mesh);
+        tree.build();
+        const double z_top = tree.bbox().zmax() + 1.0;
+        std::vector<CGAL::FaceIndex> sample_face(samples.size());
+        const std::size_t chunk_size = 4096;
+        parallel_for((samples.size() + chunk_size - 1)/chunk_size, [&] (std::size_t c) {
+            for (std::size_t k = c*chunk_size; k < std::min(samples.size(), (c + 1)*chunk_size); ++k) {
+                const CGAL::Ray ray(CGAL::Point3(samples[k].x(), samples[k].y(), z_top), CGAL::Vector(0.0, 0.0, -1.0));
+                if (const auto f = tree.any_intersected_primitive(ray))
+                    sample_face[k] = *f;
+            }
+        });
+        for (std::size_t k = 0; k < samples.size(); ++k)
+            if (sample_face[k] != CGAL::FaceIndex())
+                face_samples[sample_face[k].idx()].push_back(static_cast<std::uint32_t>(k));
+    }
+
+    const double tolerance;
+
+    void set_mesh(const CGAL::Mesh& mesh) {this->mesh = &mesh;}
+
+    boost::optional<double> cost(CGAL::VertexIndex v0, CGAL::VertexIndex v1, const CGAL::Point& p) const {
+        const auto old_faces = faces_around(v0, v1);
+
+        // The faces after the collapse, which must keep their orientation
+        std::vector<std::array<CGAL::Point, 3>> triangles;
+        for (auto f: old_faces) {
+            std::array<CGAL::Point, 3> t;
+            std::size_t i = 0, moved = 0;
+            for (auto v: mesh->vertices_around_face(mesh->halfedge(f))) {
+                const bool is_moved = (v == v0 or v == v1);
+                t[i++] = is_moved ? p : mesh->point(v);
+                moved += is_moved;
+            }
+            if (moved > 1)
+                continue;
+            if (signed_area(t) <= 0.0)
+                return boost::none;
+            triangles.push_back(t);
+        }
+
+        double max_error = 0.0;
+        for (auto f: old_faces) {
+            for (auto k: face_samples[f.idx()]) {
+                const auto& q = samples[k];
+                const auto t = std::find_if(triangles.begin(), triangles.end(),
+                                            [&q] (const std::array<CGAL::Point, 3>& t) {return min_weight(t, q) >= -1e-9;});
+                if (t == triangles.end())
+                    return boost::none;
+                max_error = std::max(max_error, std::fabs(height(*t, q) - q.z()));
+                if (max_error > tolerance)
+                    return boost::none;
+            }
+        }
+        return max_error;
+    }
+
+    // Take the samples of the faces that are about to change
+    void collapsing(CGAL::VertexIndex v0, CGAL::VertexIndex v1) {
+        pending.clear();
+        for (auto f: faces_around(v0, v1)) {
+            auto& s = face_samples[f.idx()];
+            pending.insert(pending.end(), s.begin(), s.end());
+            s.clear();
+        }
+    }
+
+    // Give the samples to the faces around the remaining vertex
+    void collapsed(CGAL::VertexIndex v) {
+        const auto new_faces = faces_around(v, v);
+        if (new_faces.empty())
+            return;
+        for (auto k: pending) {
+            const auto& q = samples[k];
+            // The face containing the sample, or the closest one for samples on the edges
+            CGAL::FaceIndex best;
+            double best_weight = std::numeric_limits<double>::lowest();
+            for (auto f: new_faces) {
+                const double w = min_weight(triangle(f), q);
+                if (w > best_weight) {
+                    best_weight = w;
+                    best = f;
+                }
+            }
+            face_samples[best.idx()].push_back(k);
+        }
+        pending.clear();
+    }
+
+  private:
+    const CGAL::Mesh* mesh = nullptr;
+    CGAL::PointList samples;
+    std::vector<std::vector<std::uint32_t>> face_samples;
+    std::vector<std::uint32_t> pending;
+
+    std::vector<CGAL::FaceIndex> faces_around(CGAL::VertexIndex v0, CGAL::VertexIndex v1) const {
+        std::vector<CGAL::FaceIndex> result;
+        for (auto v: {v0, v1})
+            for (auto f: mesh->faces_around_target(mesh->halfedge(v)))
+                if (f != CGAL::Mesh::null_face() and std::find(result.begin(), result.end(), f) == result.end())
+                    result.push_back(f);
+        return result;
+    }
+
+    std::array<CGAL::Point, 3> triangle(CGAL::FaceIndex f) const {
+        std::array<CGAL::Point, 3> t;
+        std::size_t i = 0;
+        for (auto v: mesh->vertices_around_face(mesh->halfedge(f)))
+            t[i++] = mesh->point(v);
+        return t;
+    }
+
+    static double signed_area(const std::array<CGAL::Point, 3>& t) {
+        return ((t[1].x() - t[0].x())*(t[2].y() - t[0].y()) - (t[2].x() - t[0].x())*(t[1].y() - t[0].y()))/2;
+    }
+
+    static std::array<double, 3> barycentric(const std::array<CGAL::Point, 3>& t, const CGAL::Point& q) {
+        const double area = signed_area(t);
+        const double w1 = signed_area({t[0], q, t[2]})/area;
+        const double w2 = signed_area({t[0], t[1], q})/area;
+        return {1.0 - w1 - w2, w1, w2};
+    }
+
+    static double min_weight(const std::array<CGAL::Point, 3>& t, const CGAL::Point& q) {
+        const auto w = barycentric(t, q);
+        return std::min({w[0], w[1], w[2]});
+    }
+
+    static double height(const std::array<CGAL::Point, 3>& t, const CGAL::Point& q) {
+        const auto w = barycentric(t, q);
+        return w[0]*t[0].z() + w[1]*t[1].z() + w[2]*t[2].z();
+    }
+};
+
+
+// Edge collapse policies bounding the vertical error, see VerticalErrorTracker
+struct VerticalErrorCost {
+    VerticalErrorTracker* tracker;
+
+    template<typename Profile, typename T>
+    boost::optional<typename Profile::FT> operator()(const Profile& profile, const T& placement) const {
+        if (not placement)
+            return boost::none;
+        return tracker->cost(profile.v0(), profile.v1(), *placement);
+    }
+};
+
+class VerticalErrorVisitor : public CGAL::Surface_mesh_simplification::Edge_collapse_visitor_base<CGAL::Mesh> {
+  public:
+    explicit VerticalErrorVisitor(VerticalErrorTracker* tracker) : tracker(tracker) {}
+
+    void OnStarted(CGAL::Mesh& mesh) {tracker->set_mesh(mesh);}
+
+    void OnCollapsing(const Profile& profile, const boost::optional<Point>&) {
+        tracker->collapsing(profile.v0(), profile.v1());
+    }
+
+    void OnCollapsed(const Profile&, vertex_descriptor v) {tracker->collapsed(v);}
+
+  private:
+    VerticalErrorTracker* tracker;
+};
+
+
+// Typed face and vertex attributes are Surface_mesh property maps named "<f|v>:<int|double>:<policy>:<name>",
+// so that they follow the mesh through copies. Faces keep their attributes through edge collapse. Edges
+// between faces with different values of a face attribute with the "boundary" policy are never collapsed,
+// while vertex attributes are merged by their policy when an edge is collapsed.
+enum class AttributeMerge {average, minimum, maximum, nearest};
+
+struct AttributeKey {
+    std::string element;
+    std::string type;
+    std::string policy;
+    std::string name;
+
+    std::string str() const {return element + ":" + type + ":" + policy + ":" + name;}
+
+    static std::optional<AttributeKey> parse(const std::string& key) {
+        const auto a = key.find(':');
+        const auto b = a == std::string::npos ? a : key.find(':', a + 1);
+        const auto c = b == std::string::npos ? b : key.find(':', b + 1);
+        if (c == std::string::npos)
+            return std::nullopt;
+        AttributeKey result{key.substr(0, a), key.substr(a + 1, b - a - 1), key.substr(b + 1, c - b - 1), key.substr(c + 1)};
+        if (result.type != "int" and result.type != "double")
+            return std::nullopt;
+        return result;
+    }
+};
+
+template<typename T>
+std::string attribute_type() {
+    static_assert(std::is_same_v<T, int> or std::is_same_v<T, double>, "Attributes are int or double");
+    return std::is_same_v<T, int> ? "int" : "double";
+}
+
+template<typename I>
+std::string attribute_element() {
+    return std::is_same_v<I, CGAL::FaceIndex> ? "f" : "v";
+}
+
+AttributeMerge attribute_merge(const std::string& policy) {
+    if (policy == "average")
+        return AttributeMerge::average;
+    if (policy == "minimum")
+        return AttributeMerge::minimum;
+    if (policy == "maximum")
+        return AttributeMerge::maximum;
+    if (policy == "nearest")
+        return AttributeMerge::nearest;
+    throw std::invalid_argument("Unknown vertex attribute merge policy '" + policy + "'.");
+}
+
+// Attributes of the faces or vertices (I) of the mesh
+template<typename I>
+std::vector<AttributeKey> attribute_keys(const CGAL::Mesh& mesh) {
+    std::vector<AttributeKey> result;
+    for (const auto& key: mesh.properties<I>()) {
+        const auto parsed = AttributeKey::parse(key);
+        if (parsed and parsed->element == attribute_element<I>())
+            result.push_back(*parsed);
+    }
+    return result;
+}
+
+template<typename I, typename T>
+void copy_attribute(const CGAL::Mesh& source, CGAL::Mesh& target, const std::string& key,
+                    const std::vector<std::pair<I, I>>& pairs) {
+    const auto from = source.property_map<I, T>(key).first;
+    auto to = target.add_property_map<I, T>(key, T()).first;
+    for (const auto& pair: pairs)
+        to[pair.second] = from[pair.first];
+}
+
+// Copy all attributes from the first to the second element of each pair
+template<typename I>
+void copy_attributes(const CGAL::Mesh& source, CGAL::Mesh& target, const std::vector<std::pair<I, I>>& pairs) {
+    for (const auto& key: attribute_keys<I>(source)) {
+        if (key.type == "int")
+            copy_attribute<I, int>(source, target, key.str(), pairs);
+        else
+            copy_attribute<I, double>(source, target, key.str(), pairs);
+    }
+}
+
+// Lock the edges between faces with different values of a face attribute with the boundary policy.
+// Returns whether there are such attributes.
+template<typename L>
+bool lock_attribute_boundaries(const CGAL::Mesh& mesh, L& locked) {
+    bool found = false;
+    for (const auto& key: attribute_keys<CGAL::FaceIndex>(mesh)) {
+        if (key.policy != "boundary")
+            continue;
+        found = true;
+        const auto label = mesh.property_map<CGAL::FaceIndex, int>(key.str()).first;
+        for (auto e: mesh.edges()) {
+            if (mesh.is_border(e))
+                continue;
+            const auto h = mesh.halfedge(e);
+            if (label[mesh.face(h)] != label[mesh.face(mesh.opposite(h))])
+                locked[e] = true;
+        }
+    }
+    return found;
+}
+
+template<typename T>
+T merge_attribute(AttributeMerge merge, T a, T b, bool nearest_is_a) {
+    switch (merge) {
+        case AttributeMerge::average:
+            return T((a + b)/2);
+        case AttributeMerge::minimum:
+            return std::min(a, b);
+        case AttributeMerge::maximum:
+            return std::max(a, b);
+        default:
+            return nearest_is_a ? a : b;
+    }
+}
+
+// Edge collapse visitor that merges the vertex attributes of the collapsed edge into the remaining
+// vertex, and otherwise does what the visitor V does
+template<typename V>
+class AttributeMergingVisitor : public V {
+  public:
+    using Profile = typename V::Profile;
+    using Point = typename V::Point;
+    using vertex_descriptor = typename V::vertex_descriptor;
+
+    explicit AttributeMergingVisitor(V visitor) : V(std::move(visitor)) {}
+
+    void OnStarted(CGAL::Mesh& mesh) {
+        V::OnStarted(mesh);
+        int_attributes.clear();
+        double_attributes.clear();
+        for (const auto& key: attribute_keys<CGAL::VertexIndex>(mesh)) {
+            if (key.type == "int")
+                int_attributes.push_back({mesh.property_map<CGAL::VertexIndex, int>(key.str()).first,
+                                          attribute_merge(key.policy), 0});
+            else
+                double_attributes.push_back({mesh.property_map<CGAL::VertexIndex, double>(key.str()).first,
+                                             attribute_merge(key.policy), 0.0});
+        }
+    }
+
+    void OnCollapsing(const Profile& profile, const boost::optional<Point>& placement) {
+        V::OnCollapsing(profile, placement);
+        const bool nearest_is_v0 = not placement or (CGAL::squared_distance(*placement, profile.p0())
+                                                     <= CGAL::squared_distance(*placement, profile.p1()));
+        for (auto& attribute: int_attributes)
+            attribute.merged = merge_attribute(attribute.merge, attribute.map[profile.v0()],
+                                               attribute.map[profile.v1()], nearest_is_v0);
+        for (auto& attribute: double_attributes)
+            attribute.merged = merge_attribute(attribute.merge, attribute.map[profile.v0()],
+                                               attribute.map[profile.v1()], nearest_is_v0);
+    }
+
+    void OnCollapsed(const Profile& profile, vertex_descriptor v) {
+        V::OnCollapsed(profile, v);
+        for (auto& attribute: int_attributes)
+            attribute.map[v] = attribute.merged;
+        for (auto& attribute: double_attributes)
+            attribute.map[v] = attribute.merged;
+    }
+
+  private:
+    template<typename T>
+    struct Attribute {
+        CGAL::Mesh::Property_map<CGAL::VertexIndex, T> map;
+        AttributeMerge merge;
+        T merged;
+    };
+
+    std::vector<Attribute<int>> int_attributes;
+    std::vector<Attribute<double>> double_attributes;
+};
+
+using AttributeMerger = AttributeMergingVisitor<CGAL::Surface_mesh_simplification::Edge_collapse_visitor_base<CGAL::Mesh>>;
+
+
+// Collapse edges until the mesh has fewer than target_edges edges. Locked edges are never collapsed,
+// and vertices on them are not moved. Vertex attributes are merged by their policy.
+template<typename P, typename C, typename L>
+void collapse_unlocked(CGAL::Mesh& mesh,
+                       std::size_t target_edges,
+                       const P& placement,
+                       const C& cost,
+                       const L& locked) {
+    namespace SMS = CGAL::Surface_mesh_simplification;
+    SMS::edge_collapse(mesh,
+                       SMS::Count_stop_predicate<CGAL::Mesh>(target_edges),
+                       CGAL::parameters::get_cost(cost)
+                                        .get_placement(SMS::Constrained_placement<P, L>(locked, placement))
+                                        .edge_is_constrained_map(locked)
+                                        .visitor(AttributeMerger(SMS::Edge_collapse_visitor_base<CGAL::Mesh>())));
+}
+
+
+// Distance along the Hilbert curve of the given order to cell (x, y) of its 2^order by 2^order grid
+std::uint64_t hilbert_index(std::uint32_t x, std::uint32_t y, unsigned order) {
+    std::uint64_t d = 0;
+    for (std::uint32_t s = std::uint32_t(1) << (order - 1); s > 0; s /= 2) {
+        const std::uint32_t rx = (x & s) > 0;
+        const std::uint32_t ry = (y & s) > 0;
+        d += std::uint64_t(s)*s*((3*rx) ^ ry);
+        // Rotate the quadrant
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+
+// Flat points, relative to origin, and faces of a mesh. Vertices are numbered in the order they are
+// first seen from the faces.
+template<typename P, typename I>
+void flatten_mesh(const CGAL::Mesh& mesh, const point3& origin,
+                  point3_vector_t<P>& points, face_vector_t<I>& faces) {
+    points.clear();
+    faces.clear();
+    points.reserve(mesh.number_of_vertices());
+    faces.reserve(mesh.number_of_faces());
+
+    // Indices of vertices removed by edge collapse are still in range, so a flat array covers them all
+    std::vector<std::int64_t> reindex(mesh.num_vertices(), -1);
+    for (auto f: mesh.faces()) {
+        std::array<I, 3> fl;
+        size_t idx = 0;
+        for (auto v: mesh.vertices_around_face(mesh.halfedge(f))) {
+            auto& n = reindex[v.idx()];
+            if (n < 0) {
+                n = std::int64_t(points.size());
+                const auto& pt = mesh.point(v);
+                points.push_back({P(pt.x() - origin[0]), P(pt.y() - origin[1]), P(pt.z() - origin[2])});
+            }
+            fl[idx++] = I(n);
+        }
+        faces.push_back(fl);
+    }
+}
+
+
+// Coordinate transformations between proj4 definitions. Setting up a transformation parses
+// both definitions, which costs far more than transforming a point, so each pair is set up
+// once and shared by all threads.
+using Transformation = boost::geometry::srs::transformation<>;
+
+const std::string wgs84_proj4 = "+proj=longlat +datum=WGS84 +no_defs";
+
+// Coordinate system definitions are proj4 strings, or EPSG codes given as "EPSG:4326" or
+// "+init=epsg:4326", which the proj4 parser of Boost.Geometry does not resolve
+using SrsParameters = std::variant<boost::geometry::srs::proj4, boost::geometry::srs::dpar::parameters<>>;
+
+SrsParameters parse_srs(const std::string& definition) {
+    namespace bg = boost::geometry;
+    auto lower = [] (std::string str) {
+        std::transform(str.begin(), str.end(), str.begin(), [] (unsigned char c) {return std::tolower(c);});
+        return str;
+    };
+    std::istringstream tokens(definition);
+    std::string normalised;
+    for (std::string token; tokens >> token;) {
+        const auto code = lower(token.rfind("+init=", 0) == 0 ? token.substr(6) : token);
+        if (code.rfind("epsg:", 0) == 0)
+            return bg::projections::dynamic_parameters<bg::srs::epsg>::apply(bg::srs::epsg(std::stoi(code.substr(5))));
+        // Parameter names are case insensitive, their values are not
+        const auto name_end = std::min(token.find('='), token.size());
+        normalised += (normalised.empty() ? "" : " ") + lower(token.substr(0, name_end)) + token.substr(name_end);
+    }
+    return bg::srs::proj4(normalised);
+}
+
+std::shared_ptr<const Transformation> cached_transformation(const std::string& source_proj4,
+                                                            const std::string& target_proj4) {
+    static std::mutex mutex;
+    static std::map<std::pair<std::string, std::string>, std::shared_ptr<const Transformation>> cache;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& transformation = cache[{source_proj4, target_proj4}];
+    if (not transformation)
+        transformation = std::visit([] (const auto& source, const auto& target) {
+                                        return std::make_shared<const Transformation>(source, target);
+                                    }, parse_srs(source_proj4), parse_srs(target_proj4));
+    return transformation;
+}
+
+// Geographic coordinates are in degrees for callers, and in radians for the transformation
+bool is_geographic(const std::string& proj4_str) {
+    namespace dpar = boost::geometry::srs::dpar;
+    const auto srs = parse_srs(proj4_str);
+    if (const auto proj4 = std::get_if<boost::geometry::srs::proj4>(&srs)) {
+        std::istringstream tokens(proj4->str());
+        for (std::string token; tokens >> token;)
+            for (const auto name: {"+proj=longlat", "+proj=latlong", "+proj=lonlat", "+proj=latlon"})
+                if (token == name)
+                    return true;
+        return false;
+    }
+    for (const auto& parameter: std::get<dpar::parameters<>>(srs)) {
+        if (parameter.is_id_equal(dpar::proj)) {
+            const auto id = parameter.get_value<int>();
+            return (id == dpar::proj_longlat or id == dpar::proj_latlong
+                    or id == dpar::proj_lonlat or id == dpar::proj_latlon);
+        }
+    }
+    return false;
+}
+
+// Transform the n points get(i) from the source to the target coordinate system, in parallel chunks,
+// and store them with set(i, point)
+template<typename Get, typename Set>
+void transform_points(const std::string& source_proj4, const std::string& target_proj4, std::size_t n,
+                      Get get, Set set) {
+    namespace bg = boost::geometry;
+    using point_car = bg::model::point<double, 3, bg::cs::cartesian>;
+    const auto transformation = cached_transformation(source_proj4, target_proj4);
+    const double to_radians = is_geographic(source_proj4) ? M_PI/180.0 : 1.0;
+    const double from_radians = is_geographic(target_proj4) ? 180.0/M_PI : 1.0;
+
+    constexpr std::size_t chunk_size = 4096;
+    parallel_for((n + chunk_size - 1)/chunk_size, [&] (std::size_t chunk) {
+        const std::size_t begin = chunk*chunk_size, end = std::min(n, begin + chunk_size);
+        bg::model::multi_point<point_car> source, target;
+        source.reserve(end - begin);
+        for (std::size_t i = begin; i < end; ++i) {
+            const point3 p = get(i);
+            source.emplace_back(p[0]*to_radians, p[1]*to_radians, p[2]);
+        }
+        if (not transformation->forward(source, target))
+            throw std::runtime_error("Unable to transform points from '" + source_proj4 + "' to '" + target_proj4 + "'");
+        for (std::size_t i = begin; i < end; ++i) {
+            const auto& p = target[i - begin];
+            set(i, point3{bg::get<0>(p)*from_radians, bg::get<1>(p)*from_radians, bg::get<2>(p)});
+        }
+    });
+}
+
+// Transform n points in place from the source to the target coordinate system, in parallel chunks
+void transform_points(const std::string& source_proj4, const std::string& target_proj4, point3* points,
+                      std::size_t n) {
+    transform_points(source_proj4, target_proj4, n,
+                     [points] (std::size_t i) {return points[i];},
+                     [points] (std::size_t i, const point3& p) {points[i] = p;});
+}
+
+// Immutable CGAL mesh shared by all the Mesh objects made from it. The flat points and faces
+// are only built the first time they are asked for.
+class MeshStorage {
+  public:
     const CGAL::Mesh cgal_mesh;
+
+    explicit MeshStorage(CGAL::Mesh&& cgal_mesh) : cgal_mesh(std::move(cgal_mesh)) {}
+    MeshStorage(const MeshStorage&) = delete;
+    MeshStorage& operator=(const MeshStorage&) = delete;
+
+    const point3_vector& points() const {
+        std::call_once(points_faces_built, [this] {set_points_faces();});
+        return points_;
+    }
+
+    const face_vector& faces() const {
+        std::call_once(points_faces_built, [this] {set_points_faces();});
+        return faces_;
+    }
+
+    // Longitude, latitude and height of the face centroids, in the order of cgal_mesh.faces().
+    // All meshes sharing the storage have the same coordinate system, so they are computed once.
+    const point3_vector& geographic_centroids(const std::string& proj4_str) const {
+        // Built aside, so that a failed transformation leaves nothing behind when call_once retries
+        std::call_once(centroids_built, [this, &proj4_str] {
+            point3_vector centroids;
+            centroids.reserve(cgal_mesh.number_of_faces());
+            for (auto f: cgal_mesh.faces()) {
+                point3 c{0.0, 0.0, 0.0};
+                for (auto v: cgal_mesh.vertices_around_face(cgal_mesh.halfedge(f))) {
+                    const auto& pt = cgal_mesh.point(v);
+                    c = point3{c[0] + pt.x()/3.0, c[1] + pt.y()/3.0, c[2] + pt.z()/3.0};
+                }
+                centroids.push_back(c);
+            }
+            transform_points(proj4_str, wgs84_proj4, centroids.data(), centroids.size());
+            centroids_ = std::move(centroids);
+        });
+        return centroids_;
+    }
+
+  private:
+    mutable std::once_flag points_faces_built;
+    mutable point3_vector points_;
+    mutable face_vector faces_;
+
+    mutable std::once_flag centroids_built;
+    mutable point3_vector centroids_;
+
+    void set_points_faces() const {
+        flatten_mesh(cgal_mesh, point3{0.0, 0.0, 0.0}, points_, faces_);
+    }
+};
+
+
+struct Mesh {
+  private:
+    std::shared_ptr<const MeshStorage> storage;
+
+  public:
+    const CGAL::Mesh& cgal_mesh;
     const std::string proj4_str;
     Mesh(CGAL::Mesh cgal_mesh, const std::string proj4_str)
-    : cgal_mesh(cgal_mesh), proj4_str(proj4_str) {set_points_faces();}
+    : storage(std::make_shared<const MeshStorage>(std::move(cgal_mesh))),
+      cgal_mesh(storage->cgal_mesh),
+      proj4_str(proj4_str) {}
 
+    // Simplify the mesh by edge collapse. Constrained edges (see triangulate) are never
+    // collapsed, and vertices on them are not moved. The collapse sequence is recorded in
+    // progressive_mesh if given.
     template<typename S, typename P, typename C>
-    Mesh coarsen(const S& stop, const P& placement, const C& cost) const {
+    Mesh coarsen(const S& stop, const P& placement, const C& cost,
+                 ProgressiveMesh* progressive_mesh = nullptr) const {
+        if (progressive_mesh)
+            progressive_mesh->proj4_str = proj4_str;
+        return coarsen_with_visitor(stop, placement, cost, ProgressiveMeshRecorder(progressive_mesh));
+    }
+
+    template<typename S, typename P, typename C, typename V>
+    Mesh coarsen_with_visitor(const S& stop, const P& placement, const C& cost, V visitor) const {
+        namespace SMS = CGAL::Surface_mesh_simplification;
         CGAL::Mesh new_cgal_mesh = CGAL::Mesh(this->cgal_mesh);
-        CGAL::Surface_mesh_simplification::edge_collapse(new_cgal_mesh,
-                                                         stop,
-                                                         CGAL::parameters::get_cost(cost)
-                                                                          .get_placement(placement));
-        return Mesh(new_cgal_mesh, proj4_str);
+
+        AttributeMergingVisitor<V> merging_visitor(visitor);
+
+        // Constrained edges and the boundaries between faces of different label are kept
+        auto locked = new_cgal_mesh.add_property_map<CGAL::EdgeIndex, bool>("e:locked", false).first;
+        auto [constrained, has_constraints] = new_cgal_mesh.property_map<CGAL::EdgeIndex, bool>("e:constrained");
+        if (has_constraints)
+            for (auto e: new_cgal_mesh.edges())
+                locked[e] = constrained[e];
+        const bool has_boundaries = lock_attribute_boundaries(new_cgal_mesh, locked);
+        if (has_constraints or has_boundaries) {
+            using LockedMap = decltype(locked);
+            SMS::edge_collapse(new_cgal_mesh,
+                               stop,
+                               CGAL::parameters::get_cost(cost)
+                                                .get_placement(SMS::Constrained_placement<P, LockedMap>(locked, placement))
+                                                .edge_is_constrained_map(locked)
+                                                .visitor(merging_visitor));
+        } else {
+            SMS::edge_collapse(new_cgal_mesh,
+                               stop,
+                               CGAL::parameters::get_cost(cost)
+                                                .get_placement(placement)
+                                                .visitor(merging_visitor));
+        }
+        new_cgal_mesh.remove_property_map(locked);
+        return Mesh(std::move(new_cgal_mesh), proj4_str);
+    }
+
+    // Simplify the mesh by edge collapse for as long as the vertical distance to the raster samples
+    // stays within the tolerance
+    template<typename R, typename P>
+    Mesh coarsen_by_vertical_error(const R& raster, double tolerance, const P& placement) const {
+        namespace SMS = CGAL::Surface_mesh_simplification;
+        // Collapses beyond the tolerance have no cost, so simplification only stops when none are left
+        VerticalErrorTracker tracker(cgal_mesh, raster, tolerance);
+        return coarsen_with_visitor(SMS::Count_stop_predicate<CGAL::Mesh>(0), placement,
+                                    VerticalErrorCost{&tracker}, VerticalErrorVisitor(&tracker));
+    }
+
+    // Simplify the mesh by edge collapse on a pool of threads, until it has fewer than target_edges edges.
+    //
+    // The faces are split into a grid of spatial partitions by their centroids. Each partition is
+    // simplified concurrently with the edges on the partition boundaries locked, down to its share of
+    // the target. A final pass over the bands around the partition boundaries then brings the whole
+    // mesh to the target. Constrained edges are kept as in coarsen.
+    template<typename P, typename C>
+    Mesh coarsen_parallel(std::size_t target_edges, const P& placement, const C& cost,
+                          std::size_t num_partitions = 0) const {
+        namespace SMS = CGAL::Surface_mesh_simplification;
+        const auto& mesh = cgal_mesh;
+        if (num_partitions == 0)
+            num_partitions = 2*num_threads();
+        // Small meshes are not worth the bookkeeping
+        if (num_partitions < 2 or mesh.number_of_faces() < 64*num_partitions)
+            return coarsen(SMS::Count_stop_predicate<CGAL::Mesh>(target_edges), placement, cost);
+
+        // Grid of roughly square partitions over the bounding box
+        double x_min = std::numeric_limits<double>::max(), x_max = std::numeric_limits<double>::lowest();
+        double y_min = x_min, y_max = x_max;
+        for (auto v: mesh.vertices()) {
+            const auto& p = mesh.point(v);
+            x_min = std::min(x_min, p.x()); x_max = std::max(x_max, p.x());
+            y_min = std::min(y_min, p.y()); y_max = std::max(y_max, p.y());
+        }
+        const double width = std::max(x_max - x_min, 1e-12), height = std::max(y_max - y_min, 1e-12);
+        const std::size_t nx = std::max<std::size_t>(1, std::lround(std::sqrt(num_partitions*width/height)));
+        const std::size_t ny = std::max<std::size_t>(1, (num_partitions + nx - 1)/nx);
+
+        // Faces of each partition, and the vertices shared between partitions
+        std::vector<std::vector<CGAL::FaceIndex>> partition_faces(nx*ny);
+        std::vector<int> vertex_partition(mesh.num_vertices(), -1);
+        std::vector<bool> seam(mesh.num_vertices(), false);
+        for (auto f: mesh.faces()) {
+            double cx = 0.0, cy = 0.0;
+            for (auto v: mesh.vertices_around_face(mesh.halfedge(f))) {
+                cx += mesh.point(v).x()/3;
+                cy += mesh.point(v).y()/3;
+            }
+            const std::size_t i = std::min<std::size_t>(ny - 1, static_cast<std::size_t>((cy - y_min)/height*ny));
+            const std::size_t j = std::min<std::size_t>(nx - 1, static_cast<std::size_t>((cx - x_min)/width*nx));
+            const int k = static_cast<int>(i*nx + j);
+            partition_faces[k].push_back(f);
+            for (auto v: mesh.vertices_around_face(mesh.halfedge(f))) {
+                if (vertex_partition[v.idx()] < 0)
+                    vertex_partition[v.idx()] = k;
+                else if (vertex_partition[v.idx()] != k)
+                    seam[v.idx()] = true;
+            }
+        }
+
+        const auto constrained_map = mesh.property_map<CGAL::EdgeIndex, bool>("e:constrained");
+        const auto& constrained = constrained_map.first;
+        const bool has_constraints = constrained_map.second;
+        std::vector<CGAL::Point> position(mesh.num_vertices());
+        for (auto v: mesh.vertices())
+            position[v.idx()] = mesh.point(v);
+
+        // Simplify each partition as a separate mesh, with the edges to other partitions locked
+        const double edge_ratio = static_cast<double>(target_edges)/mesh.number_of_edges();
+        struct Partition {
+            CGAL::Mesh mesh;
+            std::vector<std::size_t> global;
+        };
+        std::vector<Partition> partitions(partition_faces.size());
+        // A partition that is not a manifold on its own (faces only touching at a vertex) can not be
+        // rebuilt as a separate mesh, in which case the whole mesh is simplified serially instead
+        std::atomic<bool> non_manifold{false};
+        parallel_for(partition_faces.size(), [&] (std::size_t k) {
+            const auto& faces = partition_faces[k];
+            if (faces.empty() or non_manifold)
+                return;
+
+            std::vector<std::size_t> global;
+            global.reserve(3*faces.size());
+            for (auto f: faces)
+                for (auto v: mesh.vertices_around_face(mesh.halfedge(f)))
+                    global.push_back(v.idx());
+            std::sort(global.begin(), global.end());
+            global.erase(std::unique(global.begin(), global.end()), global.end());
+            auto local_index = [&global] (CGAL::VertexIndex v) {
+                return CGAL::VertexIndex(std::lower_bound(global.begin(), global.end(), v.idx()) - global.begin());
+            };
+
+            CGAL::Mesh local;
+            local.reserve(global.size(), 2*faces.size() + global.size(), faces.size());
+            for (auto g: global)
+                local.add_vertex(position[g]);
+            for (auto f: faces) {
+                std::array<CGAL::VertexIndex, 3> vertices;
+                std::size_t i = 0;
+                for (auto v: mesh.vertices_around_face(mesh.halfedge(f)))
+                    vertices[i++] = local_index(v);
+                if (local.add_face(vertices[0], vertices[1], vertices[2]) == CGAL::Mesh::null_face()) {
+                    non_manifold = true;
+                    return;
+                }
+            }
+            std::vector<std::pair<CGAL::VertexIndex, CGAL::VertexIndex>> vertex_pairs(global.size());
+            for (std::size_t i = 0; i < global.size(); ++i)
+                vertex_pairs[i] = {CGAL::VertexIndex(global[i]), CGAL::VertexIndex(i)};
+            std::vector<std::pair<CGAL::FaceIndex, CGAL::FaceIndex>> face_pairs(faces.size());
+            for (std::size_t i = 0; i < faces.size(); ++i)
+                face_pairs[i] = {faces[i], CGAL::FaceIndex(i)};
+            copy_attributes(mesh, local, vertex_pairs);
+            copy_attributes(mesh, local, face_pairs);
+
+            auto locked = local.add_property_map<CGAL::EdgeIndex, bool>("e:locked", false).first;
+            for (auto e: local.edges()) {
+                const auto h = local.halfedge(e);
+                const auto global_edge = mesh.edge(mesh.halfedge(CGAL::VertexIndex(global[local.source(h).idx()]),
+                                                                 CGAL::VertexIndex(global[local.target(h).idx()])));
+                locked[e] = ((local.is_border(e) and not mesh.is_border(global_edge))
+                             or (has_constraints and constrained[global_edge]));
+            }
+            lock_attribute_boundaries(local, locked);
+            collapse_unlocked(local, static_cast<std::size_t>(edge_ratio*local.number_of_edges()),
+                              placement, cost, locked);
+
+            // Only vertices inside the partition can have moved
+            for (auto v: local.vertices())
+                if (not seam[global[v.idx()]])
+                    position[global[v.idx()]] = local.point(v);
+            partitions[k] = Partition{std::move(local), std::move(global)};
+        });
+        if (non_manifold)
+            return coarsen(SMS::Count_stop_predicate<CGAL::Mesh>(target_edges), placement, cost);
+
+        // Merge the partitions, with the attributes of their faces and vertices
+        std::size_t num_faces = 0;
+        for (const auto& partition: partitions)
+            num_faces += partition.mesh.number_of_faces();
+        CGAL::Mesh merged;
+        merged.reserve(num_faces/2 + 1, 2*num_faces, num_faces);
+        std::vector<CGAL::VertexIndex> new_vertex(mesh.num_vertices());
+        for (const auto& partition: partitions) {
+            const auto& local = partition.mesh;
+            std::vector<std::pair<CGAL::VertexIndex, CGAL::VertexIndex>> vertex_pairs;
+            std::vector<std::pair<CGAL::FaceIndex, CGAL::FaceIndex>> face_pairs;
+            for (auto f: local.faces()) {
+                std::array<CGAL::VertexIndex, 3> vertices;
+                std::size_t i = 0;
+                for (auto v: local.vertices_around_face(local.halfedge(f))) {
+                    const auto g = partition.global[v.idx()];
+                    // Seam vertices come from the first partition they are in
+                    if (new_vertex[g] == CGAL::VertexIndex()) {
+                        new_vertex[g] = merged.add_vertex(position[g]);
+                        vertex_pairs.emplace_back(v, new_vertex[g]);
+                    }
+                    vertices[i++] = new_vertex[g];
+                }
+                const auto new_face = merged.add_face(vertices[0], vertices[1], vertices[2]);
+                if (new_face == CGAL::Mesh::null_face())
+                    return coarsen(SMS::Count_stop_predicate<CGAL::Mesh>(target_edges), placement, cost);
+                face_pairs.emplace_back(f, new_face);
+            }
+            copy_attributes(local, merged, vertex_pairs);
+            copy_attributes(local, merged, face_pairs);
+        }
+        auto merged_constrained = merged.add_property_map<CGAL::EdgeIndex, bool>("e:constrained", false).first;
+        if (has_constraints) {
+            for (auto e: mesh.edges()) {
+                if (not constrained[e])
+                    continue;
+                const auto u = new_vertex[mesh.source(mesh.halfedge(e)).idx()];
+                const auto v = new_vertex[mesh.target(mesh.halfedge(e)).idx()];
+                if (u == CGAL::VertexIndex() or v == CGAL::VertexIndex())
+                    continue;
+                const auto h = merged.halfedge(u, v);
+                if (h != CGAL::Mesh::null_halfedge())
+                    merged_constrained[merged.edge(h)] = true;
+            }
+        }
+
+        // Final pass over the faces with a vertex on or next to a partition boundary
+        std::vector<bool> band(merged.num_vertices(), false);
+        for (std::size_t g = 0; g < seam.size(); ++g) {
+            if (not seam[g] or new_vertex[g] == CGAL::VertexIndex())
+                continue;
+            band[new_vertex[g].idx()] = true;
+            for (auto w: merged.vertices_around_target(merged.halfedge(new_vertex[g])))
+                band[w.idx()] = true;
+        }
+        auto locked = merged.add_property_map<CGAL::EdgeIndex, bool>("e:locked", true).first;
+        for (auto f: merged.faces()) {
+            const auto vertices = merged.vertices_around_face(merged.halfedge(f));
+            if (std::none_of(vertices.begin(), vertices.end(), [&band] (CGAL::VertexIndex v) {return band[v.idx()];}))
+                continue;
+            for (auto h: merged.halfedges_around_face(merged.halfedge(f)))
+                locked[merged.edge(h)] = merged_constrained[merged.edge(h)];
+        }
+        lock_attribute_boundaries(merged, locked);
+        collapse_unlocked(merged, target_edges, placement, cost, locked);
+        merged.remove_property_map(locked);
+        if (not has_constraints)
+            merged.remove_property_map(merged_constrained);
+        return Mesh(std::move(merged), proj4_str);
     }
 
     Mesh copy() const {
-        // Call CGAL::Mesh copy constructor to do a deep copy
-        return Mesh(CGAL::Mesh(cgal_mesh), proj4_str);
+        // The storage is immutable, so copies share it
+        return *this;
     }
 
     const point3_vector& get_points() const {
-        return points;
+        return storage->points();
     }
 
     const face_vector& get_faces() const {
-        return faces;
+        return storage->faces();
+    }
+
+    const point3_vector& geographic_centroids() const {
+        return storage->geographic_centroids(proj4_str);
+    }
+
+    // The mesh with its points transformed to the target coordinate system. Connectivity,
+    // constraints and attributes are copied unchanged, so vertex and face indices carry over.
+    Mesh reproject(const std::string& target_proj4) const {
+        // The points of the copy are transformed in place. Slots of vertices removed by simplification
+        // may hold any position, so they are left out rather than compacted, which would renumber them.
+        CGAL::Mesh mesh(cgal_mesh);
+        std::vector<CGAL::VertexIndex> vertices(mesh.vertices().begin(), mesh.vertices().end());
+        transform_points(proj4_str, target_proj4, vertices.size(),
+                         [&] (std::size_t i) {
+                             const auto& pt = mesh.point(vertices[i]);
+                             return point3{pt.x(), pt.y(), pt.z()};
+                         },
+                         [&] (std::size_t i, const point3& p) {
+                             mesh.point(vertices[i]) = CGAL::Point3(p[0], p[1], p[2]);
+                         });
+        return Mesh(std::move(mesh), target_proj4);
+    }
+
+    // Centre of the bounding box, as a local origin that keeps the coordinates small
+    point3 bounding_box_centre() const {
+        if (cgal_mesh.is_empty())
+            return point3{0.0, 0.0, 0.0};
+        CGAL::Bbox_3 box;
+        for (auto v: cgal_mesh.vertices())
+            box += cgal_mesh.point(v).bbox();
+        return point3{(box.xmin() + box.xmax())/2, (box.ymin() + box.ymax())/2, (box.zmin() + box.zmax())/2};
+    }
+
+    // Points relative to origin and faces with other coordinate and index types than get_points
+    // and get_faces, in the same order
+    template<typename P, typename I>
+    std::tuple<point3_vector_t<P>, face_vector_t<I>> flat_points_faces(const point3& origin) const {
+        if (num_vertices() > std::size_t(std::numeric_limits<I>::max()))
+            throw std::overflow_error("Mesh has too many vertices for the index type.");
+        point3_vector_t<P> points;
+        face_vector_t<I> faces;
+        flatten_mesh(cgal_mesh, origin, points, faces);
+        return std::make_tuple(std::move(points), std::move(faces));
+    }
+
+    // Part index of each face for meshes merged from several parts, otherwise empty
+    std::vector<int> part_ids() const {
+        std::vector<int> result;
+        auto [part_id, found] = cgal_mesh.property_map<CGAL::FaceIndex, int>("f:part_id");
+        if (not found)
+            return result;
+        result.reserve(cgal_mesh.number_of_faces());
+        for (auto f: cgal_mesh.faces())
+            result.push_back(part_id[f]);
+        return result;
+    }
+
+    // End points of the constrained edges in the interior of the mesh
+    std::vector<std::array<point3, 2>> constrained_edges() const {
+        std::vector<std::array<point3, 2>> result;
+        auto [constrained, found] = cgal_mesh.property_map<CGAL::EdgeIndex, bool>("e:constrained");
+        if (not found)
+            return result;
+        for (auto e: cgal_mesh.edges()) {
+            if (not constrained[e])
+                continue;
+            const auto& p = cgal_mesh.point(cgal_mesh.source(cgal_mesh.halfedge(e)));
+            const auto& q = cgal_mesh.point(cgal_mesh.target(cgal_mesh.halfedge(e)));
+            result.push_back({point3{p.x(), p.y(), p.z()}, point3{q.x(), q.y(), q.z()}});
+        }
+        return result;
     }
 
     size_t num_edges() const {return cgal_mesh.number_of_edges();}
     size_t num_vertices() const {return cgal_mesh.number_of_vertices();}
     size_t num_faces() const {return cgal_mesh.number_of_faces();}
 
+    // Face indices sorted along a Hilbert curve through the face centroids in the xy-plane, so that
+    // faces close in space are close in the order
+    std::vector<int> hilbert_face_order() const {
+        const auto& points = get_points();
+        const auto& faces = get_faces();
+        std::vector<int> order(faces.size());
+        std::iota(order.begin(), order.end(), 0);
+        if (faces.empty())
+            return order;
+
+        double x_min = std::numeric_limits<double>::max(), x_max = std::numeric_limits<double>::lowest();
+        double y_min = x_min, y_max = x_max;
+        for (const auto& p: points) {
+            x_min = std::min(x_min, p[0]);
+            x_max = std::max(x_max, p[0]);
+            y_min = std::min(y_min, p[1]);
+            y_max = std::max(y_max, p[1]);
+        }
+        const unsigned order_bits = 16;
+        const double cells = double((1u << order_bits) - 1);
+        const double x_scale = x_max > x_min ? cells/(x_max - x_min) : 0.0;
+        const double y_scale = y_max > y_min ? cells/(y_max - y_min) : 0.0;
+
+        std::vector<std::uint64_t> key(faces.size());
+        for (std::size_t i = 0; i < faces.size(); ++i) {
+            const auto& a = points[faces[i][0]];
+            const auto& b = points[faces[i][1]];
+            const auto& c = points[faces[i][2]];
+            const auto x = std::uint32_t(((a[0] + b[0] + c[0])/3 - x_min)*x_scale);
+            const auto y = std::uint32_t(((a[1] + b[1] + c[1])/3 - y_min)*y_scale);
+            key[i] = hilbert_index(x, y, order_bits);
+        }
+        std::stable_sort(order.begin(), order.end(), [&key] (int i, int j) {return key[i] < key[j];});
+        return order;
+    }
+
+    // Mesh with face i being face order[i] of this mesh, and the vertices numbered in the order they
+    // are first used by the faces
+    Mesh permute_faces(const std::vector<int>& order) const {
+        if (order.size() != num_faces())
+            throw std::invalid_argument("Face order must have one entry per face.");
+        return extract_sub_mesh(order);
+    }
+
+    // Mesh of the given faces, in that order, with the vertices numbered in the order they are first
+    // used. Constrained edges, part ids and attributes are kept.
     Mesh extract_sub_mesh(const std::vector<int> &face_indices) const {
-        std::map<int, int> remap;
-        point3_vector new_points;
-        face_vector new_faces;
-        int counter = 0;
-        for (auto face_idx: face_indices) {
-            std::array<int, 3> new_face;
-            int i = 0;
-            for (auto idx: faces[face_idx]) {
-                if (remap.count(idx) == 0) {
-                    remap[idx] = counter++;
-                    new_points.emplace_back(points[idx]);
+        SubMeshScratch scratch(*this);
+        return extract_faces(flat_elements<CGAL::FaceIndex>(), face_indices, scratch);
+    }
+
+    // Sub meshes of the faces with each label, in increasing order of label, with labels given in the
+    // order of get_faces. The faces are bucketed in one pass, and the sub meshes built concurrently.
+    std::vector<std::pair<int, Mesh>> partition_by_label(const std::vector<int>& labels) const {
+        if (labels.size() != num_faces())
+            throw std::invalid_argument("Partition needs one label per face.");
+
+        std::vector<int> unique_labels(labels);
+        std::sort(unique_labels.begin(), unique_labels.end());
+        unique_labels.erase(std::unique(unique_labels.begin(), unique_labels.end()), unique_labels.end());
+
+        // Counting sort of the faces by label
+        std::vector<int> part(labels.size());
+        std::vector<std::size_t> offset(unique_labels.size() + 1, 0);
+        for (std::size_t i = 0; i < labels.size(); ++i) {
+            part[i] = int(std::lower_bound(unique_labels.begin(), unique_labels.end(), labels[i]) - unique_labels.begin());
+            ++offset[part[i] + 1];
+        }
+        std::partial_sum(offset.begin(), offset.end(), offset.begin());
+        std::vector<int> sorted_faces(labels.size());
+        std::vector<std::size_t> next(offset.begin(), offset.end() - 1);
+        for (std::size_t i = 0; i < labels.size(); ++i)
+            sorted_faces[next[part[i]]++] = int(i);
+
+        // Scratch arrays are reused between the parts a thread builds
+        const auto old_faces = flat_elements<CGAL::FaceIndex>();
+        std::vector<std::unique_ptr<SubMeshScratch>> scratch_pool;
+        std::mutex scratch_mutex;
+        std::vector<std::optional<Mesh>> meshes(unique_labels.size());
+        parallel_for(unique_labels.size(), [&] (std::size_t k) {
+            std::unique_ptr<SubMeshScratch> scratch;
+            {
+                std::lock_guard<std::mutex> lock(scratch_mutex);
+                if (not scratch_pool.empty()) {
+                    scratch = std::move(scratch_pool.back());
+                    scratch_pool.pop_back();
                 }
-                new_face[i++] = remap[idx];
             }
-            new_faces.emplace_back(new_face);
+            if (not scratch)
+                scratch = std::make_unique<SubMeshScratch>(*this);
+            const std::vector<int> face_indices(sorted_faces.begin() + offset[k], sorted_faces.begin() + offset[k + 1]);
+            meshes[k].emplace(extract_faces(old_faces, face_indices, *scratch));
+            std::lock_guard<std::mutex> lock(scratch_mutex);
+            scratch_pool.push_back(std::move(scratch));
+        });
+
+        std::vector<std::pair<int, Mesh>> result;
+        result.reserve(unique_labels.size());
+        for (std::size_t k = 0; k < unique_labels.size(); ++k)
+            result.emplace_back(unique_labels[k], std::move(*meshes[k]));
+        return result;
+    }
+
+    // Mesh with a typed attribute of the faces or vertices (I), given in the order of get_faces or
+    // get_points. An attribute of the same name is replaced. The policy of face attributes is "free",
+    // or "boundary" for int labels whose boundaries are kept when simplifying. The policy of vertex
+    // attributes is how values are merged on edge collapse: "average", "minimum", "maximum" or
+    // "nearest", which takes the value of the end point closest to the new vertex.
+    template<typename I, typename T>
+    Mesh with_attribute(const std::string& name, const std::vector<T>& values, const std::string& policy) const {
+        const auto elements = flat_elements<I>();
+        if (values.size() != elements.size())
+            throw std::invalid_argument("Attribute '" + name + "' must have one value per element.");
+        if constexpr (std::is_same_v<I, CGAL::FaceIndex>) {
+            if (policy != "free" and policy != "boundary")
+                throw std::invalid_argument("Unknown face attribute policy '" + policy + "'.");
+            if (policy == "boundary" and not std::is_same_v<T, int>)
+                throw std::invalid_argument("Only int face attributes can keep their boundaries.");
+        } else {
+            attribute_merge(policy);
         }
-        VertexIndexMap index_map;
-        FaceDescrMap face_map;
-        return Mesh(construct_mesh(new_points, new_faces, index_map, face_map), proj4_str);
+
+        CGAL::Mesh mesh(cgal_mesh);
+        for (const auto& key: attribute_keys<I>(mesh)) {
+            if (key.name != name)
+                continue;
+            if (key.type == "int")
+                mesh.remove_property_map(mesh.property_map<I, int>(key.str()).first);
+            else
+                mesh.remove_property_map(mesh.property_map<I, double>(key.str()).first);
+        }
+        const AttributeKey key{attribute_element<I>(), attribute_type<T>(), policy, name};
+        auto map = mesh.add_property_map<I, T>(key.str(), T()).first;
+        for (std::size_t i = 0; i < elements.size(); ++i)
+            map[elements[i]] = values[i];
+        return Mesh(std::move(mesh), proj4_str);
     }
 
-    private:
-    point3_vector points;
-    face_vector faces;
+    // Values of a face or vertex (I) attribute, in the order of get_faces or get_points
+    template<typename I, typename T>
+    std::vector<T> attribute(const std::string& name) const {
+        for (const auto& key: attribute_keys<I>(cgal_mesh)) {
+            if (key.name != name or key.type != attribute_type<T>())
+                continue;
+            const auto map = cgal_mesh.property_map<I, T>(key.str()).first;
+            std::vector<T> result;
+            for (auto e: flat_elements<I>())
+                result.push_back(map[e]);
+            return result;
+        }
+        throw std::out_of_range("No " + attribute_type<T>() + " attribute '" + name + "'.");
+    }
+
+    // Names and types of the face or vertex (I) attributes
+    template<typename I>
+    std::vector<std::pair<std::string, std::string>> attributes() const {
+        std::vector<std::pair<std::string, std::string>> result;
+        for (const auto& key: attribute_keys<I>(cgal_mesh))
+            result.emplace_back(key.name, key.type);
+        return result;
+    }
+
+  private:
+    // Flat remap arrays for extract_faces, left cleared after each use
+    struct SubMeshScratch {
+        std::vector<CGAL::VertexIndex> new_vertex;
+        std::vector<bool> used;
 
-    void set_points_faces() {
-        points.clear();
-        faces.clear();
-
-        points.reserve(cgal_mesh.num_vertices());
-        faces.reserve(cgal_mesh.num_faces());
-
-        int n = 0;
-        std::map<CGAL::VertexIndex, int> reindex;
-        for (auto f: cgal_mesh.faces()) {
-            std::array<int, 3> fl;
-            size_t idx = 0;
-            for (auto v: cgal_mesh.vertices_around_face(cgal_mesh.halfedge(f))) {
-                if (reindex.count(v) == 0) {
-                    reindex.emplace(v, n++);
-                    const auto pt = cgal_mesh.point(v);
-                    points.emplace_back(point3{pt.x(), pt.y(), pt.z()});
+        explicit SubMeshScratch(const Mesh& mesh)
+            : new_vertex(mesh.cgal_mesh.num_vertices()), used(mesh.num_faces(), false) {}
+    };
+
+    Mesh extract_faces(const std::vector<CGAL::FaceIndex>& old_faces,
+                       const std::vector<int>& face_indices,
+                       SubMeshScratch& scratch) const {
+        CGAL::Mesh mesh;
+        mesh.reserve(std::min(num_vertices(), 3*face_indices.size()), 2*face_indices.size(), face_indices.size());
+        auto& new_vertex = scratch.new_vertex;
+        auto& used = scratch.used;
+        std::vector<std::pair<CGAL::VertexIndex, CGAL::VertexIndex>> vertex_pairs;
+        std::vector<std::pair<CGAL::FaceIndex, CGAL::FaceIndex>> face_pairs;
+        face_pairs.reserve(face_indices.size());
+        auto clear_scratch = [&] () {
+            for (const auto& pair: vertex_pairs)
+                new_vertex[pair.first.idx()] = CGAL::VertexIndex();
+            for (auto i: face_indices)
+                if (i >= 0 and std::size_t(i) < used.size())
+                    used[i] = false;
+        };
+        for (auto i: face_indices) {
+            if (i < 0 or std::size_t(i) >= old_faces.size() or used[i]) {
+                clear_scratch();
+                if (i < 0 or std::size_t(i) >= old_faces.size())
+                    throw std::out_of_range("Face index " + std::to_string(i) + " is out of range.");
+                throw std::invalid_argument("Face " + std::to_string(i) + " is given more than once.");
+            }
+            used[i] = true;
+            std::array<CGAL::VertexIndex, 3> vertices;
+            std::size_t k = 0;
+            for (auto v: cgal_mesh.vertices_around_face(cgal_mesh.halfedge(old_faces[i]))) {
+                if (new_vertex[v.idx()] == CGAL::VertexIndex()) {
+                    new_vertex[v.idx()] = mesh.add_vertex(cgal_mesh.point(v));
+                    vertex_pairs.emplace_back(v, new_vertex[v.idx()]);
                 }
-                fl[idx++] = reindex[v];
+                vertices[k++] = new_vertex[v.idx()];
+            }
+            const auto f = mesh.add_face(vertices[0], vertices[1], vertices[2]);
+            if (f == CGAL::Mesh::null_face()) {
+                clear_scratch();
+                throw std::invalid_argument("Face " + std::to_string(i) + " can not be added without breaking the manifold.");
+            }
+            face_pairs.emplace_back(old_faces[i], f);
+        }
+        clear_scratch();
+        copy_attributes(cgal_mesh, mesh, vertex_pairs);
+        copy_attributes(cgal_mesh, mesh, face_pairs);
+
+        auto [old_part_id, has_part_ids] = cgal_mesh.property_map<CGAL::FaceIndex, int>("f:part_id");
+        if (has_part_ids) {
+            auto part_id = mesh.add_property_map<CGAL::FaceIndex, int>("f:part_id", -1).first;
+            for (const auto& pair: face_pairs)
+                part_id[pair.second] = old_part_id[pair.first];
+        }
+        auto [old_constrained, has_constraints] = cgal_mesh.property_map<CGAL::EdgeIndex, bool>("e:constrained");
+        if (has_constraints) {
+            // Vertices are added in order, so vertex_pairs[i] is new vertex i
+            auto constrained = mesh.add_property_map<CGAL::EdgeIndex, bool>("e:constrained", false).first;
+            for (auto e: mesh.edges()) {
+                const auto h = cgal_mesh.halfedge(vertex_pairs[mesh.source(mesh.halfedge(e)).idx()].first,
+                                                  vertex_pairs[mesh.target(mesh.halfedge(e)).idx()].first);
+                constrained[e] = old_constrained[cgal_mesh.edge(h)];
             }
-            faces.emplace_back(face{fl[0], fl[1], fl[2]});
         }
+        return Mesh(std::move(mesh), proj4_str);
+    }
+
+    // Faces or vertices (I) in the order of get_faces or get_points
+    template<typename I>
+    std::vector<I> flat_elements() const {
+        std::vector<I> result;
+        if constexpr (std::is_same_v<I, CGAL::FaceIndex>) {
+            result.reserve(num_faces());
+            for (auto f: cgal_mesh.faces())
+                result.push_back(f);
+        } else {
+            result.reserve(num_vertices());
+            std::vector<bool> seen(cgal_mesh.num_vertices(), false);
+            for (auto f: cgal_mesh.faces())
+                for (auto v: cgal_mesh.vertices_around_face(cgal_mesh.halfedge(f)))
+                    if (not seen[v.idx()]) {
+                        seen[v.idx()] = true;
+                        result.push_back(v);
+                    }
+        }
+        return result;
     }
 };
 
-CGAL::Mesh construct_mesh(const point3_vector &pts,
-                          const face_vector &faces,
-                          VertexIndexMap& index_map,
-                          FaceDescrMap& face_map){
-    CGAL::Mesh mesh;
-    index_map.clear();
-    face_map.clear();
-    size_t i = 0;
-    size_t j = 0;
-    for (auto p: pts)
-        index_map[i++] = mesh.add_vertex(CGAL::Point(p[0], p[1], p[2]));
-    for (auto f: faces)
-        face_map[mesh.add_face(index_map[f[0]], index_map[f[1]], index_map[f[2]])] = j++;
-    return mesh;
+
+// Level of detail with the given number of vertices from a progressive mesh
+Mesh extract_mesh(const ProgressiveMesh& progressive_mesh, std::size_t num_vertices) {
+    const auto [points, faces] = progressive_mesh.extract(num_vertices);
+    return Mesh(construct_mesh(points, faces), progressive_mesh.proj4_str);
+}
+
+
+// Scanline index over the boundary edges of a polygon.
+//
+// Edges are bucketed into horizontal bands of height delta_y, aligned with
+// y_origin, so that extracting the inside spans along a raster row and
+// locating a single point only visit the edges crossing that band. Inside is
+// determined by the even-odd rule over all boundaries, which agrees with
+// point_inside_polygon for polygons with holes and disjoint multipolygons.
+class PolygonScanlines {
+  public:
+    template<typename P>
+    PolygonScanlines(const P& polygon, double y_origin, double delta_y)
+        : y_origin(y_origin), delta_y(delta_y) {
+        for (const auto& boundary: CGAL::extract_boundaries(polygon))
+            for (auto e = boundary.edges_begin(); e != boundary.edges_end(); ++e)
+                // Horizontal edges never cross a scanline with the half-open rule below
+                if (e->vertex(0).y() != e->vertex(1).y())
+                    edges.push_back(Edge{e->vertex(0).x(), e->vertex(0).y(),
+                                         e->vertex(1).x(), e->vertex(1).y()});
+        build_bands();
+    }
+
+    // Sorted x-coordinates where the scanline at y crosses the boundary.
+    // Consecutive pairs delimit the parts of the scanline inside the polygon.
+    std::vector<double> crossings(double y) const {
+        std::vector<double> result;
+        const auto band = band_edges(y);
+        if (band == nullptr)
+            return result;
+        for (auto k: *band) {
+            const auto& e = edges[k];
+            if ((e.y0 > y) != (e.y1 > y))
+                result.push_back(e.x0 + (y - e.y0)*(e.x1 - e.x0)/(e.y1 - e.y0));
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    bool contains(double x, double y) const {
+        const auto band = band_edges(y);
+        if (band == nullptr)
+            return false;
+        bool inside = false;
+        for (auto k: *band) {
+            const auto& e = edges[k];
+            if (((e.y0 > y) != (e.y1 > y)) and (x < e.x0 + (y - e.y0)*(e.x1 - e.x0)/(e.y1 - e.y0)))
+                inside = not inside;
+        }
+        return inside;
+    }
+
+    bool contains(const CGAL::Point2& x) const {
+        return contains(x.x(), x.y());
+    }
+
+  private:
+    struct Edge {
+        double x0, y0, x1, y1;
+    };
+
+    double y_origin;
+    double delta_y;
+    std::vector<Edge> edges;
+
+    // Edge indices for the bands first_band, first_band + 1, ...
+    long first_band = 0;
+    std::vector<std::vector<std::size_t>> bands;
+
+    long band(double y) const {
+        return static_cast<long>(std::floor((y_origin - y)/delta_y));
+    }
+
+    const std::vector<std::size_t>* band_edges(double y) const {
+        const long k = band(y) - first_band;
+        if (k < 0 or k >= static_cast<long>(bands.size()))
+            return nullptr;
+        return &bands[k];
+    }
+
+    void build_bands() {
+        if (edges.empty())
+            return;
+        long last_band = first_band = band(edges.front().y0);
+        for (const auto& e: edges) {
+            first_band = std::min(first_band, band(std::max(e.y0, e.y1)));
+            last_band = std::max(last_band, band(std::min(e.y0, e.y1)));
+        }
+        bands.resize(last_band - first_band + 1);
+        for (std::size_t k = 0; k < edges.size(); ++k) {
+            const auto& e = edges[k];
+            for (long b = band(std::max(e.y0, e.y1)); b <= band(std::min(e.y0, e.y1)); ++b)
+                bands[b - first_band].push_back(k);
+        }
+    }
+};
+
+
+// Labels points by the labelled polygons containing them.
+//
+// Polygon bounding boxes are bulk loaded into a packed R-tree, and each polygon
+// keeps a scanline index with a handful of edges per band, so locating a point
+// only tests the edges near it in the few polygons whose boxes contain it. The
+// first added polygon containing a point decides its label.
+class PolygonClassifier {
+  public:
+    template<typename P>
+    void add(int label, const P& polygon) {
+        const auto boundaries = CGAL::extract_boundaries(polygon);
+        Box box;
+        boost::geometry::assign_inverse(box);
+        std::size_t num_edges = 0;
+        for (const auto& boundary: boundaries) {
+            for (auto v = boundary.vertices_begin(); v != boundary.vertices_end(); ++v)
+                boost::geometry::expand(box, *v);
+            num_edges += boundary.size();
+        }
+        if (num_edges == 0)
+            return;
+
+        const double height = box.max_corner().y() - box.min_corner().y();
+        const double delta_y = height > 0 ? height/std::max<std::size_t>(1, num_edges/4) : 1.0;
+        labels.push_back(label);
+        boxes.emplace_back(box, scanlines.size());
+        scanlines.emplace_back(polygon, box.max_corner().y(), delta_y);
+        tree.reset();
+    }
+
+    std::size_t size() const {
+        return scanlines.size();
+    }
+
+    // Labels of the n points in xy, or default_label for points outside all polygons
+    void classify(const double* xy, std::size_t n, int* out, int default_label) {
+        if (not tree)
+            tree = std::make_unique<RTree>(boxes.begin(), boxes.end());
+
+        constexpr std::size_t chunk_size = 4096;
+        parallel_for((n + chunk_size - 1)/chunk_size, [&] (std::size_t chunk) {
+            std::vector<Value> candidates;
+            for (std::size_t i = chunk*chunk_size; i < std::min(n, (chunk + 1)*chunk_size); ++i) {
+                const CGAL::Point2 x{xy[2*i], xy[2*i + 1]};
+                candidates.clear();
+                tree->query(boost::geometry::index::intersects(x), std::back_inserter(candidates));
+                std::sort(candidates.begin(), candidates.end(),
+                          [] (const Value& a, const Value& b) {return a.second < b.second;});
+                out[i] = default_label;
+                for (const auto& [box, k]: candidates)
+                    if (scanlines[k].contains(x)) {
+                        out[i] = labels[k];
+                        break;
+                    }
+            }
+        });
+    }
+
+  private:
+    using Box = boost::geometry::model::box<CGAL::Point2>;
+    using Value = std::pair<Box, std::size_t>;
+    using RTree = boost::geometry::index::rtree<Value, boost::geometry::index::rstar<16>>;
+
+    std::vector<int> labels;
+    std::vector<Value> boxes;
+    std::vector<PolygonScanlines> scanlines;
+    std::unique_ptr<RTree> tree;
 };
 
 
@@ -307,10 +1732,12 @@ template<typename FT>
 struct RasterData {
     RasterData(double x_min, double y_max, double delta_x, double delta_y,
                std::size_t num_points_x, std::size_t num_points_y,
-               FT* data)
+               FT* data,
+               std::optional<FT> nodata = std::nullopt,
+               const std::uint8_t* mask = nullptr)
         : x_min(x_min), delta_x(delta_x), num_points_x(num_points_x),
           y_max(y_max), delta_y(delta_y), num_points_y(num_points_y),
-          data(data) {}
+          data(data), nodata(nodata), mask(mask) {}
 
     double x_min;
     double delta_x;
@@ -322,16 +1749,112 @@ struct RasterData {
 
     FT* data;
 
+    // Samples equal to nodata, NaN samples and samples with a zero entry in the
+    // (optional) validity mask are voids, and are left out of the triangulation
+    std::optional<FT> nodata;
+    const std::uint8_t* mask;
+
     double get_x_max() const {return x_min + (num_points_x - 1)*delta_x; }
     double get_y_min() const {return y_max - (num_points_y - 1)*delta_y; }
 
+    bool has_voids() const {
+        return nodata or mask or std::is_floating_point_v<FT>;
+    }
+
+    bool is_valid(FT value) const {
+        if constexpr (std::is_floating_point_v<FT>)
+            if (std::isnan(value))
+                return false;
+        return not (nodata and value == *nodata);
+    }
+
+    bool is_valid(std::size_t i, std::size_t j) const {
+        const std::size_t k = i*num_points_x + j;
+        return (mask == nullptr or mask[k]) and is_valid(data[k]);
+    }
+
+    // Validity of the raster sample closest to (x, y)
+    bool is_valid_at(double x, double y) const {
+        if (not has_voids())
+            return true;
+        auto [i, j] = get_nearest_indices(x, y);
+        return is_valid(i, j);
+    }
+
+    std::vector<std::uint8_t> validity_mask() const {
+        std::vector<std::uint8_t> result(num_points_x * num_points_y);
+        for (std::size_t i = 0; i < num_points_y; ++i)
+            for (std::size_t j = 0; j < num_points_x; ++j)
+                result[i*num_points_x + j] = is_valid(i, j);
+        return result;
+    }
+
+    CGAL::Point point(std::size_t i, std::size_t j) const {
+        return CGAL::Point(x_min + j*delta_x, y_max - i*delta_y, data[i*num_points_x + j]);
+    }
+
+    // Call f(i, j) for the indices of all raster points
+    template<typename F>
+    void for_each_index(F f) const {
+        for (std::size_t i = 0; i < num_points_y; ++i)
+            for (std::size_t j = 0; j < num_points_x; ++j)
+                f(i, j);
+    }
+
+    // Call f(i, j) for the indices of the raster points inside the polygon given
+    // by its scanline index, padded with a margin of one cell in each direction
+    template<typename F>
+    void for_each_index(const PolygonScanlines& scanlines, F f) const {
+        using Span = std::pair<long, long>;
+
+        // Index spans [first, last] inside the polygon along the row y, including the margin in x
+        auto row_spans = [this, &scanlines] (long i, std::vector<Span>& spans) {
+            const auto x = scanlines.crossings(y_max - i*delta_y);
+            const long last_index = static_cast<long>(num_points_x) - 1;
+            for (std::size_t k = 0; k + 1 < x.size(); k += 2) {
+                const long first = static_cast<long>(std::ceil((x[k] - x_min)/delta_x)) - 1;
+                const long last = static_cast<long>(std::floor((x[k + 1] - x_min)/delta_x)) + 1;
+                if (last < 0 or first > last_index)
+                    continue;
+                spans.emplace_back(std::max<long>(first, 0), std::min<long>(last, last_index));
+            }
+        };
+
+        std::vector<Span> spans;
+        for (long i = 0; i < static_cast<long>(num_points_y); ++i) {
+            // Merge spans from the neighbouring rows to get the margin in y
+            spans.clear();
+            for (long k = i - 1; k <= i + 1; ++k)
+                row_spans(k, spans);
+            std::sort(spans.begin(), spans.end());
+
+            long next = 0;  // First column not yet visited on this row
+            for (const auto& [first, last]: spans) {
+                for (long j = std::max(first, next); j <= last; ++j)
+                    f(static_cast<std::size_t>(i), static_cast<std::size_t>(j));
+                next = std::max(next, last + 1);
+            }
+        }
+    }
+
     CGAL::PointList raster_points() const {
         CGAL::PointList points;
         points.reserve(num_points_x * num_points_y);
+        for_each_index([this, &points] (std::size_t i, std::size_t j) {
+            if (is_valid(i, j))
+                points.push_back(point(i, j));
+        });
+        return points;
+    }
 
-        for (std::size_t i = 0; i < num_points_y; ++i)
-            for (std::size_t j = 0; j < num_points_x; ++j)
-                points.emplace_back(x_min + j*delta_x, y_max - i*delta_y, data[i*num_points_x + j]);
+    // Raster points inside the polygon given by its scanline index, padded with a
+    // margin of one cell in each direction
+    CGAL::PointList raster_points(const PolygonScanlines& scanlines) const {
+        CGAL::PointList points;
+        for_each_index(scanlines, [this, &points] (std::size_t i, std::size_t j) {
+            if (is_valid(i, j))
+                points.push_back(point(i, j));
+        });
         return points;
     }
 
@@ -343,10 +1866,24 @@ struct RasterData {
         return std::make_pair(i,j);
     }
 
-    // Interpolate data using using a bilinear interpolation rule on each cell
+    // Indices (i, j) of the raster point closest to (x, y)
+    std::pair<int, int> get_nearest_indices(double x, double y) const {
+        int i = std::min<int>(std::max<int>(static_cast<int>(std::lround((y_max-y) /delta_y)), 0), num_points_y - 1);
+        int j = std::min<int>(std::max<int>(static_cast<int>(std::lround((x-x_min) /delta_x)), 0), num_points_x - 1);
+
+        return std::make_pair(i,j);
+    }
+
+    // Interpolate data using using a bilinear interpolation rule on each cell.
+    //
+    // Void corners are left out and the weights of the remaining corners are
+    // rescaled. The result is NaN when all corners with nonzero weight are voids.
     FT get_interpolated_value_at_point(double x, double y) const {
-        // Determine indices of the cell containing (x, y)
+        // Determine indices of the cell containing (x, y). Points on the last
+        // row or column belong to the cell before it.
         auto [i, j] = get_indices(x, y);
+        i = std::max(0, std::min<int>(i, num_points_y - 2));
+        j = std::max(0, std::min<int>(j, num_points_x - 2));
 
         // Determine the cell corners
         //     (x0, y0) -- upper left
@@ -357,12 +1894,30 @@ struct RasterData {
                y_1 = y_max - (i+1) * delta_y;
 
         // Using bilinear interpolation on the celll
-        double h = data[(i + 0)*num_points_x + j + 0] * (x_1 - x)/delta_x * (y - y_1)/delta_y   // (x0, y0)
-                 + data[(i + 0)*num_points_x + j + 1] * (x - x_0)/delta_x * (y - y_1)/delta_y   // (x1, y0)
-                 + data[(i + 1)*num_points_x + j + 0] * (x_1 - x)/delta_x * (y_0 - y)/delta_y   // (x0, y1)
-                 + data[(i + 1)*num_points_x + j + 1] * (x - x_0)/delta_x * (y_0 - y)/delta_y;  // (x1, y1)
-
-        return h;
+        const std::array<std::pair<int, int>, 4> corners{{{i, j}, {i, j + 1}, {i + 1, j}, {i + 1, j + 1}}};
+        const std::array<double, 4> weights{(x_1 - x)/delta_x * (y - y_1)/delta_y,   // (x0, y0)
+                                            (x - x_0)/delta_x * (y - y_1)/delta_y,   // (x1, y0)
+                                            (x_1 - x)/delta_x * (y_0 - y)/delta_y,   // (x0, y1)
+                                            (x - x_0)/delta_x * (y_0 - y)/delta_y};  // (x1, y1)
+        double h = 0.0;
+        double total_weight = 0.0;
+        bool has_voids = false;
+        for (std::size_t k = 0; k < 4; ++k) {
+            const auto [ci, cj] = corners[k];
+            if (weights[k] == 0.0 or ci >= static_cast<int>(num_points_y) or cj >= static_cast<int>(num_points_x))
+                continue;
+            if (not is_valid(ci, cj)) {
+                has_voids = true;
+                continue;
+            }
+            h += data[ci*num_points_x + cj] * weights[k];
+            total_weight += weights[k];
+        }
+        if (not has_voids)
+            return h;
+        if (total_weight == 0.0)
+            return std::numeric_limits<FT>::quiet_NaN();
+        return h/total_weight;
     }
 
     // Boundary of the raster domain as a CGAL polygon
@@ -393,16 +1948,688 @@ struct RasterData {
         return ((x > x_min + eps) and (x < get_x_max() - eps)
                 and (y > get_y_min() + eps) and (y < y_max - eps));
     }
+
+    // Determine if a point (x, y) is inside or on the boundary of the raster domain
+    bool covers(double x, double y) const {
+        double eps = pow(pow(delta_x, 2) + pow(delta_y, 2), 0.5) * 1e-10;
+        return ((x >= x_min - eps) and (x <= get_x_max() + eps)
+                and (y >= get_y_min() - eps) and (y <= y_max + eps));
+    }
+};
+
+
+enum class RasterReduction {
+    average,  // Mean of the valid samples in the window
+    minimum,
+    maximum,
+    nearest   // The sample at the coarse raster point
+};
+
+
+// Samples of the raster coarsened by an integer factor, on the raster points
+// (x_min + k*factor*delta_x, y_max - l*factor*delta_y) in row major order, so
+// the shape is ((num_points_y - 1)/factor + 1, (num_points_x - 1)/factor + 1).
+//
+// Every coarse sample reduces the valid fine samples within factor/2 points of
+// it. Windows without valid samples give the nodata value, or NaN when the
+// raster has none.
+template<typename FT>
+std::vector<FT> downsample(const RasterData<FT>& raster, std::size_t factor, RasterReduction reduction) {
+    if (factor == 0)
+        throw std::invalid_argument("Downsampling factor must be positive.");
+    const std::size_t m = (raster.num_points_y - 1)/factor + 1, n = (raster.num_points_x - 1)/factor + 1;
+    const std::size_t half = factor/2;
+    const FT void_value = raster.nodata ? *raster.nodata : std::numeric_limits<FT>::quiet_NaN();
+
+    std::vector<FT> result(m*n);
+    parallel_for(m, [&] (std::size_t k) {
+        const std::size_t i = k*factor;
+        const std::size_t i_0 = i - std::min(i, half), i_1 = std::min(i + half + 1, raster.num_points_y);
+        for (std::size_t l = 0; l < n; ++l) {
+            const std::size_t j = l*factor;
+            FT& value = result[k*n + l];
+            if (reduction == RasterReduction::nearest) {
+                value = raster.is_valid(i, j) ? raster.data[i*raster.num_points_x + j] : void_value;
+                continue;
+            }
+
+            const std::size_t j_0 = j - std::min(j, half), j_1 = std::min(j + half + 1, raster.num_points_x);
+            double sum = 0.0;
+            std::size_t count = 0;
+            FT low = std::numeric_limits<FT>::max(), high = std::numeric_limits<FT>::lowest();
+            for (std::size_t ii = i_0; ii < i_1; ++ii)
+                for (std::size_t jj = j_0; jj < j_1; ++jj) {
+                    if (not raster.is_valid(ii, jj))
+                        continue;
+                    const FT v = raster.data[ii*raster.num_points_x + jj];
+                    sum += v;
+                    low = std::min(low, v);
+                    high = std::max(high, v);
+                    ++count;
+                }
+            if (count == 0)
+                value = void_value;
+            else if (reduction == RasterReduction::minimum)
+                value = low;
+            else if (reduction == RasterReduction::maximum)
+                value = high;
+            else
+                value = static_cast<FT>(sum/count);
+        }
+    });
+    return result;
+}
+
+
+enum class SamplingPolicy {nearest, bilinear, bicubic};
+
+
+// Heights of the raster at the n points xy = (x_0, y_0, x_1, y_1, ...), and
+// their gradients (dz/dx, dz/dy) when gradients is not null. Points are
+// sampled in parallel chunks.
+//
+// Points outside of the raster give NaN. Bilinear heights follow
+// get_interpolated_value_at_point, with void corners left out. Bicubic
+// heights use the Catmull-Rom spline through the surrounding 4x4 points,
+// extrapolated linearly at the raster edges, and fall back to bilinear next
+// to voids.
+// Gradients are NaN in cells with voids, and zero for nearest sampling.
+template<typename FT>
+void sample_raster(const RasterData<FT>& raster, const double* xy, std::size_t n, SamplingPolicy policy,
+                   double* heights, double* gradients = nullptr) {
+    constexpr std::size_t chunk_size = 1 << 12;
+    constexpr double nan = std::numeric_limits<double>::quiet_NaN();
+    const long nx = raster.num_points_x, ny = raster.num_points_y;
+    const double inv_dx = 1.0/raster.delta_x, inv_dy = 1.0/raster.delta_y;
+    const double eps = std::hypot(raster.delta_x, raster.delta_y)*1e-10;
+    const double x_max = raster.get_x_max() + eps, y_min = raster.get_y_min() - eps;
+    const bool has_voids = raster.has_voids();
+
+    auto valid = [&] (long i, long j) {return not has_voids or raster.is_valid(i, j); };
+    auto z = [&] (long i, long j) -> double {return raster.data[i*nx + j]; };
+
+    // Bilinear height and gradient with respect to (u, v) in the cell (i, j)
+    auto bilinear = [&] (long i, long j, double t, double s, double& h, double& dt, double& ds) {
+        const std::array<double, 4> w{(1 - t)*(1 - s), t*(1 - s), (1 - t)*s, t*s};
+        double sum = 0.0, total_weight = 0.0;
+        bool complete = true, voids = false;
+        for (int c = 0; c < 4; ++c) {
+            const long ci = i + c/2, cj = j + c%2;
+            if (ci >= ny or cj >= nx) {
+                complete = false;
+                continue;
+            }
+            if (not valid(ci, cj)) {
+                complete = false;
+                voids = voids or w[c] != 0.0;
+                continue;
+            }
+            sum += w[c]*z(ci, cj);
+            total_weight += w[c];
+        }
+        h = not voids ? sum : total_weight > 0.0 ? sum/total_weight : nan;
+        if (complete) {
+            dt = (1 - s)*(z(i, j + 1) - z(i, j)) + s*(z(i + 1, j + 1) - z(i + 1, j));
+            ds = (1 - t)*(z(i + 1, j) - z(i, j)) + t*(z(i + 1, j + 1) - z(i, j + 1));
+        } else {
+            dt = ds = nan;
+        }
+    };
+
+    // Catmull-Rom weights of the points at offsets -1, 0, 1, 2 and their derivatives
+    auto cubic = [] (double t, std::array<double, 4>& w, std::array<double, 4>& dw) {
+        const double t2 = t*t, t3 = t2*t;
+        w = {(-t3 + 2*t2 - t)/2, (3*t3 - 5*t2 + 2)/2, (-3*t3 + 4*t2 + t)/2, (t3 - t2)/2};
+        dw = {(-3*t2 + 4*t - 1)/2, (9*t2 - 10*t)/2, (-9*t2 + 8*t + 1)/2, (3*t2 - 2*t)/2};
+    };
+
+    parallel_for((n + chunk_size - 1)/chunk_size, [&] (std::size_t chunk) {
+        const std::size_t end = std::min(n, (chunk + 1)*chunk_size);
+        for (std::size_t k = chunk*chunk_size; k < end; ++k) {
+            const double x = xy[2*k], y = xy[2*k + 1];
+            double h = nan, dt = nan, ds = nan;
+            if (x >= raster.x_min - eps and x <= x_max and y >= y_min and y <= raster.y_max + eps) {
+                const double u = (x - raster.x_min)*inv_dx, v = (raster.y_max - y)*inv_dy;
+                if (policy == SamplingPolicy::nearest) {
+                    const long i = std::clamp<long>(std::lround(v), 0, ny - 1);
+                    const long j = std::clamp<long>(std::lround(u), 0, nx - 1);
+                    h = valid(i, j) ? z(i, j) : nan;
+                    dt = ds = 0.0;
+                } else {
+                    // Points on the last row or column belong to the cell before it
+                    const long i = std::clamp<long>(static_cast<long>(std::floor(v)), 0, std::max(ny - 2, 0L));
+                    const long j = std::clamp<long>(static_cast<long>(std::floor(u)), 0, std::max(nx - 2, 0L));
+                    const double t = u - j, s = v - i;
+                    bool smooth = policy == SamplingPolicy::bicubic and nx > 1 and ny > 1;
+                    const long a_0 = i == 0, a_1 = i + 2 < ny ? 4 : 3;
+                    const long b_0 = j == 0, b_1 = j + 2 < nx ? 4 : 3;
+                    for (long a = a_0; a < a_1 and smooth; ++a)
+                        for (long b = b_0; b < b_1 and smooth; ++b)
+                            smooth = valid(i - 1 + a, j - 1 + b);
+
+                    if (smooth) {
+                        // Points beyond the raster edges are extrapolated linearly
+                        std::array<std::array<double, 4>, 4> values;
+                        for (long a = a_0; a < a_1; ++a) {
+                            for (long b = b_0; b < b_1; ++b)
+                                values[a][b] = z(i - 1 + a, j - 1 + b);
+                            if (b_0)
+                                values[a][0] = 2*values[a][1] - values[a][2];
+                            if (b_1 < 4)
+                                values[a][3] = 2*values[a][2] - values[a][1];
+                        }
+                        for (int b = 0; b < 4; ++b) {
+                            if (a_0)
+                                values[0][b] = 2*values[1][b] - values[2][b];
+                            if (a_1 < 4)
+                                values[3][b] = 2*values[2][b] - values[1][b];
+                        }
+
+                        std::array<double, 4> wt, dwt, ws, dws;
+                        cubic(t, wt, dwt);
+                        cubic(s, ws, dws);
+                        h = dt = ds = 0.0;
+                        for (int a = 0; a < 4; ++a)
+                            for (int b = 0; b < 4; ++b) {
+                                h += ws[a]*wt[b]*values[a][b];
+                                dt += ws[a]*dwt[b]*values[a][b];
+                                ds += dws[a]*wt[b]*values[a][b];
+                            }
+                    } else {
+                        bilinear(i, j, t, s, h, dt, ds);
+                    }
+                }
+            }
+            heights[k] = h;
+            if (gradients) {
+                gradients[2*k] = dt*inv_dx;
+                gradients[2*k + 1] = -ds*inv_dy;
+            }
+        }
+    });
+}
+
+
+// Regular grid of points with the layout of RasterData
+struct RasterGrid {
+    double x_min, y_max, delta_x, delta_y;
+    std::size_t num_points_x, num_points_y;
+};
+
+// Samples of the source rasters, each in the coordinate system of its proj4 definition, at the
+// points of the target grid, row by row. Earlier sources take priority, and points outside of or
+// in voids of all the sources are NaN, so sources in different coordinate systems mosaic in one
+// pass.
+//
+// Only control points every step points along the rows and columns of the grid, and the last
+// ones, are transformed exactly to each source coordinate system. The source coordinates in
+// between are interpolated bilinearly, which is accurate to far below a raster spacing for
+// steps of a few dozen points between projected coordinate systems.
+template<typename FT>
+std::vector<FT> warp_rasters(const std::vector<RasterData<FT>>& sources,
+                             const std::vector<std::string>& source_proj4s,
+                             const std::string& target_proj4,
+                             const RasterGrid& grid,
+                             SamplingPolicy policy,
+                             std::size_t step = 16) {
+    if (sources.size() != source_proj4s.size())
+        throw std::invalid_argument("Every source raster needs a coordinate system.");
+    if (step == 0)
+        throw std::invalid_argument("Control point step must be positive.");
+    const std::size_t nx = grid.num_points_x, ny = grid.num_points_y;
+    std::vector<FT> result(nx*ny, std::numeric_limits<FT>::quiet_NaN());
+    if (result.empty())
+        return result;
+
+    // Control point k along a direction with n points, and the interval holding point v
+    auto controls = [step] (std::size_t n) {return n < 2 ? std::size_t(1) : (n - 2)/step + 2; };
+    auto control = [step] (std::size_t k, std::size_t n) {return std::min(k*step, n - 1); };
+    auto interval = [&] (std::size_t v, std::size_t n) -> std::pair<std::size_t, double> {
+        if (n < 2)
+            return {0, 0.0};
+        const std::size_t k = std::min(v/step, controls(n) - 2);
+        const double c0 = control(k, n), c1 = control(k + 1, n);
+        return {k, (v - c0)/(c1 - c0)};
+    };
+    const std::size_t cx = controls(nx), cy = controls(ny);
+
+    // Control points in each distinct source coordinate system
+    std::map<std::string, point3_vector> control_points;
+    for (const auto& proj4_str: source_proj4s) {
+        if (control_points.count(proj4_str))
+            continue;
+        point3_vector points(cx*cy);
+        for (std::size_t ki = 0; ki < cy; ++ki)
+            for (std::size_t kj = 0; kj < cx; ++kj)
+                points[ki*cx + kj] = point3{grid.x_min + control(kj, nx)*grid.delta_x,
+                                            grid.y_max - control(ki, ny)*grid.delta_y, 0.0};
+        if (proj4_str != target_proj4)
+            transform_points(target_proj4, proj4_str, points.data(), points.size());
+        control_points.emplace(proj4_str, std::move(points));
+    }
+
+    // Blocks of rows, so the source coordinates of the points still to fill stay small
+    const std::size_t block_rows = std::max<std::size_t>(1, (std::size_t(1) << 20)/nx);
+    constexpr std::size_t chunk_size = 4096;
+    std::vector<std::size_t> pending;
+    std::vector<double> xy, heights;
+    for (std::size_t row0 = 0; row0 < ny; row0 += block_rows) {
+        const std::size_t row1 = std::min(ny, row0 + block_rows);
+        for (std::size_t s = 0; s < sources.size(); ++s) {
+            const auto& source = sources[s];
+            const auto& points = control_points.at(source_proj4s[s]);
+
+            // Skip sources whose footprint misses the control points around the block
+            const std::size_t k0 = interval(row0, ny).first, k1 = std::min(cy - 1, interval(row1 - 1, ny).first + 1);
+            double x_lo = std::numeric_limits<double>::max(), x_hi = std::numeric_limits<double>::lowest();
+            double y_lo = x_lo, y_hi = x_hi;
+            for (std::size_t ki = k0; ki <= k1; ++ki)
+                for (std::size_t kj = 0; kj < cx; ++kj) {
+                    const auto& p = points[ki*cx + kj];
+                    x_lo = std::min(x_lo, p[0]);
+                    x_hi = std::max(x_hi, p[0]);
+                    y_lo = std::min(y_lo, p[1]);
+                    y_hi = std::max(y_hi, p[1]);
+                }
+            const double margin = std::max(source.delta_x, source.delta_y);
+            if (x_hi + margin < source.x_min or x_lo - margin > source.get_x_max()
+                or y_hi + margin < source.get_y_min() or y_lo - margin > source.y_max)
+                continue;
+
+            pending.clear();
+            for (std::size_t k = row0*nx; k < row1*nx; ++k)
+                if (std::isnan(result[k]))
+                    pending.push_back(k);
+            if (pending.empty())
+                break;
+
+            xy.resize(2*pending.size());
+            heights.resize(pending.size());
+            parallel_for((pending.size() + chunk_size - 1)/chunk_size, [&] (std::size_t chunk) {
+                for (std::size_t p = chunk*chunk_size; p < std::min(pending.size(), (chunk + 1)*chunk_size); ++p) {
+                    const auto [ki, t] = interval(pending[p]/nx, ny);
+                    const auto [kj, u] = interval(pending[p]%nx, nx);
+                    const std::size_t ki1 = std::min(ki + 1, cy - 1), kj1 = std::min(kj + 1, cx - 1);
+                    for (int d = 0; d < 2; ++d)
+                        xy[2*p + d] = (1 - t)*((1 - u)*points[ki*cx + kj][d] + u*points[ki*cx + kj1][d])
+                                      + t*((1 - u)*points[ki1*cx + kj][d] + u*points[ki1*cx + kj1][d]);
+                }
+            });
+            sample_raster(source, xy.data(), pending.size(), policy, heights.data());
+            for (std::size_t p = 0; p < pending.size(); ++p)
+                if (not std::isnan(heights[p]))
+                    result[pending[p]] = FT(heights[p]);
+        }
+    }
+    return result;
+}
+
+
+enum class MosaicPolicy {
+    priority,  // In overlaps, the first raster in the list with data wins
+    blend      // Overlapping rasters are averaged, weighted by the distance to their borders
+};
+
+
+// A virtual raster made from a list of (possibly overlapping) rasters.
+//
+// The mosaic only refers to the raster list, which must outlive it, and no
+// raster data is copied. Every location is sampled from the rasters covering
+// it according to the policy, and raster points are deduplicated: a point is
+// only emitted by the first raster in the list that covers it and has data
+// there, so shared edge rows and overlaps yield each location once.
+//
+// Abutting GeoTIFF tiles do not share samples, and leave a gap of one cell
+// between the last sample of a tile and the first of the next. A raster with
+// a neighbour within one cell spacing to its right or below is extended across
+// the gap, and interpolated there from its edge samples and the neighbour's.
+//
+// The mosaic has the same interface as RasterData for the meshing functions.
+template<typename FT>
+class RasterMosaic {
+  public:
+    RasterMosaic(const std::vector<RasterData<FT>>& rasters, MosaicPolicy policy = MosaicPolicy::priority)
+        : rasters(rasters), policy(policy) {
+        if (rasters.empty())
+            throw std::invalid_argument("Raster mosaic needs at least one raster.");
+
+        x_min = rasters.front().x_min;
+        y_max = rasters.front().y_max;
+        x_max = rasters.front().get_x_max();
+        y_min = rasters.front().get_y_min();
+        delta_x = rasters.front().delta_x;
+        delta_y = rasters.front().delta_y;
+        double bucket_size = 0.0;
+        for (const auto& raster: rasters) {
+            x_min = std::min(x_min, raster.x_min);
+            y_max = std::max(y_max, raster.y_max);
+            x_max = std::max(x_max, raster.get_x_max());
+            y_min = std::min(y_min, raster.get_y_min());
+            delta_x = std::min(delta_x, raster.delta_x);
+            delta_y = std::min(delta_y, raster.delta_y);
+            bucket_size = std::max({bucket_size,
+                                    raster.get_x_max() - raster.x_min,
+                                    raster.y_max - raster.get_y_min()});
+        }
+        // Rasters that should share an edge rarely agree to the last bit
+        tolerance = std::hypot(delta_x, delta_y)*1e-8;
+        find_gaps();
+        build_buckets(bucket_size);
+    }
+
+    // Bounding box and finest resolution of the rasters
+    double x_min, x_max;
+    double y_min, y_max;
+    double delta_x, delta_y;
+
+    const std::vector<RasterData<FT>>& get_rasters() const { return rasters; }
+    MosaicPolicy get_policy() const { return policy; }
+
+    CGAL::PointList raster_points() const {
+        CGAL::PointList points;
+        for (std::size_t k = 0; k < rasters.size(); ++k)
+            rasters[k].for_each_index([this, k, &points] (std::size_t i, std::size_t j) {
+                add_point(k, i, j, points);
+            });
+        return points;
+    }
+
+    CGAL::PointList raster_points(const PolygonScanlines& scanlines) const {
+        CGAL::PointList points;
+        for (std::size_t k = 0; k < rasters.size(); ++k)
+            rasters[k].for_each_index(scanlines, [this, k, &points] (std::size_t i, std::size_t j) {
+                add_point(k, i, j, points);
+            });
+        return points;
+    }
+
+    // Height at (x, y) according to the policy, NaN where no raster has data
+    FT get_interpolated_value_at_point(double x, double y) const {
+        double h = 0.0, total_weight = 0.0;
+        for (auto k: candidates(x, y)) {
+            const auto& raster = rasters[k];
+            if (not covers(k, x, y))
+                continue;
+            const FT value = sample(k, x, y);
+            if (std::isnan(value))
+                continue;
+            if (policy == MosaicPolicy::priority)
+                return value;
+            const double weight = blend_weight(raster, x, y);
+            h += weight*value;
+            total_weight += weight;
+        }
+        if (total_weight == 0.0)
+            return std::numeric_limits<FT>::quiet_NaN();
+        return h/total_weight;
+    }
+
+    // A point has data if it is not closest to a void in at least one of the rasters covering it,
+    // or if it is in the gap after a raster and can be interpolated there
+    bool is_valid_at(double x, double y) const {
+        for (auto k: candidates(x, y)) {
+            if (in_extent(rasters[k], x, y)) {
+                if (rasters[k].is_valid_at(x, y))
+                    return true;
+            } else if (covers(k, x, y) and not std::isnan(sample(k, x, y))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Determine if a point (x, y) is strictly inside the union of the raster domains
+    bool contains(double x, double y) const {
+        const double d = 2*tolerance;
+        const std::array<std::pair<double, double>, 4> offsets{{{-d, -d}, {d, -d}, {d, d}, {-d, d}}};
+        for (const auto& offset: offsets) {
+            const double u = x + offset.first, v = y + offset.second;
+            const auto& bucket = candidates(u, v);
+            if (std::none_of(bucket.begin(), bucket.end(),
+                             [this, u, v] (std::size_t k) {return covers(k, u, v);}))
+                return false;
+        }
+        return true;
+    }
+
+    // Union of the raster domains, with rasters within one cell of each other joined
+    CGAL::MultiPolygon exterior() const {
+        CGAL::MultiPolygon result;
+        domain().polygons_with_holes(std::back_inserter(result));
+        return result;
+    }
+
+    template<typename P>
+    CGAL::MultiPolygon compute_intersection(const P& polygon) const {
+        auto set = domain();
+        set.intersection(polygon);
+
+        CGAL::MultiPolygon intersection_polygon;
+        set.polygons_with_holes(std::back_inserter(intersection_polygon));
+        return intersection_polygon;
+    }
+
+  private:
+    const std::vector<RasterData<FT>>& rasters;
+    MosaicPolicy policy;
+    double tolerance;
+
+    // Width of the gap to the neighbouring raster to the right of and below each raster, or zero
+    std::vector<std::array<double, 2>> gaps;
+
+    // Uniform grid over the bounding box, no finer than the largest raster, listing the
+    // rasters intersecting each bucket in list order
+    double bucket_dx, bucket_dy;
+    std::size_t num_buckets_x, num_buckets_y;
+    std::vector<std::vector<std::size_t>> buckets;
+    std::vector<std::size_t> no_rasters;
+
+    bool in_extent(const RasterData<FT>& raster, double x, double y) const {
+        return ((x >= raster.x_min - tolerance) and (x <= raster.get_x_max() + tolerance)
+                and (y >= raster.get_y_min() - tolerance) and (y <= raster.y_max + tolerance));
+    }
+
+    // Extent of raster k including the gaps after it
+    bool covers(std::size_t k, double x, double y) const {
+        const auto& raster = rasters[k];
+        return ((x >= raster.x_min - tolerance) and (x <= raster.get_x_max() + gaps[k][0] + tolerance)
+                and (y >= raster.get_y_min() - gaps[k][1] - tolerance) and (y <= raster.y_max + tolerance));
+    }
+
+    // Neighbours more than the tolerance but at most a cell spacing away, overlapping along the edge
+    void find_gaps() {
+        gaps.assign(rasters.size(), {0.0, 0.0});
+        for (std::size_t k = 0; k < rasters.size(); ++k) {
+            const auto& raster = rasters[k];
+            for (std::size_t q = 0; q < rasters.size(); ++q) {
+                const auto& other = rasters[q];
+                const double gap_x = other.x_min - raster.get_x_max();
+                if (gap_x > tolerance and gap_x <= raster.delta_x + tolerance
+                    and other.get_y_min() < raster.y_max and other.y_max > raster.get_y_min())
+                    gaps[k][0] = gaps[k][0] > 0.0 ? std::min(gaps[k][0], gap_x) : gap_x;
+                const double gap_y = raster.get_y_min() - other.y_max;
+                if (gap_y > tolerance and gap_y <= raster.delta_y + tolerance
+                    and other.x_min < raster.get_x_max() and other.get_x_max() > raster.x_min)
+                    gaps[k][1] = gaps[k][1] > 0.0 ? std::min(gaps[k][1], gap_y) : gap_y;
+            }
+        }
+    }
+
+    // Height of raster k at (x, y), also in the gaps after it. A gap cell is interpolated bilinearly from
+    // the edge samples of the raster and the samples of the rasters on the other side, with voids left
+    // out as in RasterData::get_interpolated_value_at_point.
+    FT sample(std::size_t k, double x, double y) const {
+        const auto& raster = rasters[k];
+        if (in_extent(raster, x, y))
+            return raster.get_interpolated_value_at_point(x, y);
+
+        // Cell [t0, t1] along an axis, as offsets from the first sample, either of the raster or the gap
+        auto cell = [] (double t, double dt, std::size_t n, double gap) {
+            const double t_last = (n - 1)*dt;
+            if (t > t_last)
+                return std::make_pair(t_last, t_last + gap);
+            const double j = std::min(std::floor(std::max(t, 0.0)/dt), n > 1 ? double(n - 2) : 0.0);
+            return std::make_pair(j*dt, (j + 1)*dt);
+        };
+        const auto [u0, u1] = cell(x - raster.x_min, raster.delta_x, raster.num_points_x, gaps[k][0]);
+        const auto [v0, v1] = cell(raster.y_max - y, raster.delta_y, raster.num_points_y, gaps[k][1]);
+        const double a = (x - raster.x_min - u0)/(u1 - u0), b = (raster.y_max - y - v0)/(v1 - v0);
+
+        double h = 0.0, total_weight = 0.0;
+        bool has_voids = false;
+        for (const auto& [u, v, weight]: {std::tuple{u0, v0, (1 - a)*(1 - b)}, std::tuple{u1, v0, a*(1 - b)},
+                                          std::tuple{u0, v1, (1 - a)*b}, std::tuple{u1, v1, a*b}}) {
+            if (weight == 0.0)
+                continue;
+            const double cx = raster.x_min + u, cy = raster.y_max - v;
+            const FT value = in_extent(raster, cx, cy) ? raster.get_interpolated_value_at_point(cx, cy)
+                                                       : neighbour_value(k, cx, cy);
+            if (std::isnan(value)) {
+                has_voids = true;
+                continue;
+            }
+            h += weight*value;
+            total_weight += weight;
+        }
+        if (total_weight == 0.0)
+            return std::numeric_limits<FT>::quiet_NaN();
+        return has_voids ? h/total_weight : h;
+    }
+
+    // Height at (x, y) from the first raster other than k with data there, or NaN
+    FT neighbour_value(std::size_t k, double x, double y) const {
+        for (auto q: candidates(x, y)) {
+            if (q == k or not in_extent(rasters[q], x, y))
+                continue;
+            const FT value = rasters[q].get_interpolated_value_at_point(x, y);
+            if (not std::isnan(value))
+                return value;
+        }
+        return std::numeric_limits<FT>::quiet_NaN();
+    }
+
+    // Weight of a raster in a blend, the distance in cells to its border. The weights fade
+    // out towards the borders, and are equal for rasters meeting at a shared edge.
+    static double blend_weight(const RasterData<FT>& raster, double x, double y) {
+        return std::max(1e-6, std::min({(x - raster.x_min)/raster.delta_x,
+                                       (raster.get_x_max() - x)/raster.delta_x,
+                                       (y - raster.get_y_min())/raster.delta_y,
+                                       (raster.y_max - y)/raster.delta_y}));
+    }
+
+    void build_buckets(double bucket_size) {
+        bucket_dx = bucket_dy = std::max(bucket_size, tolerance);
+        num_buckets_x = static_cast<std::size_t>((x_max - x_min)/bucket_dx) + 1;
+        num_buckets_y = static_cast<std::size_t>((y_max - y_min)/bucket_dy) + 1;
+        buckets.resize(num_buckets_x*num_buckets_y);
+
+        auto bucket_index = [this] (double v, double v_min, double dv, std::size_t n) {
+            const double b = std::floor((v - v_min)/dv);
+            return static_cast<std::size_t>(std::min(std::max(b, 0.0), static_cast<double>(n - 1)));
+        };
+        for (std::size_t k = 0; k < rasters.size(); ++k) {
+            const auto& raster = rasters[k];
+            const auto bx0 = bucket_index(raster.x_min - tolerance, x_min, bucket_dx, num_buckets_x);
+            const auto bx1 = bucket_index(raster.get_x_max() + gaps[k][0] + tolerance, x_min, bucket_dx, num_buckets_x);
+            const auto by0 = bucket_index(raster.get_y_min() - gaps[k][1] - tolerance, y_min, bucket_dy, num_buckets_y);
+            const auto by1 = bucket_index(raster.y_max + tolerance, y_min, bucket_dy, num_buckets_y);
+            for (auto by = by0; by <= by1; ++by)
+                for (auto bx = bx0; bx <= bx1; ++bx)
+                    buckets[by*num_buckets_x + bx].push_back(k);
+        }
+    }
+
+    // Rasters that may cover (x, y), in list order
+    const std::vector<std::size_t>& candidates(double x, double y) const {
+        if (x < x_min - tolerance or x > x_max + tolerance or y < y_min - tolerance or y > y_max + tolerance)
+            return no_rasters;
+        const auto bx = std::min(static_cast<std::size_t>(std::max(0.0, (x - x_min)/bucket_dx)), num_buckets_x - 1);
+        const auto by = std::min(static_cast<std::size_t>(std::max(0.0, (y - y_min)/bucket_dy)), num_buckets_y - 1);
+        return buckets[by*num_buckets_x + bx];
+    }
+
+    // Add point (i, j) of raster k unless a raster before it in the list has data there
+    void add_point(std::size_t k, std::size_t i, std::size_t j, CGAL::PointList& points) const {
+        const auto& raster = rasters[k];
+        if (not raster.is_valid(i, j))
+            return;
+        const double x = raster.x_min + j*raster.delta_x;
+        const double y = raster.y_max - i*raster.delta_y;
+
+        bool overlapped = false;
+        for (auto q: candidates(x, y)) {
+            if (q == k or not in_extent(rasters[q], x, y))
+                continue;
+            if (q < k and rasters[q].is_valid_at(x, y))
+                return;
+            overlapped = true;
+        }
+        if (overlapped and policy == MosaicPolicy::blend)
+            points.emplace_back(x, y, get_interpolated_value_at_point(x, y));
+        else
+            points.push_back(raster.point(i, j));
+    }
+
+    CGAL::Polygon_set_2<CGAL::K> domain() const {
+        CGAL::Polygon_set_2<CGAL::K> set;
+        for (std::size_t k = 0; k < rasters.size(); ++k) {
+            const auto& raster = rasters[k];
+            const double x_max = raster.get_x_max() + gaps[k][0], y_min = raster.get_y_min() - gaps[k][1];
+            CGAL::SimplePolygon rectangle;
+            rectangle.push_back(CGAL::Point2(raster.x_min - tolerance, y_min - tolerance));
+            rectangle.push_back(CGAL::Point2(x_max + tolerance, y_min - tolerance));
+            rectangle.push_back(CGAL::Point2(x_max + tolerance, raster.y_max + tolerance));
+            rectangle.push_back(CGAL::Point2(raster.x_min - tolerance, raster.y_max + tolerance));
+            set.join(rectangle);
+        }
+        return set;
+    }
 };
 
-template<typename T, typename P>
-CGAL::DelaunayConstraints interpolate_boundary_points(const RasterData<T>& raster,
+
+// Sample the segment from a to b with approximately the same resolution as the raster, taking heights
+// from the raster. The samples are split into point sequences where is_inside fails or the raster has
+// no data, and sequences of at least two points are added to constraints.
+template<typename R, typename F>
+void drape_segment(const R& raster,
+                   const CGAL::Point2& a,
+                   const CGAL::Point2& b,
+                   F is_inside,
+                   CGAL::DelaunayConstraints& constraints) {
+    double edge_len_x = b.x() - a.x();
+    double edge_len_y = b.y() - a.y();
+    std::size_t num_subedges = static_cast<int>(std::max<double>(std::fabs(edge_len_x/raster.delta_x),
+                                                                 std::fabs(edge_len_y/raster.delta_y)));
+    num_subedges = std::max<int>(1, num_subedges);
+
+    double edge_dx = edge_len_x / num_subedges; // signed distance
+    double edge_dy = edge_len_y / num_subedges;
+
+    CGAL::PointSequence points_on_edge;
+    for (std::size_t k=0; k < num_subedges + 1; ++k) {
+        double x = a.x() + k * edge_dx;
+        double y = a.y() + k * edge_dy;
+        double z = is_inside(x, y) ? raster.get_interpolated_value_at_point(x, y) : std::nan("");
+        if (std::isnan(z) or not raster.is_valid_at(x, y)) {
+            if (points_on_edge.size() > 1)
+                constraints.push_back(std::move(points_on_edge));
+            points_on_edge.clear();
+            continue;
+        }
+        points_on_edge.emplace_back(x, y, z);
+    }
+    if (points_on_edge.size() > 1)
+        constraints.push_back(std::move(points_on_edge));
+}
+
+
+template<typename R, typename P>
+CGAL::DelaunayConstraints interpolate_boundary_points(const R& raster,
                                                       const P& boundary_polygon) {
     // First we need to determine intersection points between the raster domain and the polygon
     CGAL::MultiPolygon intersection_polygon = raster.compute_intersection(boundary_polygon);
 
     // Iterate over edges of the intersection polygon and interpolate points
-    // TODO: Handle holes. Only needed if the intersecting polygon has holes.
     CGAL::DelaunayConstraints interpolated_points;
     for (const auto& part : CGAL::extract_boundaries(intersection_polygon)) {
         for (auto e = part.edges_begin(); e != part.edges_end(); ++e) {
@@ -417,36 +2644,46 @@ CGAL::DelaunayConstraints interpolate_boundary_points(const RasterData<T>& raste
                 continue;
             }
 
-            // Sample with the approximately the same resolution as the raster data along the boundary edges
-            double edge_len_x = second_vertex.x() - first_vertex.x();
-            double edge_len_y = second_vertex.y() - first_vertex.y();
-            std::size_t num_subedges = static_cast<int>(std::max<double>(std::fabs(edge_len_x/raster.delta_x),
-                                                                         std::fabs(edge_len_y/raster.delta_y)));
-            num_subedges = std::max<int>(1, num_subedges);
-
-            double edge_dx = edge_len_x / num_subedges; // signed distance
-            double edge_dy = edge_len_y / num_subedges;
-
-            // Iterate over edge samples
-            std::vector<CGAL::Point> interpolated_points_on_edge;
-            for (std::size_t k=0; k < num_subedges + 1; ++k) {
-                double x = first_vertex.x() + k * edge_dx;
-                double y = first_vertex.y() + k * edge_dy;
-                double z = raster.get_interpolated_value_at_point(x, y);
-                interpolated_points_on_edge.emplace_back(x, y, z);
-            }
-            interpolated_points.push_back(std::move(interpolated_points_on_edge));
+            // Split the edge where it crosses voids in the raster
+            drape_segment(raster, first_vertex, second_vertex,
+                          [] (double, double) {return true;}, interpolated_points);
         }
     }
     return interpolated_points;
 }
 
 
-template<typename Pgn>
-Mesh make_mesh(const CGAL::PointList &pts,
-               const Pgn& inclusion_polygon,
-               const CGAL::DelaunayConstraints &constraints,
-               const std::string proj4_str) {
+// Break lines, like shorelines and roads, given as the boundaries of polygons, draped onto the raster.
+//
+// Only the parts of the break lines strictly inside the domain given by its scanline index are kept, so
+// that they do not interfere with the boundary constraints.
+template<typename R>
+CGAL::DelaunayConstraints interpolate_break_lines(const R& raster,
+                                                  const CGAL::MultiPolygon& break_lines,
+                                                  const PolygonScanlines& scanlines) {
+    CGAL::DelaunayConstraints interpolated_points;
+    const double margin = 0.5*std::min(raster.delta_x, raster.delta_y);
+    auto is_inside = [&raster, &scanlines, margin] (double x, double y) {
+        // Samples too close to the domain boundary are left out
+        return (scanlines.contains(x, y) and raster.contains(x, y)
+                and scanlines.contains(x - margin, y) and scanlines.contains(x + margin, y)
+                and scanlines.contains(x, y - margin) and scanlines.contains(x, y + margin));
+    };
+    for (const auto& line : CGAL::extract_boundaries(break_lines))
+        for (auto e = line.edges_begin(); e != line.edges_end(); ++e)
+            drape_segment(raster, e->vertex(0), e->vertex(1), is_inside, interpolated_points);
+    return interpolated_points;
+}
+
+
+// Constrained Delaunay triangulation of the points, keeping the faces with midpoint accepted by is_inside.
+//
+// Constrained edges in the interior of the mesh are marked in the "e:constrained" edge property, and are
+// kept by Mesh::coarsen. On the mesh border the constraints are implied.
+template<typename F>
+CGAL::Mesh triangulate(const CGAL::PointList &pts,
+                       const CGAL::DelaunayConstraints &constraints,
+                       F is_inside) {
 
     CGAL::ConstrainedDelaunay dtin;
     for (const auto p: pts)
@@ -466,6 +2703,7 @@ Mesh make_mesh(const CGAL::PointList &pts,
         return iter->second;
     };
 
+    std::vector<std::pair<CGAL::VertexIndex, CGAL::VertexIndex>> constrained_edges;
     for (auto f = dtin.finite_faces_begin(); f != dtin.finite_faces_end(); ++f) {
         CGAL::Point u = f->vertex(0)->point();
         CGAL::Point v = f->vertex(1)->point();
@@ -474,12 +2712,43 @@ Mesh make_mesh(const CGAL::PointList &pts,
         // Add face if midpoint is contained
         CGAL::Point2 face_midpoint(u.x()/3 + v.x()/3 + w.x()/3,
                                    u.y()/3 + v.y()/3 + w.y()/3);
-        if (CGAL::point_inside_polygon(face_midpoint, inclusion_polygon)) {
+        if (is_inside(face_midpoint)) {
             mesh.add_face(index(u), index(v), index(w));
+            for (int i = 0; i < 3; ++i)
+                if (f->is_constrained(i))
+                    constrained_edges.emplace_back(index(f->vertex(dtin.ccw(i))->point()),
+                                                   index(f->vertex(dtin.cw(i))->point()));
         }
     }
     pvm.clear();
-    return Mesh(mesh, proj4_str);
+
+    std::optional<CGAL::Mesh::Property_map<CGAL::EdgeIndex, bool>> constrained;
+    for (const auto& [u, v]: constrained_edges) {
+        // The face of a constrained edge may not have been added to the mesh
+        const auto h = mesh.halfedge(u, v);
+        if (h == CGAL::Mesh::null_halfedge())
+            continue;
+        const auto e = mesh.edge(h);
+        if (mesh.is_border(e))
+            continue;
+        if (not constrained)
+            constrained = mesh.add_property_map<CGAL::EdgeIndex, bool>("e:constrained", false).first;
+        (*constrained)[e] = true;
+    }
+    return mesh;
+};
+
+
+template<typename Pgn>
+Mesh make_mesh(const CGAL::PointList &pts,
+               const Pgn& inclusion_polygon,
+               const CGAL::DelaunayConstraints &constraints,
+               const std::string proj4_str) {
+    return Mesh(triangulate(pts, constraints,
+                            [&inclusion_polygon] (const CGAL::Point2& x) {
+                                return CGAL::point_inside_polygon(x, inclusion_polygon);
+                            }),
+                proj4_str);
 };
 
 
@@ -505,57 +2774,145 @@ Mesh make_mesh(const CGAL::PointList &pts,  const std::string proj4_str) {
     }
     pvm.clear();
 
-    return Mesh(mesh, proj4_str);
+    return Mesh(std::move(mesh), proj4_str);
 };
 
 
-template<typename T, typename Pgn>
-Mesh mesh_from_raster(const std::vector<RasterData<T>>& raster_list,
-                      const Pgn& boundary_polygon,
-                      const std::string proj4_str) {
-    CGAL::PointList raster_points;
-    CGAL::DelaunayConstraints boundary_points;
-    for (auto raster : raster_list) {
-        CGAL::PointList new_points = raster.raster_points();
-        raster_points.insert(raster_points.end(),
-                             std::make_move_iterator(new_points.begin()),
-                             std::make_move_iterator(new_points.end()));
-        CGAL::DelaunayConstraints new_constraints = interpolate_boundary_points(raster, boundary_polygon);
+// Triangulate the raster points inside the polygon, with the polygon boundary inserted as constraints.
+// The raster is a RasterData or a RasterMosaic. The boundaries of the break line polygons are draped
+// onto the raster and inserted as constraints as well.
+template<typename R, typename Pgn>
+CGAL::Mesh triangulate_raster(const R& raster,
+                              const Pgn& boundary_polygon,
+                              const CGAL::MultiPolygon& break_lines = CGAL::MultiPolygon()) {
+    // Only points inside the polygon are triangulated, and the same index is used to discard outside faces
+    const PolygonScanlines scanlines(boundary_polygon, raster.y_max, raster.delta_y);
+    CGAL::PointList raster_points = raster.raster_points(scanlines);
+    CGAL::DelaunayConstraints boundary_points = interpolate_boundary_points(raster, boundary_polygon);
+    if (not break_lines.empty()) {
+        CGAL::DelaunayConstraints break_line_points = interpolate_break_lines(raster, break_lines, scanlines);
         boundary_points.insert(boundary_points.end(),
-                               std::make_move_iterator(new_constraints.begin()),
-                               std::make_move_iterator(new_constraints.end()));
+                               std::make_move_iterator(break_line_points.begin()),
+                               std::make_move_iterator(break_line_points.end()));
     }
-    return make_mesh(raster_points, boundary_polygon, boundary_points, proj4_str);
+
+    // Faces over voids in the raster are left out, and become holes in the mesh
+    return triangulate(raster_points, boundary_points,
+                       [&scanlines, &raster] (const CGAL::Point2& x) {
+                           return scanlines.contains(x) and raster.is_valid_at(x.x(), x.y());
+                       });
 }
 
 
-template<typename T>
-Mesh mesh_from_raster(const std::vector<RasterData<T>>& raster_list, const std::string proj4_str) {
-    CGAL::PointList raster_points;
-    for (auto raster : raster_list) {
-        CGAL::PointList new_points = raster.raster_points();
-        raster_points.insert(raster_points.end(),
-                             std::make_move_iterator(new_points.begin()),
-                             std::make_move_iterator(new_points.end()));
+// Merge meshes of disjoint parts into one mesh, storing the part index of each face in "f:part_id".
+// Constrained edges are carried over.
+CGAL::Mesh merge_parts(const std::vector<CGAL::Mesh>& parts) {
+    std::size_t num_vertices = 0, num_edges = 0, num_faces = 0;
+    for (const auto& part: parts) {
+        num_vertices += part.number_of_vertices();
+        num_edges += part.number_of_edges();
+        num_faces += part.number_of_faces();
+    }
+
+    CGAL::Mesh mesh;
+    mesh.reserve(num_vertices, num_edges, num_faces);
+    auto part_id = mesh.add_property_map<CGAL::FaceIndex, int>("f:part_id", 0).first;
+
+    std::vector<CGAL::VertexIndex> vertex_map;
+    for (std::size_t k = 0; k < parts.size(); ++k) {
+        const auto& part = parts[k];
+        vertex_map.assign(part.num_vertices(), CGAL::VertexIndex());
+        for (auto v: part.vertices())
+            vertex_map[v.idx()] = mesh.add_vertex(part.point(v));
+        for (auto f: part.faces()) {
+            std::array<CGAL::VertexIndex, 3> vertices;
+            std::size_t i = 0;
+            for (auto v: part.vertices_around_face(part.halfedge(f)))
+                vertices[i++] = vertex_map[v.idx()];
+            part_id[mesh.add_face(vertices[0], vertices[1], vertices[2])] = static_cast<int>(k);
+        }
+
+        auto [part_constrained, has_constraints] = part.property_map<CGAL::EdgeIndex, bool>("e:constrained");
+        if (not has_constraints)
+            continue;
+        auto constrained = mesh.add_property_map<CGAL::EdgeIndex, bool>("e:constrained", false).first;
+        for (auto e: part.edges())
+            if (part_constrained[e])
+                constrained[mesh.edge(mesh.halfedge(vertex_map[part.source(part.halfedge(e)).idx()],
+                                                    vertex_map[part.target(part.halfedge(e)).idx()]))] = true;
     }
-    return make_mesh(raster_points, proj4_str);
+    return mesh;
+}
+
+
+// Triangulate each part of the multipolygon independently on a pool of threads
+template<typename R>
+Mesh mesh_from_parts(const R& raster,
+                     const CGAL::MultiPolygon& boundary_polygon,
+                     const std::string proj4_str,
+                     const CGAL::MultiPolygon& break_lines = CGAL::MultiPolygon()) {
+    std::vector<CGAL::Mesh> part_meshes(boundary_polygon.size());
+    parallel_for(boundary_polygon.size(), [&] (std::size_t k) {
+        part_meshes[k] = triangulate_raster(raster, boundary_polygon[k], break_lines);
+    });
+    return Mesh(merge_parts(part_meshes), proj4_str);
+}
+
+
+template<typename R, typename Pgn>
+Mesh mesh_from_raster(const R& raster,
+                      const Pgn& boundary_polygon,
+                      const std::string proj4_str,
+                      const CGAL::MultiPolygon& break_lines = CGAL::MultiPolygon()) {
+    return Mesh(triangulate_raster(raster, boundary_polygon, break_lines), proj4_str);
 }
 
 
+template<typename R>
+Mesh mesh_from_raster(const R& raster,
+                      const CGAL::MultiPolygon& boundary_polygon,
+                      const std::string proj4_str,
+                      const CGAL::MultiPolygon& break_lines = CGAL::MultiPolygon()) {
+    return mesh_from_parts(raster, boundary_polygon, proj4_str, break_lines);
+}
+
+
+template<typename R>
+Mesh mesh_from_raster(const R& raster, const std::string proj4_str) {
+    return Mesh(triangulate(raster.raster_points(), CGAL::DelaunayConstraints(),
+                            [&raster] (const CGAL::Point2& x) {return raster.is_valid_at(x.x(), x.y());}),
+                proj4_str);
+}
+
+
+// A list of rasters is meshed as a mosaic, where the first raster takes precedence in overlaps
 template<typename T, typename Pgn>
-Mesh mesh_from_raster(const RasterData<T>& raster,
+Mesh mesh_from_raster(const std::vector<RasterData<T>>& raster_list,
                       const Pgn& boundary_polygon,
-                      const std::string proj4_str) {
-    CGAL::PointList raster_points = raster.raster_points();
-    CGAL::DelaunayConstraints boundary_points = interpolate_boundary_points(raster, boundary_polygon);
+                      const std::string proj4_str,
+                      const CGAL::MultiPolygon& break_lines = CGAL::MultiPolygon()) {
+    if (raster_list.empty())
+        return Mesh(CGAL::Mesh(), proj4_str);
+    return mesh_from_raster(RasterMosaic<T>(raster_list), boundary_polygon, proj4_str, break_lines);
+}
+
 
-    return make_mesh(raster_points, boundary_polygon, boundary_points, proj4_str);
+template<typename T>
+Mesh mesh_from_raster(const std::vector<RasterData<T>>& raster_list,
+                      const CGAL::MultiPolygon& boundary_polygon,
+                      const std::string proj4_str,
+                      const CGAL::MultiPolygon& break_lines = CGAL::MultiPolygon()) {
+    if (raster_list.empty())
+        return Mesh(CGAL::Mesh(), proj4_str);
+    return mesh_from_parts(RasterMosaic<T>(raster_list), boundary_polygon, proj4_str, break_lines);
 }
 
 
 template<typename T>
-Mesh mesh_from_raster(const RasterData<T>& raster, const std::string proj4_str) {
-    return make_mesh(raster.raster_points(), proj4_str);
+Mesh mesh_from_raster(const std::vector<RasterData<T>>& raster_list, const std::string proj4_str) {
+    if (raster_list.empty())
+        return Mesh(CGAL::Mesh(), proj4_str);
+    return mesh_from_raster(RasterMosaic<T>(raster_list), proj4_str);
 }
 
 CGAL::Point3 centroid(const Mesh& mesh, const CGAL::face_descriptor &face) {
@@ -570,7 +2927,7 @@ CGAL::Point3 centroid(const Mesh& mesh, const CGAL::face_descriptor &face) {
 std::vector<int> compute_shadow(const Mesh & mesh,
                                 const point3 &sun_direction) {
     std::vector<int> shade;
-    auto cgal_mesh = mesh.cgal_mesh;
+    const auto& cgal_mesh = mesh.cgal_mesh;
     const CGAL::Vector sun_vec(-sun_direction[0], -sun_direction[1], -sun_direction[2]);
 
     int i = 0;
@@ -616,21 +2973,14 @@ auto shade(const Mesh &mesh,
            const std::chrono::system_clock::time_point tp) {
     std::vector<bool> shade_vec;
     shade_vec.reserve(mesh.num_faces());
-    namespace bg = boost::geometry;
-    using point_car = bg::model::point<double, 2, bg::cs::cartesian>;
-    using point_geo = bg::model::point<double, 2, bg::cs::geographic<bg::degree>>;
-    bg::srs::transformation<> tr{
-        bg::srs::proj4(mesh.proj4_str),
-        bg::srs::epsg(4326)
-    };
+    // Geographic centroids are cached with the mesh, for repeated calls over a time series
+    const auto& geographic_centroids = mesh.geographic_centroids();
     const CGAL::Tree tree(CGAL::faces(mesh.cgal_mesh).first, CGAL::faces(mesh.cgal_mesh).second, mesh.cgal_mesh);
+    std::size_t i = 0;
     for (auto fd: mesh.cgal_mesh.faces()) {
         const auto c = centroid(mesh, fd);
-        const point_car x_car{c.x(), c.y()};
-        point_geo x_geo;
-        tr.forward(x_car, x_geo);
-        const auto lat = bg::get<1>(x_geo);
-        const auto lon = bg::get<0>(x_geo);
+        const auto lon = geographic_centroids[i][0];
+        const auto lat = geographic_centroids[i++][1];
         const auto [azimuth, elevation] = solar_position::time_point_solar_position(
                 tp,
                 lat,
@@ -662,7 +3012,7 @@ std::vector<std::vector<int>> compute_shadows(const Mesh &mesh,
     return result;
     /*
     result.reserve(sun_rays.size());
-    CGAL::Mesh cgal_mesh = mesh.cgal_mesh;
+    const CGAL::Mesh& cgal_mesh = mesh.cgal_mesh;
     std::map<size_t, CGAL::VertexIndex> index_map;
     std::map<CGAL::face_descriptor, size_t> face_map;
     size_t i = 0;
@@ -751,6 +3101,11 @@ double_vector compute_aspects(const point3_vector &normals) {
     return result;
 };
 
+template<typename P>
+point3 to_point3(const std::array<P, 3>& p) {
+    return point3{double(p[0]), double(p[1]), double(p[2])};
+}
+
 point3 normal(const point3 &p0, const point3 &p1, const point3 &p2) {
         const arma::vec::fixed<3> v0{p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
         const arma::vec::fixed<3> v1{p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
@@ -759,11 +3114,14 @@ point3 normal(const point3 &p0, const point3 &p1, const point3 &p2) {
         return n[2] >= 0.0 ? point3{n[0], n[1], n[2]} : point3{-n[0], -n[1], -n[2]};
 }
 
-point3_vector surface_normals(const point3_vector &pts, const face_vector &faces) {
-    point3_vector result;
+template<typename P, typename I>
+point3_vector_t<P> surface_normals(const point3_vector_t<P> &pts, const face_vector_t<I> &faces) {
+    point3_vector_t<P> result;
     result.reserve(faces.size());
-    for (const auto face: faces)
-        result.emplace_back(normal(pts[face[0]], pts[face[1]], pts[face[2]]));
+    for (const auto face: faces) {
+        const auto n = normal(to_point3(pts[face[0]]), to_point3(pts[face[1]]), to_point3(pts[face[2]]));
+        result.push_back({P(n[0]), P(n[1]), P(n[2])});
+    }
     return result;
 };
 
@@ -773,33 +3131,196 @@ template <typename T> void iadd(T& v, const T& o) {
     v[2] += o[2];
 }
 
-point3_vector point_normals(const point3_vector &pts, const face_vector &faces) {
-    point3_vector result(pts.size(), {0.0, 0.0, 0.0});
+template<typename P, typename I>
+point3_vector_t<P> point_normals(const point3_vector_t<P> &pts, const face_vector_t<I> &faces) {
+    // Sum in double precision whatever the coordinate type
+    point3_vector sum(pts.size(), {0.0, 0.0, 0.0});
     for (auto face: faces) {
-        const auto p0 = pts[face[0]];
-        const auto p1 = pts[face[1]];
-        const auto p2 = pts[face[2]];
+        const auto p0 = to_point3(pts[face[0]]);
+        const auto p1 = to_point3(pts[face[1]]);
+        const auto p2 = to_point3(pts[face[2]]);
         const arma::vec::fixed<3> v0{p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
         const arma::vec::fixed<3> v1{p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
         arma::vec::fixed<3> n = arma::cross(v0, v1);
         n /= arma::norm(n);
         const auto v = (n[2] >= 0.0) ? point3{n[0], n[1], n[2]} : point3{-n[0], -n[1], -n[2]};
-        iadd(result[face[0]], v);
-        iadd(result[face[1]], v);
-        iadd(result[face[2]], v);
+        iadd(sum[face[0]], v);
+        iadd(sum[face[1]], v);
+        iadd(sum[face[2]], v);
     }
-    for (int i = 0; i < result.size(); ++i) {
-        point3 &p = result[i];
+    point3_vector_t<P> result;
+    result.reserve(sum.size());
+    for (auto& p: sum) {
         const double norm = std::sqrt(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
         if (norm > 1.0e-16) {
             p[0] /= norm;
             p[1] /= norm;
             p[2] /= norm;
         }
+        result.push_back({P(p[0]), P(p[1]), P(p[2])});
     }
     return result;
 }
 
+// Output arrays of terrain_attributes, as structure of arrays: component k of face i is at
+// face_normals[k][i]. Attributes with null pointers are not computed.
+struct TerrainAttributeBuffers {
+    std::array<double*, 3> face_normals{{nullptr, nullptr, nullptr}};
+    double* slopes = nullptr;
+    double* aspects = nullptr;
+    std::array<double*, 3> cell_centers{{nullptr, nullptr, nullptr}};
+    std::array<double*, 3> point_normals{{nullptr, nullptr, nullptr}};
+};
+
+// Face normals (pointing up), slopes, aspects and cell centers in a single multithreaded pass over the
+// faces, and point normals from a gather over the faces around each point, so that no two threads
+// write to the same point. The results agree with surface_normals, compute_slopes, compute_aspects,
+// cell_centers and point_normals.
+template<typename P, typename I>
+void terrain_attributes(const P* points, std::size_t num_points,
+                        const I* faces, std::size_t num_faces,
+                        const TerrainAttributeBuffers& out) {
+    constexpr std::size_t chunk_size = 1 << 14;
+    const bool with_point_normals = out.point_normals[0] != nullptr;
+
+    // Point normals need the face normals, also when they are not asked for
+    std::vector<double> normal_storage;
+    auto normals = out.face_normals;
+    if (with_point_normals and normals[0] == nullptr) {
+        normal_storage.resize(3*num_faces);
+        for (std::size_t k = 0; k < 3; ++k)
+            normals[k] = normal_storage.data() + k*num_faces;
+    }
+    const bool with_normals = normals[0] != nullptr;
+
+    parallel_for((num_faces + chunk_size - 1)/chunk_size, [&] (std::size_t c) {
+        const std::size_t end = std::min(num_faces, (c + 1)*chunk_size);
+        for (std::size_t i = c*chunk_size; i < end; ++i) {
+            const P* p0 = points + 3*faces[3*i];
+            const P* p1 = points + 3*faces[3*i + 1];
+            const P* p2 = points + 3*faces[3*i + 2];
+            if (out.cell_centers[0] != nullptr)
+                for (std::size_t k = 0; k < 3; ++k)
+                    out.cell_centers[k][i] = (double(p0[k]) + double(p1[k]) + double(p2[k]))/3.0;
+            if (not with_normals and out.slopes == nullptr and out.aspects == nullptr)
+                continue;
+
+            const double ux = double(p1[0]) - p0[0], uy = double(p1[1]) - p0[1], uz = double(p1[2]) - p0[2];
+            const double vx = double(p2[0]) - p0[0], vy = double(p2[1]) - p0[1], vz = double(p2[2]) - p0[2];
+            double nx = uy*vz - uz*vy;
+            double ny = uz*vx - ux*vz;
+            double nz = ux*vy - uy*vx;
+            const double scale = (nz >= 0.0 ? 1.0 : -1.0)/std::sqrt(nx*nx + ny*ny + nz*nz);
+            nx *= scale;
+            ny *= scale;
+            nz *= scale;
+            if (with_normals) {
+                normals[0][i] = nx;
+                normals[1][i] = ny;
+                normals[2][i] = nz;
+            }
+            if (out.slopes != nullptr)
+                out.slopes[i] = std::atan2(std::sqrt(nx*nx + ny*ny), nz);
+            if (out.aspects != nullptr)
+                out.aspects[i] = std::atan2(nx, ny);
+        }
+    });
+
+    if (not with_point_normals)
+        return;
+
+    // Faces around each point, in compressed sparse rows
+    std::vector<std::size_t> offset(num_points + 1, 0);
+    for (std::size_t j = 0; j < 3*num_faces; ++j)
+        ++offset[faces[j] + 1];
+    std::partial_sum(offset.begin(), offset.end(), offset.begin());
+    std::vector<std::size_t> point_faces(3*num_faces);
+    std::vector<std::size_t> next(offset.begin(), offset.end() - 1);
+    for (std::size_t j = 0; j < 3*num_faces; ++j)
+        point_faces[next[faces[j]]++] = j/3;
+
+    parallel_for((num_points + chunk_size - 1)/chunk_size, [&] (std::size_t c) {
+        const std::size_t end = std::min(num_points, (c + 1)*chunk_size);
+        for (std::size_t v = c*chunk_size; v < end; ++v) {
+            double n[3] = {0.0, 0.0, 0.0};
+            for (std::size_t j = offset[v]; j < offset[v + 1]; ++j)
+                for (std::size_t k = 0; k < 3; ++k)
+                    n[k] += normals[k][point_faces[j]];
+            const double norm = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+            for (std::size_t k = 0; k < 3; ++k)
+                out.point_normals[k][v] = norm > 1.0e-16 ? n[k]/norm : n[k];
+        }
+    });
+}
+
+// Output grids of raster_terrain_attributes, row major with the shape of the raster. Grids with null
+// pointers are not computed.
+struct RasterTerrainAttributeBuffers {
+    double* slopes = nullptr;
+    double* aspects = nullptr;
+    double* curvatures = nullptr;
+};
+
+// Slopes and aspects from the Horn gradient of the 3x3 window around each raster point, and curvatures
+// as the Zevenbergen-Thorne Laplacian of the height, positive in hollows. The upward normal of a plane
+// with gradient (p, q) is (-p, -q, 1), so that the angles agree with compute_slope and compute_aspect.
+// Attributes are NaN on the border, and where their window or the point itself is a void.
+//
+// The raster is processed in tiles in parallel. Each tile converts its rows to doubles once, with voids
+// as NaN, so that the kernels are branch free loops over contiguous rows, left to the compiler to vectorise.
+template<typename FT>
+void raster_terrain_attributes(const RasterData<FT>& raster, const RasterTerrainAttributeBuffers& out) {
+    constexpr std::size_t tile_rows = 64, tile_columns = 2048;
+    const std::size_t nx = raster.num_points_x, ny = raster.num_points_y;
+    const std::size_t num_tiles_x = (nx + tile_columns - 1)/tile_columns;
+    const std::size_t num_tiles_y = (ny + tile_rows - 1)/tile_rows;
+    const double dx = raster.delta_x, dy = raster.delta_y;
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+
+    parallel_for(num_tiles_x*num_tiles_y, [&] (std::size_t t) {
+        const std::size_t i_begin = (t/num_tiles_x)*tile_rows, i_end = std::min(ny, i_begin + tile_rows);
+        const std::size_t j_begin = (t%num_tiles_x)*tile_columns, j_end = std::min(nx, j_begin + tile_columns);
+        const std::size_t w = j_end - j_begin;
+
+        // Rows north, at and south of the current row, padded with a column on each side
+        std::vector<double> rows(3*(w + 2)), p(w), q(w), laplacian(w);
+        std::array<double*, 3> window{{rows.data(), rows.data() + (w + 2), rows.data() + 2*(w + 2)}};
+        auto load = [&] (std::size_t i, double* row) {
+            for (std::size_t k = 0; k < w + 2; ++k) {
+                const std::size_t j = j_begin + k - 1;  // Wraps around for the column before the first
+                row[k] = (i < ny and j < nx and raster.is_valid(i, j)) ? double(raster.data[i*nx + j]) : nan;
+            }
+        };
+        load(i_begin - 1, window[1]);
+        load(i_begin, window[2]);
+
+        for (std::size_t i = i_begin; i < i_end; ++i) {
+            std::rotate(window.begin(), window.begin() + 1, window.end());
+            load(i + 1, window[2]);
+            const double* n = window[0];
+            const double* c = window[1];
+            const double* s = window[2];
+            for (std::size_t k = 0; k < w; ++k) {
+                // A void centre is left out of the gradient, but still voids it
+                const double void_centre = c[k + 1] - c[k + 1];
+                p[k] = ((n[k + 2] + 2.0*c[k + 2] + s[k + 2]) - (n[k] + 2.0*c[k] + s[k]))/(8.0*dx) + void_centre;
+                q[k] = ((n[k] + 2.0*n[k + 1] + n[k + 2]) - (s[k] + 2.0*s[k + 1] + s[k + 2]))/(8.0*dy) + void_centre;
+                laplacian[k] = (c[k] + c[k + 2] - 2.0*c[k + 1])/(dx*dx) + (n[k + 1] + s[k + 1] - 2.0*c[k + 1])/(dy*dy);
+            }
+
+            const std::size_t offset = i*nx + j_begin;
+            if (out.slopes != nullptr)
+                for (std::size_t k = 0; k < w; ++k)
+                    out.slopes[offset + k] = std::atan(std::sqrt(p[k]*p[k] + q[k]*q[k]));
+            if (out.aspects != nullptr)
+                for (std::size_t k = 0; k < w; ++k)
+                    out.aspects[offset + k] = std::atan2(-p[k], -q[k]);
+            if (out.curvatures != nullptr)
+                std::copy(laplacian.begin(), laplacian.end(), out.curvatures + offset);
+        }
+    });
+}
+
 template <typename CB>
 std::tuple<face_vector, face_vector> partition(const point3_vector &pts,
                                                const face_vector &faces,
@@ -850,17 +3371,18 @@ std::tuple<face_vector, face_vector> extract_avalanche_expositions(const point3_
     });
 }
 
-point3_vector cell_centers(const point3_vector& points, const face_vector & faces) {
-    point3_vector result;
+template<typename P, typename I>
+point3_vector_t<P> cell_centers(const point3_vector_t<P>& points, const face_vector_t<I> & faces) {
+    point3_vector_t<P> result;
     result.reserve(faces.size());
     for (auto f: faces) {
-        auto p0 = points[f[0]];
-        auto p1 = points[f[1]];
-        auto p2 = points[f[2]];
+        const auto p0 = to_point3(points[f[0]]);
+        const auto p1 = to_point3(points[f[1]]);
+        const auto p2 = to_point3(points[f[2]]);
         auto x = (p0[0] + p1[0] + p2[0])/3.0;
         auto y = (p0[1] + p1[1] + p2[1])/3.0;
         auto z = (p0[2] + p1[2] + p2[2])/3.0;
-        result.emplace_back(point3{x, y, z});
+        result.push_back({P(x), P(y), P(z)});
     }
     return result;
 }
@@ -885,11 +3407,17 @@ std::vector<T> extract_buffer_values(const index_vector& indices, pybind11::arra
     std::vector<T> result;
     result.reserve(indices.size());
     auto buffer = array.request();
+    if (buffer.ndim != 2)
+        throw std::invalid_argument("Buffer must be two-dimensional");
     unsigned long M = (unsigned long)buffer.shape[0];
     unsigned long N = (unsigned long)buffer.shape[1];
     T* ptr = (T *)buffer.ptr;
-    for (auto idx: indices)
-        result.emplace_back(ptr[idx[0]*N + idx[1]]);  // TODO: Implement range check?
+    // Indices are (column, row), as from coordinates_to_indices
+    for (auto idx: indices) {
+        if (idx[0] >= N or idx[1] >= M)
+            throw std::out_of_range("Index outside of buffer");
+        result.emplace_back(ptr[idx[1]*N + idx[0]]);
+    }
     return result;
 }
 
@@ -164,9 +164,12 @@ def visualize_tin():
                 material_by_id[material_id]["material_name"] = land_cover_names[material_id]
     
     geometries = []
+    geometry_by_id = tin_repo.extract_all(uid=res.uid)
     for land_cover in info["info"]["land_covers"]:
         material_id, name, *rest = land_cover
-        geometry = tin_repo.extract(uid=res.uid, face_id=material_id)
+        if material_id not in geometry_by_id:
+            raise IOError(f"face_id {material_id} not found in dataset")
+        geometry = geometry_by_id[material_id]
         if material_id in material_by_id:
             geometry.material_spec = material_by_id[material_id]
         geometries.append(geometry)
@@ -49,3 +49,45 @@ def test_gml_repository():
     geo_cell_centers = GeoPoints(xy=cmesh.cell_centers[:, :2], crs=target_crs)
     terrain_cover = repos.land_cover(land_types=None, geo_points=geo_cell_centers, domain=domain)
     assert terrain_cover is not None
+
+
+def test_polygon_store(tmp_path):
+    from rasputin.gml_repository import PolygonStore
+
+    def feature(code, *rings):
+        boundaries = "".join(f"<gml:{tag}><gml:LinearRing><gml:coordinates>"
+                             + " ".join(f"{x},{y}" for (x, y) in ring + ring[:1])
+                             + f"</gml:coordinates></gml:LinearRing></gml:{tag}>"
+                             for (tag, ring) in zip(["outerBoundaryIs"] + ["innerBoundaryIs"]*len(rings), rings))
+        return (f"<gml:featureMember><ogr:clc><ogr:geometryProperty><gml:Polygon srsName=\"EPSG:32633\">"
+                f"{boundaries}</gml:Polygon></ogr:geometryProperty><ogr:clc18_kode>{code}</ogr:clc18_kode>"
+                f"</ogr:clc></gml:featureMember>")
+
+    square = lambda x, y, s: [(x, y), (x + s, y), (x + s, y + s), (x, y + s)]
+    filepath = tmp_path / "clc.gml"
+    filepath.write_text("<?xml version=\"1.0\" encoding=\"utf-8\" ?>"
+                        "<ogr:FeatureCollection xmlns:gml=\"http://www.opengis.net/gml\" xmlns:ogr=\"http://ogr.maptools.org/\">"
+                        + feature(312, square(0, 0, 10), square(4, 4, 2))
+                        + feature(512, square(4, 4, 2))
+                        + feature(332, square(20, 0, 10))
+                        + "</ogr:FeatureCollection>")
+
+    store = PolygonStore(filepath=filepath)
+    assert len(store) == 3
+    assert list(store.codes) == [312, 512, 332]
+    assert store.crs.to_epsg() == 32633
+    assert list(store.query((5, 5, 8, 8))) == [0, 1]
+    assert list(store.query((11, 0, 19, 10))) == []
+    assert store.polygon(0).area == 96
+    exterior, hole = store.rings(0)
+    assert hole.shape == (5, 2)
+
+    # A second store maps the converted arrays instead of parsing the file again
+    converted = (store.directory / "codes.npy").stat().st_mtime_ns
+    assert len(PolygonStore(filepath=filepath)) == 3
+    assert (store.directory / "codes.npy").stat().st_mtime_ns == converted
+
+    # A changed file is converted again
+    filepath.write_text(filepath.read_text().replace("</ogr:FeatureCollection>",
+                                                     feature(111, square(40, 0, 1)) + "</ogr:FeatureCollection>"))
+    assert list(PolygonStore(filepath=filepath).codes) == [312, 512, 332, 111]
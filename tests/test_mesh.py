@@ -1,14 +1,15 @@
 import pytest
+import numpy as np
 from numpy import array, cos, sin, linspace, pi, float32, zeros, ndindex, sqrt, meshgrid
 from numpy.linalg import norm
 from datetime import datetime, timedelta
 
 import pyproj 
-from shapely.geometry import Polygon, Point
+from shapely.geometry import Polygon, MultiPolygon, Point
 
 from rasputin.geometry import GeoPolygon
 from rasputin.reader import Rasterdata
-from rasputin.mesh import Mesh
+from rasputin.mesh import Mesh, ProgressiveMesh
 from rasputin import triangulate_dem
 
 
@@ -155,6 +156,105 @@ def test_mesh_sub_mesh(raster, polygon):
     sub_mesh = mesh.extract_sub_mesh(array([0, 1]))
     assert len(sub_mesh.faces) == 2
 
+
+def test_mesh_from_points_and_faces(raster, polygon):
+    mesh = Mesh.from_raster(data=raster, domain=polygon)
+    # Points as a strided view are converted on the way in, and int64 faces are read as they are
+    points = zeros((mesh.num_points, 4))
+    points[:, :3] = mesh.points
+    copy = Mesh.from_points_and_faces(points=points[:, :3], faces=mesh.faces.astype("int64"), proj4_str="")
+    assert (copy.points == mesh.points).all()
+    assert (copy.faces == mesh.faces).all()
+
+    with pytest.raises(IndexError):
+        Mesh.from_points_and_faces(points=mesh.points, faces=mesh.faces + mesh.num_points, proj4_str="")
+    # Indices that only wrap into range when narrowed to 32 bits
+    with pytest.raises(IndexError):
+        Mesh.from_points_and_faces(points=mesh.points, faces=mesh.faces.astype("int64") + 2**32, proj4_str="")
+    with pytest.raises(IndexError):
+        Mesh.from_points_and_faces(points=mesh.points, faces=mesh.faces.astype("uint32") + 2**31, proj4_str="")
+
+
+def test_mesh_reorder(raster, polygon):
+    mesh = Mesh.from_raster(data=raster, domain=polygon)
+    reordered, order = mesh.reorder()
+    assert sorted(order) == list(range(mesh.num_faces))
+    assert reordered.num_points == mesh.num_points
+    # Same triangles, with the points numbered by first use
+    assert (reordered.cell_centers == mesh.cell_centers[order]).all()
+    assert sorted(reordered.faces[0]) == [0, 1, 2]
+
+
+def test_mesh_precision(raster, polygon):
+    mesh = Mesh.from_raster(data=raster, domain=polygon)
+    compact = mesh.with_precision("compact")
+    large = mesh.with_precision("large")
+    assert compact.points.dtype == float32 and compact.faces.dtype == "uint32"
+    assert large.points.dtype == "float64" and large.faces.dtype == "int64"
+    assert (compact.faces == mesh.faces).all() and (large.faces == mesh.faces).all()
+    assert abs(compact.points + compact.origin - mesh.points).max() < 1e-6
+    assert abs(compact.cell_centers - mesh.cell_centers).max() < 1e-6
+    assert abs(compact.face_normals - mesh.face_normals).max() < 1e-5
+    assert compact.simplify(ratio=0.5).precision == "compact"
+
+
+def test_mesh_attributes(raster, polygon):
+    mesh = Mesh.from_raster(data=raster, domain=polygon)
+    side = (mesh.cell_centers[:, 0] > 0.5).astype("int32")
+    mesh = (mesh.with_face_attribute("side", side, preserve_boundaries=True)
+                .with_vertex_attribute("height", mesh.points[:, 2]))
+    assert (mesh.face_attributes["side"] == side).all()
+
+    reordered, order = mesh.reorder()
+    assert (reordered.face_attributes["side"] == side[order]).all()
+    assert (reordered.vertex_attributes["height"] == reordered.points[:, 2]).all()
+
+    sub_mesh = mesh.extract_sub_mesh(array([3, 1]))
+    assert (sub_mesh.face_attributes["side"] == side[[3, 1]]).all()
+
+    def label_boundary(m):
+        edges = {}
+        for face, label in zip(m.faces, m.face_attributes["side"]):
+            for i in range(3):
+                edge = frozenset(tuple(m.points[v]) for v in (face[i], face[(i + 1) % 3]))
+                edges.setdefault(edge, set()).add(label)
+        return {edge for edge, labels in edges.items() if len(labels) == 2}
+
+    for coarse in (mesh.simplify(ratio=0.3), mesh.simplify(ratio=0.3, parallel=True)):
+        assert coarse.num_faces < mesh.num_faces
+        assert label_boundary(coarse) == label_boundary(mesh)
+        height = coarse.vertex_attributes["height"]
+        assert height.min() >= mesh.points[:, 2].min() and height.max() <= mesh.points[:, 2].max()
+
+
+def test_mesh_partition_by_label(raster, polygon):
+    mesh = Mesh.from_raster(data=raster, domain=polygon)
+    labels = (3*mesh.cell_centers[:, 0]).astype(int) - 1
+    parts = mesh.partition_by_label(labels)
+    assert sorted(parts) == sorted(set(labels))
+    for label, part in parts.items():
+        sub_mesh = mesh.extract_sub_mesh((labels == label).nonzero()[0])
+        assert (part.points == sub_mesh.points).all()
+        assert (part.faces == sub_mesh.faces).all()
+
+
+def test_mesh_terrain_attributes(raster, polygon):
+    mesh = Mesh.from_raster(data=raster, domain=polygon)
+    slopes = zeros(mesh.num_faces)
+    attributes = mesh.terrain_attributes(face_normals=True, aspects=True, cell_centers=True,
+                                         point_normals=True, out=dict(slopes=slopes))
+    assert attributes["slopes"] is slopes
+    assert np.allclose(attributes["face_normals"].T, mesh.face_normals)
+    assert np.allclose(attributes["cell_centers"].T, mesh.cell_centers)
+    assert np.allclose(attributes["point_normals"].T, mesh.point_normals)
+    normals = triangulate_dem.surface_normals(mesh._cpp.points, mesh._cpp.faces)
+    assert np.allclose(slopes, triangulate_dem.compute_slopes(normals))
+    assert np.allclose(attributes["aspects"], triangulate_dem.compute_aspects(normals))
+
+    with pytest.raises(ValueError):
+        mesh.terrain_attributes(out=dict(slopes=zeros(mesh.num_faces + 1)))
+
+
 def test_mesh_w_hole(raster, polygon_w_hole):
     mesh = Mesh.from_raster(data=raster, domain=polygon_w_hole)
 
@@ -192,3 +292,291 @@ def test_mesh_shade(raster_xm):
     tp = datetime(2000, 6, 2, 4) + timedelta(minutes=18)
     shades = triangulate_dem.shade(mesh._cpp, tp.timestamp())
     assert len(shades) == mesh.num_faces
+
+
+def test_mesh_thin_polygon(raster):
+    # Thin diagonal strip covering a small fraction of the raster
+    strip = GeoPolygon(polygon=Polygon([(0.05, 0.1), (0.15, 0.1), (0.95, 0.9), (0.85, 0.9)]),
+                       crs=pyproj.CRS.from_epsg(32633))
+    mesh = Mesh.from_raster(data=raster, domain=strip)
+
+    assert len(mesh.points) == mesh.num_points
+    assert len(mesh.faces) == mesh.num_faces
+    assert mesh.characteristic == 1
+    assert mesh.num_points < raster.array.size
+
+    test_poly = strip.polygon.buffer(1e-10)
+    for (x, y, _) in mesh.points:
+        assert test_poly.contains(Point(x, y))
+
+
+def test_mesh_multi_polygon(raster):
+    islands = [Polygon([(0.1, 0.1), (0.4, 0.1), (0.4, 0.4), (0.1, 0.4)]),
+               Polygon([(0.6, 0.6), (0.9, 0.6), (0.9, 0.9), (0.6, 0.9)]),
+               Polygon([(0.6, 0.1), (0.9, 0.1), (0.75, 0.4)])]
+    domain = GeoPolygon(polygon=MultiPolygon(islands),
+                        crs=pyproj.CRS.from_epsg(32633))
+    mesh = Mesh.from_raster(data=raster, domain=domain)
+
+    assert len(mesh.faces) == mesh.num_faces
+    # One connected component per island
+    assert mesh.characteristic == len(islands)
+
+    part_ids = mesh.part_ids
+    assert len(part_ids) == mesh.num_faces
+    assert set(part_ids) == set(range(len(islands)))
+    for part_id, center in zip(part_ids, mesh.cell_centers):
+        assert islands[part_id].buffer(1e-10).contains(Point(center[:2]))
+
+
+def test_mesh_nodata_hole(raster):
+    # Punch a void into the raster, it must become a hole in the mesh
+    array = raster.array.copy()
+    array[8:13, 4:7] = -9999
+    void_raster = Rasterdata(shape=raster.shape,
+                             x_min=raster.x_min,
+                             y_max=raster.y_max,
+                             delta_x=raster.delta_x,
+                             delta_y=raster.delta_y,
+                             array=array,
+                             coordinate_system=raster.coordinate_system,
+                             info={},
+                             nodata=-9999)
+    mesh = Mesh.from_raster(data=void_raster)
+
+    assert len(mesh.points) == mesh.num_points
+    assert mesh.num_points == (array != -9999).sum()
+    assert mesh.points[:, 2].min() > -9999
+    # A rectangle with one hole
+    assert mesh.characteristic == 0
+
+
+def test_mesh_validity_mask(raster):
+    # Samples outside a bool validity mask are voids, like nodata samples
+    mask = np.ones(raster.shape, dtype=bool)
+    mask[8:13, 4:7] = False
+    masked_raster = triangulate_dem.raster_data_float(raster.array, raster.x_min, raster.y_max,
+                                                      raster.delta_x, raster.delta_y, mask=mask)
+    assert (masked_raster.validity_mask() == mask).all()
+    mesh = Mesh(triangulate_dem.make_mesh(masked_raster, raster.coordinate_system))
+    assert mesh.num_points == mask.sum()
+    assert mesh.characteristic == 0
+
+    # The validity mask of a raster can be passed on, also as uint8
+    nodata_array = raster.array.copy()
+    nodata_array[~mask] = -9999
+    nodata_raster = triangulate_dem.raster_data_float(nodata_array, raster.x_min, raster.y_max,
+                                                      raster.delta_x, raster.delta_y, nodata=-9999)
+    for valid in [nodata_raster.validity_mask(), mask.astype(np.uint8)]:
+        copy = triangulate_dem.raster_data_float(raster.array, raster.x_min, raster.y_max,
+                                                 raster.delta_x, raster.delta_y, mask=valid)
+        assert (copy.validity_mask() == mask).all()
+
+    # Masks are read in place, so strided views and other types are rejected
+    wide_mask = np.ones((raster.shape[0], 2*raster.shape[1]), dtype=bool)
+    with pytest.raises(ValueError):
+        triangulate_dem.raster_data_float(raster.array, raster.x_min, raster.y_max,
+                                          raster.delta_x, raster.delta_y, mask=wide_mask[:, ::2])
+    with pytest.raises(TypeError):
+        triangulate_dem.raster_data_float(raster.array, raster.x_min, raster.y_max,
+                                          raster.delta_x, raster.delta_y, mask=mask.astype(np.int32))
+
+
+def test_mesh_mosaic_shared_edge(raster, polygon):
+    # Split the raster into two tiles sharing the middle column
+    m, n = raster.array.shape
+    k = n//2
+    tiles = [Rasterdata(shape=(m, k + 1),
+                        x_min=raster.x_min,
+                        y_max=raster.y_max,
+                        delta_x=raster.delta_x,
+                        delta_y=raster.delta_y,
+                        array=raster.array[:, :k + 1].copy(),
+                        coordinate_system=raster.coordinate_system,
+                        info={}),
+             Rasterdata(shape=(m, n - k),
+                        x_min=raster.x_min + k*raster.delta_x,
+                        y_max=raster.y_max,
+                        delta_x=raster.delta_x,
+                        delta_y=raster.delta_y,
+                        array=raster.array[:, k:].copy(),
+                        coordinate_system=raster.coordinate_system,
+                        info={})]
+
+    # The shared column is only sampled once, so the mosaic meshes exactly like the full raster
+    mesh = Mesh.from_raster(data=raster)
+    mosaic_mesh = Mesh.from_raster(data=tiles)
+    assert mosaic_mesh.num_points == mesh.num_points == m*n
+    assert mosaic_mesh.num_faces == mesh.num_faces
+
+    mesh = Mesh.from_raster(data=raster, domain=polygon)
+    for policy in ["priority", "blend"]:
+        mosaic_mesh = Mesh.from_raster(data=tiles, domain=polygon, mosaic_policy=policy)
+        assert mosaic_mesh.num_points == mesh.num_points
+        assert mosaic_mesh.num_faces == mesh.num_faces
+
+    # Abutting tiles share no sample column or row, leaving a one cell gap at each seam
+    def tile(rows, cols):
+        return Rasterdata(shape=(rows.stop - rows.start, cols.stop - cols.start),
+                          x_min=raster.x_min + cols.start*raster.delta_x,
+                          y_max=raster.y_max - rows.start*raster.delta_y,
+                          delta_x=raster.delta_x,
+                          delta_y=raster.delta_y,
+                          array=raster.array[rows, cols].copy(),
+                          coordinate_system=raster.coordinate_system,
+                          info={})
+
+    l = m//2
+    layouts = [[tile(slice(0, m), slice(0, k)), tile(slice(0, m), slice(k, n))],
+               [tile(slice(0, l), slice(0, k)), tile(slice(0, l), slice(k, n)),
+                tile(slice(l, m), slice(0, k)), tile(slice(l, m), slice(k, n))]]
+    mesh = Mesh.from_raster(data=raster)
+    x_max = raster.x_min + (n - 1)*raster.delta_x
+    y_min = raster.y_max - (m - 1)*raster.delta_y
+    for tiles in layouts:
+        for policy in ["priority", "blend"]:
+            mosaic_mesh = Mesh.from_raster(data=tiles, mosaic_policy=policy)
+            assert mosaic_mesh.num_points == m*n
+            assert mosaic_mesh.num_faces == mesh.num_faces
+
+            # The seams are closed: every edge used by a single face lies on the boundary of the union
+            faces = mosaic_mesh.faces
+            edges = np.sort(np.concatenate([faces[:, [0, 1]], faces[:, [1, 2]], faces[:, [2, 0]]]), axis=1)
+            edges, counts = np.unique(edges, axis=0, return_counts=True)
+            mid = mosaic_mesh.points[edges[counts == 1]].mean(axis=1)
+            inside = ((mid[:, 0] > raster.x_min + 1e-10) & (mid[:, 0] < x_max - 1e-10)
+                      & (mid[:, 1] > y_min + 1e-10) & (mid[:, 1] < raster.y_max - 1e-10))
+            assert not inside.any()
+
+
+def test_mesh_break_lines(raster, polygon):
+    # A square lake in the middle of the domain
+    lake = GeoPolygon(polygon=Polygon([(0.4, 0.4), (0.63, 0.42), (0.6, 0.61), (0.42, 0.6)]),
+                      crs=polygon.crs)
+    mesh = Mesh.from_raster(data=raster, domain=polygon, constraints=[lake])
+    edges = mesh.constrained_edges
+    assert len(edges) > 0
+
+    # The break lines are draped onto the raster along the lake boundary
+    assert all(lake.polygon.exterior.distance(Point(p[:2])) < 1e-10 for p in edges.reshape(-1, 3))
+
+    # Simplification keeps the break lines
+    coarse_mesh = mesh.simplify(ratio=0.3)
+    assert coarse_mesh.num_edges < mesh.num_edges
+    coarse_edges = coarse_mesh.constrained_edges
+    assert len(coarse_edges) == len(edges)
+    assert sorted(map(tuple, edges.reshape(-1, 6))) == sorted(map(tuple, coarse_edges.reshape(-1, 6)))
+
+
+def test_progressive_mesh(raster, tmp_path):
+    mesh = Mesh.from_raster(data=raster)
+    progressive_mesh = mesh.progressive()
+    assert progressive_mesh.num_points == mesh.num_points
+    assert progressive_mesh.min_num_points < mesh.num_points
+
+    full_mesh = progressive_mesh.extract()
+    assert full_mesh.num_points == mesh.num_points
+    assert full_mesh.num_faces == mesh.num_faces
+
+    # The collapse order does not depend on when simplification stops
+    coarse_mesh = mesh.simplify(ratio=0.5)
+    lod_mesh = progressive_mesh.extract(num_points=coarse_mesh.num_points)
+    assert lod_mesh.num_points == coarse_mesh.num_points
+    assert lod_mesh.num_faces == coarse_mesh.num_faces
+    assert sorted(map(tuple, lod_mesh.points)) == sorted(map(tuple, coarse_mesh.points))
+
+    path = tmp_path / "lod.npz"
+    progressive_mesh.save(path)
+    loaded_mesh = ProgressiveMesh.load(path).extract(num_points=coarse_mesh.num_points)
+    assert (loaded_mesh.points == lod_mesh.points).all()
+    assert (loaded_mesh.faces == lod_mesh.faces).all()
+
+
+def test_progressive_mesh_corrupt_file(raster, tmp_path):
+    path = tmp_path / "lod.npz"
+    Mesh.from_raster(data=raster).progressive().save(path)
+    with np.load(path) as data:
+        arrays = dict(data)
+
+    # A collapse into a vertex that does not exist
+    kept = arrays["kept"].copy()
+    kept[0] = len(arrays["points"])
+    np.savez(path, **dict(arrays, kept=kept))
+    with pytest.raises(IndexError):
+        ProgressiveMesh.load(path)
+
+    # Faces referring to points cut off the file
+    np.savez(path, **dict(arrays, points=arrays["points"][:len(arrays["points"])//2]))
+    with pytest.raises(IndexError):
+        ProgressiveMesh.load(path)
+
+
+def test_mesh_simplify_parallel():
+    # Dense enough to be split into partitions on any number of cores
+    m, n = 101, 101
+    x, y = meshgrid(linspace(0, 1, n), linspace(0, 1, m))
+    raster = Rasterdata(shape=(m, n),
+                        x_min=0,
+                        y_max=1,
+                        delta_x=1/(n - 1),
+                        delta_y=1/(m - 1),
+                        array=(sin(4*x)*cos(3*y)).astype(float32),
+                        coordinate_system="+init=epsg:32633",
+                        info={})
+    mesh = Mesh.from_raster(data=raster)
+    coarse_mesh = mesh.simplify(ratio=0.2, parallel=True)
+
+    # The global target is reached, and the result is a consistent mesh of the same domain
+    assert coarse_mesh.num_edges < 0.2*mesh.num_edges
+    assert len(coarse_mesh.points) == coarse_mesh.num_points
+    assert len(coarse_mesh.faces) == coarse_mesh.num_faces
+    assert coarse_mesh.characteristic == mesh.characteristic
+
+
+def test_mesh_simplify_vertical_error(raster):
+    mesh = Mesh.from_raster(data=raster)
+
+    # The raster is a smooth surface, so a loose tolerance removes most points
+    loose_mesh = mesh.simplify(max_vertical_error=0.05, data=raster)
+    tight_mesh = mesh.simplify(max_vertical_error=1e-3, data=raster)
+    assert loose_mesh.num_points < tight_mesh.num_points <= mesh.num_points
+    assert loose_mesh.characteristic == mesh.characteristic
+
+    # Every raster sample is within the tolerance of the simplified mesh
+    m, n = raster.array.shape
+    x, y = meshgrid(linspace(0, 1, n), linspace(1, 0, m))
+    p, f = loose_mesh.points, loose_mesh.faces
+    a, b, c = p[f[:, 0]], p[f[:, 1]], p[f[:, 2]]
+    area = (b[:, 0] - a[:, 0])*(c[:, 1] - a[:, 1]) - (c[:, 0] - a[:, 0])*(b[:, 1] - a[:, 1])
+    for qx, qy, qz in zip(x.ravel(), y.ravel(), raster.array.ravel()):
+        w1 = ((qx - a[:, 0])*(c[:, 1] - a[:, 1]) - (c[:, 0] - a[:, 0])*(qy - a[:, 1]))/area
+        w2 = ((b[:, 0] - a[:, 0])*(qy - a[:, 1]) - (qx - a[:, 0])*(b[:, 1] - a[:, 1]))/area
+        w0 = 1 - w1 - w2
+        k = np.argmax(np.minimum(np.minimum(w0, w1), w2))
+        assert abs(w0[k]*a[k, 2] + w1[k]*b[k, 2] + w2[k]*c[k, 2] - qz) <= 0.05 + 1e-5
+
+
+def test_mesh_reproject(raster_xm):
+    mesh = Mesh.from_raster(data=raster_xm)
+    geo_crs = pyproj.CRS.from_epsg(4326)
+    geo_mesh = mesh.reproject(geo_crs)
+
+    # Same connectivity, points as by pyproj in lon, lat order
+    assert np.array_equal(geo_mesh.faces, mesh.faces)
+    lon, lat = pyproj.Transformer.from_crs(pyproj.CRS.from_proj4(mesh.proj4_str), geo_crs,
+                                           always_xy=True).transform(mesh.points[:, 0], mesh.points[:, 1])
+    assert np.allclose(geo_mesh.points[:, 0], lon, atol=1e-9)
+    assert np.allclose(geo_mesh.points[:, 1], lat, atol=1e-9)
+    assert np.allclose(geo_mesh.points[:, 2], mesh.points[:, 2])
+
+    # And back again
+    assert np.allclose(geo_mesh.reproject(pyproj.CRS.from_epsg(32633)).points, mesh.points, atol=1e-5)
+
+    # Face centroids for the solar position are cached in geographic coordinates
+    centroids = np.asarray(mesh._cpp.geographic_centroids)
+    assert np.allclose(centroids, np.asarray(geo_mesh._cpp.geographic_centroids), atol=1e-7)
+
+    # EPSG codes are resolved by the extension itself
+    for definition in ["EPSG:4326", "+init=epsg:4326"]:
+        points = np.asarray(mesh._cpp.reproject(definition).points)
+        assert np.allclose(points, geo_mesh.points, atol=1e-9)
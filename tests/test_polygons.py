@@ -25,3 +25,21 @@ def circle_polygon():
 def test_intersection(rectangle_polygon, circle_polygon):
     polygon = rectangle_polygon.intersection(circle_polygon)
     assert polygon.num_parts() == 1
+
+
+def test_polygon_classifier(rectangle_polygon, circle_polygon):
+    import numpy as np
+
+    classifier = td.polygon_classifier()
+    # A frame with a hole, given as rings, is added before the circle and wins where they overlap
+    classifier.add(1, array([[0.0, 0.0], [1.0, 0.0], [1.0, 1.0], [0.0, 1.0]]),
+                   [array([[0.2, 0.2], [0.8, 0.2], [0.8, 0.8], [0.2, 0.8]])])
+    classifier.add(2, circle_polygon)
+    classifier.add(3, rectangle_polygon)
+    assert len(classifier) == 3
+
+    xy = array([[0.1, 0.5], [0.5, 0.5], [0.79, 0.5], [0.95, 0.5], [1.5, 0.5]])
+    labels = classifier.classify(xy)
+    assert labels.dtype == np.int32
+    assert list(labels) == [1, 2, 2, 1, -1]
+    assert classifier.classify(xy, default_label=0)[-1] == 0
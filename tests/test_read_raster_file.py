@@ -1,3 +1,4 @@
+import os
 import pytest
 import tempfile
 from contextlib import contextmanager
@@ -5,10 +6,15 @@ from pathlib import Path
 
 import numpy as np
 from PIL import Image, TiffImagePlugin
+import pyproj
 from shapely.geometry import Polygon
 
 from rasputin.reader import read_raster_file, crop_image_to_polygon, get_image_extents
-from rasputin.reader import GeoTiffTags
+from rasputin import reader
+from rasputin.geometry import GeoPolygon
+from rasputin.reader import GeoKeys, GeoTiffTags, PackedRTree, Rasterdata, warp_raster_data
+from rasputin.reader import RasterRepository, TileCatalog
+from rasputin.triangulate_dem import GeoTiff, downsample, raster_data_float, raster_reduction, sampling_policy
 
 @contextmanager
 def image_from_array(array: np.ndarray):
@@ -39,6 +45,21 @@ def image_from_array(array: np.ndarray):
         temp_path.unlink()
 
 
+
+def write_geotiff(path: Path, array: np.ndarray, *, x_min: float, y_max: float, delta: float, epsg: int = 32633):
+    # A GeoTIFF in a projected coordinate system given by its EPSG code
+    tags = TiffImagePlugin.ImageFileDirectory_v2()
+    tags[GeoTiffTags.ModelPixelScaleTag.value] = (float(delta), float(delta), 0.0)
+    tags[GeoTiffTags.ModelTiePointTag.value] = (0.0, 0.0, 0.0, float(x_min), float(y_max), 0.0)
+    tags[GeoTiffTags.GeoKeyDirectoryTag.value] = (1, 1, 0, 1, GeoKeys.ProjectedCSTypeGeoKey.value, 0, 1, epsg)
+    Image.fromarray(array).save(path, format="tiff", tiffinfo=tags)
+
+
+def bump_mtime(path: Path):
+    # Rewrites within the file system time resolution keep the modification time
+    stat = path.stat()
+    os.utime(path, ns=(stat.st_atime_ns, stat.st_mtime_ns + 10**9))
+
 @pytest.fixture
 def two_level_array():
     M, N = 24, 16
@@ -93,3 +114,301 @@ def test_image_crop(two_level_array, upper_half_rectangle):
 
         # Check contents
         assert not (sub_array - 2.0).any()
+
+
+@pytest.mark.parametrize("compression", [None, "tiff_lzw", "tiff_adobe_deflate"])
+def test_native_reader_window(random_array, compression):
+    array = random_array.astype(np.float32)
+    m, n = array.shape
+    tags = TiffImagePlugin.ImageFileDirectory_v2()
+    tags[GeoTiffTags.ModelPixelScaleTag.value] = (1, 1, 0)
+    tags[GeoTiffTags.ModelTiePointTag.value] = (0, 0, 0, 0, m - 1, 0)
+
+    _, temp_name = tempfile.mkstemp(suffix=".tif")
+    temp_path = Path(temp_name)
+    try:
+        Image.fromarray(array).save(temp_path, format="tiff", tiffinfo=tags, compression=compression)
+        tiff = GeoTiff(str(temp_path))
+
+        assert (tiff.height, tiff.width) == (m, n)
+        assert tiff.dtype == np.float32
+        assert tiff.is_mapped == (compression is None)
+        assert tuple(tiff.pixel_scale) == (1, 1, 0)
+        assert np.array_equal(tiff.read(row=0, col=0, rows=m, cols=n), array)
+        assert np.array_equal(tiff.read(row=5, col=3, rows=10, cols=7), array[5:15, 3:10])
+        with pytest.raises(IndexError):
+            tiff.read(row=m - 1, col=0, rows=2, cols=n)
+    finally:
+        temp_path.unlink()
+
+
+
+def rewrite_strip_entry(path: Path, tag: int, update):
+    # Replace each value v of the StripOffsets (273) or StripByteCounts (279) entry of a little endian TIFF with update(v)
+    data = bytearray(path.read_bytes())
+    assert data[:2] == b"II"
+    ifd = int.from_bytes(data[4:8], "little")
+    for e in range(int.from_bytes(data[ifd:ifd + 2], "little")):
+        entry = ifd + 2 + 12*e
+        if int.from_bytes(data[entry:entry + 2], "little") != tag:
+            continue
+        size = {3: 2, 4: 4}[int.from_bytes(data[entry + 2:entry + 4], "little")]
+        count = int.from_bytes(data[entry + 4:entry + 8], "little")
+        values = entry + 8 if count*size <= 4 else int.from_bytes(data[entry + 8:entry + 12], "little")
+        for k in range(count):
+            at = values + k*size
+            value = int.from_bytes(data[at:at + size], "little")
+            data[at:at + size] = update(value).to_bytes(size, "little")
+    path.write_bytes(bytes(data))
+
+
+def shorten_strips(path: Path, num_bytes: int):
+    # Cut num_bytes off each strip
+    rewrite_strip_entry(path, 279, lambda value: max(value - num_bytes, 1))
+
+
+@pytest.mark.parametrize("compression", [None, "tiff_lzw", "tiff_adobe_deflate"])
+def test_native_reader_truncated(random_array, compression):
+    # Short strip data must fail, not be read as zero samples
+    array = random_array.astype(np.float32)
+    _, temp_name = tempfile.mkstemp(suffix=".tif")
+    temp_path = Path(temp_name)
+    try:
+        Image.fromarray(array).save(temp_path, format="tiff", compression=compression)
+        shorten_strips(temp_path, 64)
+        tiff = GeoTiff(str(temp_path))
+        assert not tiff.is_mapped
+        with pytest.raises(RuntimeError):
+            tiff.read(row=0, col=0, rows=array.shape[0], cols=array.shape[1])
+    finally:
+        temp_path.unlink()
+
+@pytest.mark.parametrize("dtype, nodata, expected", [(np.float32, None, np.nan),
+                                                     (np.float32, "-9999", -9999),
+                                                     (np.uint8, "7", 7)])
+def test_native_reader_sparse(random_array, dtype, nodata, expected):
+    # Strips without data in the file read as nodata, or NaN for floating point samples without it
+    array = (10*abs(random_array)).astype(dtype)
+    m, n = array.shape
+    tags = TiffImagePlugin.ImageFileDirectory_v2()
+    if nodata is not None:
+        tags[42113] = nodata
+    _, temp_name = tempfile.mkstemp(suffix=".tif")
+    temp_path = Path(temp_name)
+    try:
+        Image.fromarray(array).save(temp_path, format="tiff", tiffinfo=tags)
+        rewrite_strip_entry(temp_path, 273, lambda value: 0)
+        rewrite_strip_entry(temp_path, 279, lambda value: 0)
+        tiff = GeoTiff(str(temp_path))
+        assert not tiff.is_mapped
+        values = tiff.read(row=0, col=0, rows=m, cols=n)
+        assert values.dtype == dtype
+        assert np.array_equal(values, np.full((m, n), expected, dtype=dtype), equal_nan=True)
+        assert np.array_equal(tiff.gather([[0, 0], [n - 1, m - 1]]), np.full(2, expected, dtype=dtype), equal_nan=True)
+    finally:
+        temp_path.unlink()
+
+@pytest.mark.parametrize("compression", [None, "tiff_lzw"])
+def test_native_reader_gather(random_array, compression):
+    # Categorical values, like the GlobCov land cover classes
+    rng = np.random.default_rng(1)
+    array = rng.integers(0, 230, size=random_array.shape, dtype=np.uint8)
+    m, n = array.shape
+    _, temp_name = tempfile.mkstemp(suffix=".tif")
+    temp_path = Path(temp_name)
+    try:
+        Image.fromarray(array).save(temp_path, format="tiff", compression=compression)
+        tiff = GeoTiff(str(temp_path))
+
+        indices = np.column_stack([rng.integers(0, n, 1000), rng.integers(0, m, 1000)])
+        values = tiff.gather(indices)
+        assert values.dtype == np.uint8
+        assert np.array_equal(values, array[indices[:, 1], indices[:, 0]])
+        assert np.array_equal(tiff.gather(indices[::-1]), values[::-1])
+        with pytest.raises(IndexError):
+            tiff.gather([[n, 0]])
+    finally:
+        temp_path.unlink()
+
+
+def test_packed_rtree_query():
+    rng = np.random.default_rng(0)
+    lower = rng.uniform(0, 100, size=(1000, 2))
+    boxes = np.hstack([lower, lower + rng.uniform(0.1, 5, size=(1000, 2))])
+    tree = PackedRTree(boxes)
+
+    for query in [(10, 10, 20, 30), (50, 50, 50, 50), (-10, -10, -1, -1), (-10, -10, 200, 200)]:
+        x_min, y_min, x_max, y_max = query
+        expected = np.flatnonzero((boxes[:, 0] <= x_max) & (boxes[:, 2] >= x_min) &
+                                  (boxes[:, 1] <= y_max) & (boxes[:, 3] >= y_min))
+        assert np.array_equal(tree.query(query), expected)
+
+
+def test_downsample():
+    array = np.arange(5*7, dtype=np.float32).reshape(5, 7)
+    array[0, 0] = -1
+    raster = raster_data_float(array, 0.0, 4.0, 1.0, 1.0, nodata=-1)
+
+    average = downsample(raster, 2, raster_reduction.average)
+    assert average.shape == (3, 4)
+    # Windows reach one point out from each coarse point, and skip nodata
+    assert average[0, 0] == pytest.approx(np.mean([1, 7, 8]))
+    assert average[1, 1] == pytest.approx(array[1:4, 1:4].mean())
+    assert downsample(raster, 2, raster_reduction.maximum)[2, 3] == array[3:, 5:].max()
+    assert np.array_equal(downsample(raster, 2, raster_reduction.nearest), array[::2, ::2])
+
+
+def test_raster_sample():
+    # Samples of the plane z = 2x + 3y on [0, 8] x [0, 4], with one void
+    x, y = np.meshgrid(np.linspace(0, 8, 17), np.linspace(4, 0, 9))
+    array = (2*x + 3*y).astype(np.float32)
+    array[4, 8] = -1
+    raster = raster_data_float(array, 0.0, 4.0, 0.5, 0.5, nodata=-1)
+
+    xy = np.array([[1.1, 0.3], [7.9, 3.6], [4.0, 2.0], [9.0, 1.0]])
+    for policy in [sampling_policy.bilinear, sampling_policy.bicubic]:
+        heights, gradients = raster.sample(xy, policy, True)
+        assert heights[:2] == pytest.approx(2*xy[:2, 0] + 3*xy[:2, 1], rel=1e-6)
+        assert gradients[:2] == pytest.approx(np.array([[2, 3], [2, 3]]), rel=1e-6)
+        assert np.isnan(heights[2:]).all() and np.isnan(gradients[2:]).all()
+
+    nearest = raster.sample(xy, sampling_policy.nearest)
+    assert nearest[0] == array[7, 2]
+
+
+def test_warp_raster_data():
+    # The plane z = x/100 + y/50 in UTM zone 33, near Oslo, with 100 m spacing
+    x_0, y_0, m, n = 221000.0, 6660000.0, 51, 41
+    x, y = np.meshgrid(np.arange(n)*100.0, -np.arange(m)*100.0)
+    raster = Rasterdata(shape=(m, n), x_min=x_0, y_max=y_0, delta_x=100, delta_y=100,
+                        array=(x/100 + y/50).astype(np.float32),
+                        coordinate_system="+proj=utm +zone=33 +datum=WGS84 +units=m +no_defs",
+                        info={})
+
+    # Onto its own grid, the raster is reproduced
+    same = warp_raster_data(data=[raster], target_crs=pyproj.CRS.from_epsg(32633), resolution=100)
+    assert (same.x_min, same.y_max) == (x_0, y_0)
+    assert np.array_equal(same.array[:m, :n], raster.array)
+
+    # Into zone 32, points inside the raster sample the plane at their zone 33 positions
+    warped = warp_raster_data(data=[raster], target_crs=pyproj.CRS.from_epsg(32632), resolution=200)
+    tx, ty = np.meshgrid(warped.x_min + np.arange(warped.shape[1])*200.0,
+                         warped.y_max - np.arange(warped.shape[0])*200.0)
+    transformer = pyproj.Transformer.from_crs(32632, 32633, always_xy=True)
+    sx, sy = transformer.transform(tx, ty)
+    inside = (sx > x_0 + 1) & (sx < x_0 + (n - 1)*100 - 1) & (sy < y_0 - 1) & (sy > y_0 - (m - 1)*100 + 1)
+    assert inside.sum() > 0.5*np.isfinite(warped.array).sum() > 0
+    assert np.isfinite(warped.array[inside]).all()
+    expected = (sx - x_0)/100 + (sy - y_0)/50
+    assert warped.array[inside] == pytest.approx(expected[inside], abs=1e-2)
+
+
+def test_raster_terrain_attributes():
+    # The plane z = 2x + 3y, with 0.5 spacing and one void
+    x, y = np.meshgrid(np.linspace(0, 8, 17), np.linspace(4, 0, 9))
+    array = (2*x + 3*y).astype(np.float32)
+    array[4, 8] = -1
+    raster = Rasterdata(shape=array.shape, x_min=0, y_max=4, delta_x=0.5, delta_y=0.5,
+                        array=array, coordinate_system="+init=epsg:32633", info={}, nodata=-1)
+
+    slopes = np.empty(array.shape)
+    attributes = raster.terrain_attributes(aspects=True, curvatures=True, out=dict(slopes=slopes))
+    assert attributes["slopes"] is slopes
+
+    # The normal of the plane is (-2, -3, 1), with slope and aspect as for mesh faces
+    valid = np.ones(array.shape, dtype=bool)
+    valid[[0, -1], :] = valid[:, [0, -1]] = False
+    valid[3:6, 7:10] = False
+    assert np.isnan(slopes[~valid]).all() and np.isnan(attributes["aspects"][~valid]).all()
+    assert slopes[valid] == pytest.approx(np.arctan(np.sqrt(13)))
+    assert attributes["aspects"][valid] == pytest.approx(np.arctan2(-2, -3))
+    assert attributes["curvatures"][valid] == pytest.approx(0, abs=1e-4)
+
+
+def test_tile_catalog(tmp_path, monkeypatch):
+    array = np.zeros((10, 10), dtype=np.float32)
+    write_geotiff(tmp_path / "a.tif", array, x_min=500000, y_max=6700000, delta=2)
+    write_geotiff(tmp_path / "b.tif", array, x_min=500010, y_max=6700000, delta=1)
+
+    # Finest resolution first, whatever the file names
+    catalog = TileCatalog(directory=tmp_path)
+    assert [t.filepath.name for t in catalog.tiles] == ["b.tif", "a.tif"]
+    assert catalog.tiles[1].box == (500000, 6699982, 500018, 6700000)
+    assert (tmp_path / TileCatalog.filename).exists()
+
+    opened = []
+    read_raster_info = reader.read_raster_info
+    def counting_read_raster_info(*, filepath):
+        opened.append(filepath.name)
+        return read_raster_info(filepath=filepath)
+    monkeypatch.setattr(reader, "read_raster_info", counting_read_raster_info)
+
+    # The stored catalog is reused without opening the files
+    assert TileCatalog(directory=tmp_path).tiles == catalog.tiles
+    assert opened == []
+
+    # A rewritten file is opened again, and only that one
+    write_geotiff(tmp_path / "a.tif", array, x_min=500000, y_max=6700000, delta=0.5)
+    bump_mtime(tmp_path / "a.tif")
+    catalog = TileCatalog(directory=tmp_path)
+    assert opened == ["a.tif"]
+    assert [t.filepath.name for t in catalog.tiles] == ["a.tif", "b.tif"]
+    assert catalog.tiles[0].delta_x == 0.5
+
+    # So is a touched file
+    opened.clear()
+    bump_mtime(tmp_path / "b.tif")
+    TileCatalog(directory=tmp_path)
+    assert opened == ["b.tif"]
+
+    # Deleted files are dropped, also from the stored catalog
+    opened.clear()
+    (tmp_path / "a.tif").unlink()
+    assert [t.filepath.name for t in TileCatalog(directory=tmp_path).tiles] == ["b.tif"]
+    assert [t.filepath.name for t in TileCatalog(directory=tmp_path).tiles] == ["b.tif"]
+    assert opened == []
+
+
+def test_raster_repository_overviews(tmp_path, monkeypatch):
+    rng = np.random.default_rng(2)
+    array = rng.uniform(0, 100, size=(32, 64)).astype(np.float32)
+    x_min, y_max = 500000.0, 6700000.0
+    write_geotiff(tmp_path / "tile.tif", array, x_min=x_min, y_max=y_max, delta=10)
+
+    repository = RasterRepository(directory=tmp_path, reduction="nearest")
+    tile = repository.catalog.tiles[0]
+
+    # Overviews keep the upper left corner, and scale the spacing by 2**level
+    overview = repository.overview(tile=tile, level=2)
+    assert overview.shape == (8, 16)
+    assert (overview.x_min, overview.y_max) == (x_min, y_max)
+    assert (overview.delta_x, overview.delta_y) == (40, 40)
+    assert np.array_equal(overview.array, array[::4, ::4])
+
+    # Each level is cached, and read back without downsampling
+    cache_dir = tmp_path / RasterRepository.overview_dirname
+    assert sorted(p.name for p in cache_dir.iterdir()) == ["tile.nearest.1.npy", "tile.nearest.2.npy"]
+    def fail(*args, **kwargs):
+        raise AssertionError("Overview rebuilt")
+    with monkeypatch.context() as patch:
+        patch.setattr(reader.triangulate_dem, "downsample", fail)
+        assert np.array_equal(repository.overview(tile=tile, level=2).array, array[::4, ::4])
+
+    # A changed tile invalidates the cache
+    write_geotiff(tmp_path / "tile.tif", array + 1, x_min=x_min, y_max=y_max, delta=10)
+    bump_mtime(tmp_path / "tile.tif")
+    assert np.array_equal(repository.overview(tile=tile, level=2).array, array[::4, ::4] + 1)
+
+    # The coarsest level within the resolution, coarsened further for max_points,
+    # but keeping at least two points in each direction of the tile
+    domain = GeoPolygon(polygon=Polygon.from_bounds(x_min + 1, y_max - 309, x_min + 629, y_max - 1), crs=tile.crs)
+    assert repository.overview_level(domain=domain) == 0
+    assert repository.overview_level(domain=domain, resolution=10) == 0
+    assert repository.overview_level(domain=domain, resolution=45) == 2
+    assert repository.overview_level(domain=domain, resolution=10**6) == 4
+    # About 1934 points inside the domain at level 0
+    assert repository.overview_level(domain=domain, max_points=500) == 1
+    assert repository.overview_level(domain=domain, max_points=200) == 2
+    assert repository.overview_level(domain=domain, resolution=25, max_points=10**6) == 1
+    [part] = repository.read(domain=domain, resolution=45)
+    assert (part.delta_x, part.delta_y) == (40, 40)